@@ -0,0 +1,163 @@
+// -------------------------------------------
+// Headless benchmark : renders the built-in scenes with a fixed
+// resolution, number of samples, seed and camera, and prints the
+// timings as JSON on the standard output (peak_rss_kb : peak of the
+// process so far).
+//
+// Usage : ./benchmark [--scene <name>]... [--width <w>] [--height <h>]
+//                     [--spp <n>] [--seed <n>] [--threads <n>]
+//                     [--warmup <n>] [--repeat <n>] [--trace <file.json>]
+// -------------------------------------------
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+
+#include <sys/resource.h>
+
+#include "src/Scene.h"
+#include "src/SceneRegistry.h"
+#include "src/Renderer.h"
+#include "src/Functions.h"
+#include "src/Trace.h"
+
+using namespace std;
+
+struct BenchOptions {
+    vector<string> scenes; // all if empty
+    RenderSettings settings;
+    unsigned int warmup, repeat;
+    string trace; // Chrome trace of the whole run, see Trace.h
+
+    BenchOptions() : warmup(1), repeat(3) {
+        settings.width = 320;
+        settings.height = 180;
+        settings.nsamples = 4;
+        settings.seed = 1;
+    }
+};
+
+static void usage() {
+    cerr << "Usage : ./benchmark [--scene <name>]... [--width <w>] [--height <h>] [--spp <n>] [--seed <n>] [--threads <n>] [--warmup <n>] [--repeat <n>] [--trace <file.json>]" << endl;
+    exit(EXIT_FAILURE);
+}
+
+static BenchOptions parse_options(int argc, char **argv) {
+    BenchOptions options;
+    for (int i = 1; i < argc; i++) {
+        if (i + 1 >= argc) usage();
+        string option = argv[i];
+        const char *value = argv[++i];
+        if (option == "--scene") options.scenes.push_back(value);
+        else if (option == "--width") options.settings.width = atoi(value);
+        else if (option == "--height") options.settings.height = atoi(value);
+        else if (option == "--spp") options.settings.nsamples = atoi(value);
+        else if (option == "--seed") options.settings.seed = strtoull(value, nullptr, 10);
+        else if (option == "--threads") options.settings.threads = atoi(value);
+        else if (option == "--warmup") options.warmup = atoi(value);
+        else if (option == "--repeat") options.repeat = atoi(value);
+        else if (option == "--trace") options.trace = value;
+        else usage();
+    }
+    if (options.settings.width == 0 || options.settings.height == 0 || options.settings.nsamples == 0 || options.repeat == 0) usage();
+    return options;
+}
+
+static string json_string(const string &s) {
+    string out = "\"";
+    for (char c : s) {
+        if (c == '"' || c == '\\') out += '\\';
+        out += c;
+    }
+    return out + "\"";
+}
+
+// Peak resident set size of the process so far
+static long peak_rss_kb() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+int main(int argc, char **argv) {
+    BenchOptions options = parse_options(argc, argv);
+    const RenderSettings &settings = options.settings;
+    float aspect_ratio = float(settings.width) / float(settings.height);
+
+    if (!options.trace.empty()) Trace::start(options.trace);
+    SceneRegistry scenes;
+    add_builtin_scenes(scenes, aspect_ratio);
+
+    vector<unsigned int> selected;
+    for (unsigned int i = 0; i < scenes.size(); i++) {
+        if (options.scenes.empty() || find(options.scenes.begin(), options.scenes.end(), scenes.name(i)) != options.scenes.end()) selected.push_back(i);
+    }
+    if (selected.size() < options.scenes.size()) {
+        cerr << "Unknown scene name" << endl;
+        return EXIT_FAILURE;
+    }
+
+    // The registry logs the builds on the standard output, keep it for the JSON
+    streambuf *json = cout.rdbuf();
+    ostringstream log;
+    ostringstream out;
+
+    out << "{" << endl;
+    out << "  \"width\": " << settings.width << ", \"height\": " << settings.height << ", \"spp\": " << settings.nsamples
+        << ", \"seed\": " << settings.seed << ", \"warmup\": " << options.warmup << ", \"repeat\": " << options.repeat << "," << endl;
+    out << "  \"scenes\": [";
+    for (unsigned int k = 0; k < selected.size(); k++) {
+        unsigned int index = selected[k];
+        // Scenes drawing random numbers in their setup get the same ones on every run
+        seed_random(settings.seed);
+        cout.rdbuf(log.rdbuf());
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        Scene &scene = scenes.get(index);
+        double setup_seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        cout.rdbuf(json);
+
+        Renderer renderer(scene, RenderCamera(scene.camera, aspect_ratio), settings);
+        vector<Vec3> image;
+        for (unsigned int i = 0; i < options.warmup; i++) renderer.render(image);
+        vector<double> seconds;
+        RenderStats stats;
+        for (unsigned int i = 0; i < options.repeat; i++) {
+            stats = renderer.render(image);
+            seconds.push_back(stats.seconds);
+        }
+        sort(seconds.begin(), seconds.end());
+        double median = seconds[seconds.size() / 2];
+        if (seconds.size() % 2 == 0) median = 0.5 * (median + seconds[seconds.size() / 2 - 1]);
+
+        // Every run traces the same rays, the rates use the median time
+        out << (k ? "," : "") << endl << "    {\"name\": " << json_string(scenes.name(index))
+            << ", \"setup_seconds\": " << setup_seconds - scene.kdtree_seconds << ", \"kdtree_seconds\": " << scene.kdtree_seconds
+            << ", \"threads\": " << stats.threads
+            << ", \"wall_seconds\": {\"min\": " << seconds.front() << ", \"median\": " << median << ", \"max\": " << seconds.back() << "}"
+            << ", \"counters\": {";
+        // Ray counts, and the detailed counters of a RENDER_STATS build
+        const char *separator = "";
+        stats.counters.for_each([&](const char *name, uint64_t value) {
+            out << separator << json_string(name) << ": " << value;
+            separator = ", ";
+        });
+        const RayCounters &c = stats.counters;
+        out << "}, \"mrays_per_second\": {\"primary\": " << c.primary / median * 1e-6 << ", \"secondary\": " << c.secondary / median * 1e-6
+            << ", \"shadow\": " << c.shadow / median * 1e-6 << ", \"total\": " << (c.primary + c.secondary + c.shadow) / median * 1e-6 << "}"
+            << ", \"peak_rss_kb\": " << peak_rss_kb() << "}";
+        cerr << scenes.name(index) << " : " << median << " s" << endl;
+    }
+    out << endl << "  ]," << endl;
+    out << "  \"peak_rss_kb\": " << peak_rss_kb() << endl << "}" << endl;
+    cout << out.str();
+    if (!options.trace.empty() && !Trace::stop()) {
+        cerr << "Could not write " << options.trace << endl;
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
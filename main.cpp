@@ -26,6 +26,9 @@
 #include "src/Vec3.h"
 #include "src/Camera.h"
 #include "src/Scene.h"
+#include "src/SceneRegistry.h"
+#include "src/Renderer.h"
+#include "src/Trace.h"
 #include <GL/glut.h>
 
 #include "src/matrixUtilities.h"
@@ -39,9 +42,6 @@ using namespace std;
 #include <time.h> 
 #include "src/Functions.h"
 
-#include <thread>
-#include <random>
-
 #include "src/Constants.h"
 
 // -------------------------------------------
@@ -59,9 +59,11 @@ static int lastX=0, lastY=0, lastZoom=0;
 static unsigned int FPS = 0;
 static bool fullScreen = false;
 
-std::vector<Scene> scenes;
+SceneRegistry scenes;
 unsigned int selected_scene;
+float aspect_ratio = float(SCREENWIDTH)/float(SCREENHEIGHT);
 unsigned int nsamples = DEFAULT_NSAMPLES;
+RenderMode render_mode = RenderMode_Color;
 
 MatrixUtilities matrixUtilities;
 
@@ -72,12 +74,14 @@ void printUsage () {
          << "gMini: a minimal OpenGL/GLUT application" << endl
          << "for 3D graphics." << endl
          << "Author : Tamy Boubekeur (http://www.labri.fr/~boubek)" << endl << endl
-         << "Usage : ./gmini [<file.off>]" << endl
+         << "Usage : ./main [<file.scene>]" << endl
          << "Keyboard commands" << endl
          << "------------------" << endl
          << " ?: Print help" << endl
          << " w: Toggle Wireframe Mode" << endl
          << " r: Ray trace the scene" << endl
+         << " t: Start / stop recording a timeline of the scene builds and renders (trace.json, Chrome trace format)" << endl
+         << " h: Cycle the render mode (color, heatmaps of KD-tree nodes, intersection tests, time per pixel)" << endl
          << " u: Recompute the random scenes" << endl
          << " f: Toggle full screen mode" << endl
          << " S/s: Increase/decrease the number of samples per pixel" << endl
@@ -137,7 +141,7 @@ void clear () {
 
 void draw () {
     glEnable(GL_LIGHTING);
-    scenes[selected_scene].draw();
+    scenes.get(selected_scene).draw();
 
     // draw rays : (for debug)
     //  std::cout << rays.size() << std::endl;
@@ -178,91 +182,57 @@ void idle () {
     glutPostRedisplay ();
 }
 
-thread_local std::mt19937 rng(std::random_device{}());
-
-void trace_line(int y, int w, int h, unsigned int nsamples, std::vector<Vec3>& image) {
-    Vec3 pos, dir;
-    std::uniform_real_distribution<float> dist(0.0f, 1.0f);
-
-    for (int x = 0; x < w; x++) {
-        for (unsigned int s = 0; s < nsamples; ++s) {
-            float u = ((float)(x) + dist(rng)) / w;
-            float v = ((float)(y) + dist(rng)) / h;
-            matrixUtilities.screen_space_to_world_space_ray(u, v, pos, dir);
-            Vec3 color = scenes[selected_scene].rayTrace(Ray(pos, dir, dist(rng)));
-            image[x + y * w] += color;
-        }
-        image[x + y * w] /= nsamples;
-        gamma_correct(image[x + y * w]);
-    }
-}
-
 void ray_trace_from_camera() {
     int w = glutGet(GLUT_WINDOW_WIDTH), h = glutGet(GLUT_WINDOW_HEIGHT);
-    std::vector<Vec3> image(w * h, Vec3(0, 0, 0));
-    std::vector<std::thread> threads;
+    std::vector<Vec3> image;
+
+    RenderSettings settings;
+    settings.width = w;
+    settings.height = h;
+    settings.nsamples = nsamples;
+    settings.threads = MULTI_THREADED ? 0 : 1;
+    settings.seed = time(nullptr);
+    settings.mode = render_mode;
+    RenderCamera render_camera(camera, float(w) / float(h));
 
-    unsigned int nb_threads;
-    if (MULTI_THREADED) {
-        nb_threads = std::thread::hardware_concurrency();
-    } else {
-        nb_threads = 1;
-    }
-    
-    camera.apply();
-    matrixUtilities.updated();
-    matrixUtilities.updateMatrices();
-    clock_t start = clock();
     if (MONORAY) {
         int x = 220;
         int y = 270;
         // send a ray to the x and y position of the final screen, and use the resulting color on all the screen
         std::cout << "Sending only one ray to the screen position (" << x << ", " << y << ") and using the resulting color for the whole image" << std::endl;
         Vec3 pos, dir;
-        matrixUtilities.screen_space_to_world_space_ray(x / (float)w, y / (float)h, pos, dir);
-        Vec3 color = scenes[selected_scene].rayTrace(Ray(pos, dir, 0.f));
+        render_camera.ray(x / (float)w, y / (float)h, pos, dir);
+        Vec3 color = scenes.get(selected_scene).rayTrace(Ray(pos, dir, 0.f));
         gamma_correct(color);
-        for (int i = 0; i < w * h; i++) {
-            image[i] = color;
-        }
+        image.assign(w * h, color);
     } else {
-        if (MULTI_THREADED) {
-            // multi-threading
-            std::cout << "Ray tracing a " << w << " x " << h << " image using " << nb_threads << " threads and " << nsamples << " samples per pixel" << std::endl;
-            for (int y = 0; y < h; y++) {
-                threads.emplace_back(trace_line, y, w, h, nsamples, std::ref(image));
-            }
-
-            for (auto& t : threads) {
-                t.join();
-            }
-        } else {
-            // single-threading
-            std::cout << "Ray tracing a " << w << " x " << h << " image using 1 thread and " << nsamples << " samples per pixel" << std::endl;
-            for (int y = 0; y < h; y++) {
-                trace_line(y, w, h, nsamples, image);
-            }
+        Renderer renderer(scenes.get(selected_scene), render_camera, settings);
+        RenderStats stats = renderer.render(image);
+        std::cout << "Ray tracing a " << w << " x " << h << " image using " << stats.threads << " threads and " << nsamples << " samples per pixel" << std::endl;
+        std::cout << "  Done in " << stats.seconds << " seconds" << std::endl;
+        print_counters(std::cout, stats.counters);
+        if (render_mode != RenderMode_Color) {
+            std::cout << "  Heatmap of " << render_mode_name(render_mode) << " per pixel, red : " << stats.heatmap_scale << std::endl;
         }
     }
 
-    clock_t end = clock();
-    std::cout << "  Done in " << (double)(end - start) / CLOCKS_PER_SEC / nb_threads << " seconds" << std::endl;
-
     // Save image
-    std::string filename = "./rendu.ppm";
-    ofstream f(filename.c_str(), ios::binary);
-    if (f.fail()) {
+    std::string filename = render_mode == RenderMode_Color ? "./rendu.ppm" : std::string("./rendu_") + render_mode_name(render_mode) + ".ppm";
+    if (!save_ppm(filename, w, h, image)) {
         cout << "Could not open file: " << filename << endl;
-        return;
     }
-    f << "P3" << std::endl << w << " " << h << std::endl << 255 << std::endl;
-    for (int i=0; i<w*h; i++)
-        f << (int)(255.f*std::min<float>(1.f,image[i][0])) << " " << (int)(255.f*std::min<float>(1.f,image[i][1])) << " " << (int)(255.f*std::min<float>(1.f,image[i][2])) << " ";
-    f << std::endl;
-    f.close();
 }
 
 
+// Builds the selected scene if needed, and its neighbours in the background
+void select_scene(unsigned int index) {
+    selected_scene = index;
+    Scene & scene = scenes.get(selected_scene);
+    if (scene.camera.defined) camera.setView(scene.camera.translation, scene.camera.zoom, scene.camera.rotation);
+    scenes.prebuild((selected_scene + 1) % scenes.size());
+    scenes.prebuild((selected_scene + scenes.size() - 1) % scenes.size());
+}
+
 void key (unsigned char keyPressed, int x, int y) {
     Vec3 pos , dir;
     switch (keyPressed) {
@@ -325,14 +295,31 @@ void key (unsigned char keyPressed, int x, int y) {
         
         break;
     case 'u':
-        scenes[5].setup_random_spheres();
+        scenes.rebuild(5);
+        break;
+    case 't':
+        if (Trace::enabled()) {
+            if (Trace::stop()) std::cout << "Timeline written to trace.json" << std::endl;
+            else std::cout << "Could not write trace.json" << std::endl;
+        } else {
+            Trace::start("trace.json");
+            std::cout << "Recording a timeline, press t again to write it" << std::endl;
+        }
+        break;
+    case 'h':
+        render_mode = RenderMode((render_mode + 1) % RenderMode_Count);
+        std::cout << "Render mode : " << render_mode_name(render_mode) << std::endl;
+#ifndef RENDER_STATS
+        if (render_mode == RenderMode_HeatmapNodes || render_mode == RenderMode_HeatmapTests) {
+            std::cout << "  Nodes and tests are only counted in a build with STATS=1, the heatmap will be empty" << std::endl;
+        }
+#endif
         break;
     case '-':
-        selected_scene = (selected_scene + scenes.size() - 1) % scenes.size();
+        select_scene((selected_scene + scenes.size() - 1) % scenes.size());
         break;
     case '+':
-        selected_scene++;
-        if( selected_scene >= scenes.size() ) selected_scene = 0;
+        select_scene((selected_scene + 1) % scenes.size());
         break;
     default:
         printUsage ();
@@ -388,7 +375,9 @@ void motion (int x, int y) {
 
 void reshape(int w, int h) {
     camera.resize (w, h);
-    scenes[2].setup_cornell_box(float(w)/float(h));
+    aspect_ratio = float(w)/float(h);
+    // Does not wait for the scenes being built in the background
+    scenes.set_parameter("aspect_ratio", aspect_ratio);
 }
 
 
@@ -417,19 +406,14 @@ int main (int argc, char ** argv) {
 
     camera.move(0., 0., -3.1);
     matrixUtilities = MatrixUtilities();
-    selected_scene=DEFAULT_SELECTED_SCENE;
-    scenes.resize(11);
-    scenes[0].setup_single_sphere();
-    scenes[1].setup_single_square();
-    scenes[2].setup_cornell_box(float(SCREENWIDTH)/float(SCREENHEIGHT));
-    scenes[3].setup_mesh();
-    scenes[4].setup_rt_in_a_weekend();
-    scenes[5].setup_random_spheres();
-    scenes[6].setup_debug_refraction();
-    scenes[7].setup_flamingo();
-    scenes[8].setup_raccoon();
-    scenes[9].setup_flamingo_pond();
-    scenes[10].setup_backrooms_pool();
+    // Scenes are built when first selected
+    add_builtin_scenes(scenes, aspect_ratio);
+    if (argc == 2) {
+        std::string filename = argv[1];
+        select_scene(scenes.add(filename, [filename](Scene & s) { s.setup_from_file(filename); }));
+    } else {
+        select_scene(DEFAULT_SELECTED_SCENE);
+    }
 
 
     glutMainLoop ();
@@ -0,0 +1,255 @@
+// -------------------------------------------
+// Micro-benchmarks of the intersection and shading kernels, each one
+// timed alone on pre-generated ray sets :
+//   coherent : pinhole camera rays through the test object
+//   random   : random origins around the object, random directions
+//   shadow   : from points of the object towards a light above it
+// Every kernel runs in several samples of ~10 ms, the table gives the
+// mean time per call with its 95% confidence interval and the
+// throughput of the median sample.
+//
+// Usage : ./microbench [--filter <substring>] [--samples <n>]
+// -------------------------------------------
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <cmath>
+#include <cstdlib>
+
+#include "src/Scene.h"
+#include "src/Mesh.h"
+#include "src/Sphere.h"
+#include "src/Square.h"
+#include "src/Triangle.h"
+#include "src/AABB.h"
+#include "src/Material.h"
+#include "src/TextureCache.h"
+#include "src/Functions.h"
+
+using namespace std;
+
+static const unsigned int NRAYS = 4096;
+
+// Results are accumulated here so that the compiler cannot drop the calls
+static volatile float sink;
+
+struct RaySet {
+    string name;
+    vector<Ray> rays;
+};
+
+static Vec3 random_in_box(const Vec3 &lo, const Vec3 &hi) {
+    return Vec3(random_float(lo[0], hi[0]), random_float(lo[1], hi[1]), random_float(lo[2], hi[2]));
+}
+
+// Rays aimed at the box [lo, hi] (the test objects are placed in it)
+static vector<RaySet> make_ray_sets(const Vec3 &lo, const Vec3 &hi) {
+    vector<RaySet> sets(3);
+    Vec3 center = 0.5f * (lo + hi), extent = hi - lo;
+    float size = extent.length();
+
+    sets[0].name = "coherent";
+    unsigned int side = (unsigned int)sqrtf(NRAYS);
+    Vec3 eye = center + Vec3(0., 0., 2.f * size);
+    for (unsigned int y = 0; y < side; y++) {
+        for (unsigned int x = 0; x < side; x++) {
+            Vec3 target = center + Vec3((x + 0.5f) / side - 0.5f, 0.5f - (y + 0.5f) / side, 0.) * size;
+            Vec3 d = target - eye;
+            d.normalize();
+            sets[0].rays.push_back(Ray(eye, d, 0.f));
+        }
+    }
+
+    sets[1].name = "random";
+    for (unsigned int i = 0; i < NRAYS; i++) {
+        Vec3 o = random_in_box(center - extent, center + extent);
+        sets[1].rays.push_back(Ray(o, random_unit_vector(), 0.f));
+    }
+
+    sets[2].name = "shadow";
+    Vec3 light = center + Vec3(0., 2.f * size, 0.);
+    for (unsigned int i = 0; i < NRAYS; i++) {
+        Vec3 o = random_in_box(lo, hi);
+        Vec3 d = light - o;
+        d.normalize();
+        sets[2].rays.push_back(Ray(o + d * EPSILON, d, 0.f));
+    }
+    return sets;
+}
+
+struct Result {
+    string kernel, rays;
+    double mean_ns, ci_ns, median_mops;
+};
+
+// kernel(i) does one call on the i-th input, returns something to keep
+static Result run(const string &kernel, const string &rays, unsigned int n, unsigned int samples, const function<float(unsigned int)> &body) {
+    // Calibration : enough passes over the inputs for ~10 ms per sample
+    unsigned int passes = 1;
+    for (;;) {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        float acc = 0.f;
+        for (unsigned int p = 0; p < passes; p++)
+            for (unsigned int i = 0; i < n; i++) acc += body(i);
+        sink = acc;
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        if (seconds > 0.01 || passes >= (1u << 20)) break;
+        passes *= 2;
+    }
+
+    vector<double> ns;
+    for (unsigned int s = 0; s < samples; s++) {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        float acc = 0.f;
+        for (unsigned int p = 0; p < passes; p++)
+            for (unsigned int i = 0; i < n; i++) acc += body(i);
+        sink = acc;
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        ns.push_back(seconds * 1e9 / (double(passes) * n));
+    }
+
+    double mean = 0.;
+    for (double x : ns) mean += x;
+    mean /= ns.size();
+    double variance = 0.;
+    for (double x : ns) variance += (x - mean) * (x - mean);
+    variance /= max<size_t>(ns.size() - 1, 1);
+    sort(ns.begin(), ns.end());
+
+    Result result;
+    result.kernel = kernel;
+    result.rays = rays;
+    result.mean_ns = mean;
+    result.ci_ns = 1.96 * sqrt(variance / ns.size());
+    result.median_mops = 1e3 / ns[ns.size() / 2];
+    return result;
+}
+
+int main(int argc, char **argv) {
+    string filter;
+    unsigned int samples = 15;
+    for (int i = 1; i < argc; i += 2) {
+        string option = argv[i];
+        if (i + 1 < argc && option == "--filter") filter = argv[i + 1];
+        else if (i + 1 < argc && option == "--samples") samples = max(2, atoi(argv[i + 1]));
+        else {
+            cerr << "Usage : ./microbench [--filter <substring>] [--samples <n>]" << endl;
+            return EXIT_FAILURE;
+        }
+    }
+    seed_random(1);
+
+    // Test objects, all inside [-1, 1]^3
+    Mesh mesh;
+    mesh.loadOFF("mesh/flamingo.off");
+    mesh.centerAndScaleToUnit();
+    mesh.build_arrays();
+    mesh.computeKDTree();
+
+    vector<Sphere> spheres;
+    for (unsigned int i = 0; i < 16; i++) spheres.push_back(Sphere(random_in_box(Vec3(-0.8), Vec3(0.8)), random_float(0.05, 0.3)));
+    Square square(Vec3(-1., -1., 0.), Vec3(1., 0., 0.), Vec3(0., 1., 0.), 2., 2.);
+
+    vector<Triangle> triangles;
+    for (unsigned int t = 0; t < min(256u, mesh.triangleCount()); t++) {
+        MeshTriangle tri = mesh.triangle(t * (mesh.triangleCount() / 256));
+        triangles.push_back(Triangle(mesh.positions[tri[0]], mesh.positions[tri[1]], mesh.positions[tri[2]]));
+    }
+
+    vector<Material> materials(3);
+    materials[1].type = Material_Mirror;
+    materials[2].type = Material_Glass;
+    materials[2].index_medium = 1.5;
+    Material checker;
+    checker.texture_type = Texture_Checkerboard;
+    checker.checkerboard_color1 = Vec3(1.);
+    checker.checkerboard_color2 = Vec3(0.);
+    checker.texture_scale_x = checker.texture_scale_y = 8.;
+    TextureHandle image = TextureCache::get("img/planeTextures/brickwall.ppm");
+    Material textured;
+    textured.texture_type = Texture_Image;
+    textured.set_texture(image.get());
+
+    Scene scene;
+    scene.loadSkybox("img/planeTextures/sand.ppm");
+
+    vector<RaySet> sets = make_ray_sets(Vec3(-1.), Vec3(1.));
+    // Shading inputs : uniform uvs, footprints (half of them 0, finest level), random normals
+    vector<float> us(NRAYS), vs(NRAYS), footprints(NRAYS);
+    vector<Vec3> normals(NRAYS);
+    for (unsigned int i = 0; i < NRAYS; i++) {
+        us[i] = random_float();
+        vs[i] = random_float();
+        footprints[i] = random_float() < 0.5f ? 0.f : random_float(0., 0.05);
+        normals[i] = random_unit_vector();
+    }
+
+    vector<Result> results;
+    auto bench = [&](const string &kernel, const string &rays, const function<float(unsigned int)> &body) {
+        if (!filter.empty() && (kernel + " " + rays).find(filter) == string::npos) return;
+        results.push_back(run(kernel, rays, NRAYS, samples, body));
+        const Result &r = results.back();
+        cout << left << setw(28) << r.kernel << setw(10) << r.rays << right << fixed << setprecision(2)
+             << setw(10) << r.mean_ns << " ns +- " << setw(6) << r.ci_ns << setw(10) << r.median_mops << " Mops/s" << endl;
+    };
+
+    cout << left << setw(28) << "kernel" << setw(10) << "rays" << right << setw(10) << "mean" << "       95%" << setw(10) << "median" << endl;
+    for (const RaySet &set : sets) {
+        const vector<Ray> &rays = set.rays;
+        bench("Sphere::intersect", set.name, [&](unsigned int i) {
+            return spheres[i % spheres.size()].intersect(rays[i]).t;
+        });
+        bench("Sphere::intersect4", set.name, [&](unsigned int i) {
+            float t[4];
+            Sphere::intersect4(rays[i], &spheres[4 * (i % (spheres.size() / 4))], 4, t);
+            return t[0];
+        });
+        bench("Square::intersect", set.name, [&](unsigned int i) {
+            return square.intersect(rays[i]).t;
+        });
+        bench("Triangle::getIntersection", set.name, [&](unsigned int i) {
+            return triangles[i % triangles.size()].getIntersection(rays[i]).t;
+        });
+        bench("AABB::intersects", set.name, [&](unsigned int i) {
+            return (float)mesh.aabb.intersects(rays[i]);
+        });
+        bench("KDTree::intersect", set.name, [&](unsigned int i) {
+            return mesh.kdtree->intersect(rays[i]).t;
+        });
+        bench("Material::scatter diffuse", set.name, [&](unsigned int i) {
+            Ray out;
+            materials[0].scatter(rays[i], normals[i], rays[i].origin(), out);
+            return out.direction()[0];
+        });
+        bench("Material::scatter mirror", set.name, [&](unsigned int i) {
+            Ray out;
+            materials[1].scatter(rays[i], normals[i], rays[i].origin(), out);
+            return out.direction()[0];
+        });
+        bench("Material::scatter glass", set.name, [&](unsigned int i) {
+            Ray out;
+            materials[2].scatter(rays[i], normals[i], rays[i].origin(), out);
+            return out.direction()[0];
+        });
+        bench("Scene::skyboxTexture", set.name, [&](unsigned int i) {
+            return scene.skyboxTexture(rays[i].direction(), 1)[0];
+        });
+    }
+    // Texture lookups do not depend on rays
+    bench("Material::texture checker", "uv", [&](unsigned int i) {
+        Vec3 color;
+        checker.texture(color, us[i], vs[i], footprints[i], footprints[i]);
+        return color[0];
+    });
+    bench("Material::texture image", "uv", [&](unsigned int i) {
+        Vec3 color;
+        textured.texture(color, us[i], vs[i], footprints[i], footprints[i]);
+        return color[0];
+    });
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,225 @@
+// -------------------------------------------
+// Image regression : renders the built-in scenes headless with a fixed
+// seed and compares them with reference renders (PSNR, SSIM on the
+// luminance, fraction of pixels off by more than a tolerance). On
+// failure a diff image (error x 10) is written next to the references.
+//
+// Quick mode (default) is meant for every change. Nightly mode renders
+// at a higher resolution and number of samples : noise changes (RNG,
+// sampling) only pass there.
+//
+// Usage : ./regress [--nightly] [--update] [--scene <name>]...
+//                   [--dir <directory>] [--psnr <dB>] [--ssim <s>]
+//                   [--tolerance <t>] [--max-bad <fraction>]
+// References are made with --update (on a known good tree) in
+// reference/quick or reference/nightly, they are not versioned : the
+// renders depend on the compiler flags (ARCHFLAGS) and on the textures
+// present.
+// -------------------------------------------
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+#include <sys/stat.h>
+
+#include "src/Scene.h"
+#include "src/SceneRegistry.h"
+#include "src/Renderer.h"
+#include "src/Functions.h"
+
+using namespace std;
+
+struct RegressOptions {
+    vector<string> scenes; // all if empty
+    bool nightly, update;
+    string dir;
+    RenderSettings settings;
+    double min_psnr, min_ssim;
+    float tolerance;   // per channel
+    double max_bad;    // fraction of the pixels beyond the tolerance
+
+    RegressOptions() : nightly(false), update(false), min_psnr(-1.), min_ssim(-1.), tolerance(-1.f), max_bad(-1.) {
+        settings.seed = 1;
+    }
+};
+
+static void usage() {
+    cerr << "Usage : ./regress [--nightly] [--update] [--scene <name>]... [--dir <directory>] [--psnr <dB>] [--ssim <s>] [--tolerance <t>] [--max-bad <fraction>]" << endl;
+    exit(EXIT_FAILURE);
+}
+
+static RegressOptions parse_options(int argc, char **argv) {
+    RegressOptions options;
+    for (int i = 1; i < argc; i++) {
+        string option = argv[i];
+        if (option == "--nightly") { options.nightly = true; continue; }
+        if (option == "--update") { options.update = true; continue; }
+        if (i + 1 >= argc) usage();
+        const char *value = argv[++i];
+        if (option == "--scene") options.scenes.push_back(value);
+        else if (option == "--dir") options.dir = value;
+        else if (option == "--psnr") options.min_psnr = atof(value);
+        else if (option == "--ssim") options.min_ssim = atof(value);
+        else if (option == "--tolerance") options.tolerance = atof(value);
+        else if (option == "--max-bad") options.max_bad = atof(value);
+        else usage();
+    }
+    // Thresholds not given on the command line : the nightly renders have less noise and must be closer
+    RenderSettings &s = options.settings;
+    if (options.nightly) {
+        s.width = 480;  s.height = 270;  s.nsamples = 256;
+        if (options.min_psnr < 0.) options.min_psnr = 35.;
+        if (options.min_ssim < 0.) options.min_ssim = 0.97;
+        if (options.tolerance < 0.f) options.tolerance = 0.05f;
+    } else {
+        s.width = 160;  s.height = 90;  s.nsamples = 4;
+        if (options.min_psnr < 0.) options.min_psnr = 30.;
+        if (options.min_ssim < 0.) options.min_ssim = 0.95;
+        if (options.tolerance < 0.f) options.tolerance = 0.1f;
+    }
+    if (options.max_bad < 0.) options.max_bad = 0.01;
+    if (options.dir.empty()) options.dir = options.nightly ? "reference/nightly" : "reference/quick";
+    return options;
+}
+
+// Images are kept as float (PFM, little endian, bottom to top rows) to compare the renders before quantization
+static bool save_pfm(const string &filename, unsigned int w, unsigned int h, const vector<Vec3> &image) {
+    ofstream f(filename.c_str(), ios::binary);
+    if (f.fail()) return false;
+    f << "PF\n" << w << " " << h << "\n-1.0\n";
+    for (int y = h - 1; y >= 0; y--) f.write((const char *)&image[y * w], w * sizeof(Vec3));
+    return !f.fail();
+}
+
+static bool load_pfm(const string &filename, unsigned int &w, unsigned int &h, vector<Vec3> &image) {
+    ifstream f(filename.c_str(), ios::binary);
+    string magic;
+    float scale;
+    if (!(f >> magic >> w >> h >> scale) || magic != "PF" || scale >= 0.f) return false;
+    f.get();
+    image.resize(w * h);
+    for (int y = h - 1; y >= 0; y--) f.read((char *)&image[y * w], w * sizeof(Vec3));
+    return !f.fail();
+}
+
+static float luma(const Vec3 &c) {
+    return 0.2126f * min(c[0], 1.f) + 0.7152f * min(c[1], 1.f) + 0.0722f * min(c[2], 1.f);
+}
+
+struct Comparison {
+    double psnr, ssim, bad;
+};
+
+// Colors clamped to [0, 1]. SSIM : mean over 7x7 windows of the luminance, with the usual constants
+static Comparison compare(unsigned int w, unsigned int h, const vector<Vec3> &a, const vector<Vec3> &b, float tolerance) {
+    Comparison result;
+    double se = 0.;
+    unsigned int bad = 0;
+    for (unsigned int i = 0; i < w * h; i++) {
+        float worst = 0.f;
+        for (int c = 0; c < 3; c++) {
+            float d = min(max(a[i][c], 0.f), 1.f) - min(max(b[i][c], 0.f), 1.f);
+            se += d * d;
+            worst = max(worst, fabsf(d));
+        }
+        if (worst > tolerance) bad++;
+    }
+    double mse = se / (3. * w * h);
+    result.psnr = mse > 0. ? 10. * log10(1. / mse) : INFINITY;
+    result.bad = double(bad) / (w * h);
+
+    const int r = 3;
+    const double c1 = 0.01 * 0.01, c2 = 0.03 * 0.03;
+    double ssim = 0.;
+    unsigned int windows = 0;
+    for (int y = r; y + r < (int)h; y++) {
+        for (int x = r; x + r < (int)w; x++) {
+            double ma = 0., mb = 0., vaa = 0., vbb = 0., vab = 0.;
+            for (int dy = -r; dy <= r; dy++) {
+                for (int dx = -r; dx <= r; dx++) {
+                    double la = luma(a[(y + dy) * w + x + dx]), lb = luma(b[(y + dy) * w + x + dx]);
+                    ma += la;  mb += lb;
+                    vaa += la * la;  vbb += lb * lb;  vab += la * lb;
+                }
+            }
+            double n = (2 * r + 1) * (2 * r + 1);
+            ma /= n;  mb /= n;
+            vaa = vaa / n - ma * ma;  vbb = vbb / n - mb * mb;  vab = vab / n - ma * mb;
+            ssim += ((2 * ma * mb + c1) * (2 * vab + c2)) / ((ma * ma + mb * mb + c1) * (vaa + vbb + c2));
+            windows++;
+        }
+    }
+    result.ssim = windows ? ssim / windows : 1.;
+    return result;
+}
+
+int main(int argc, char **argv) {
+    RegressOptions options = parse_options(argc, argv);
+    const RenderSettings &settings = options.settings;
+    float aspect_ratio = float(settings.width) / float(settings.height);
+
+    SceneRegistry scenes;
+    add_builtin_scenes(scenes, aspect_ratio);
+    vector<unsigned int> selected;
+    for (unsigned int i = 0; i < scenes.size(); i++) {
+        if (options.scenes.empty() || find(options.scenes.begin(), options.scenes.end(), scenes.name(i)) != options.scenes.end()) selected.push_back(i);
+    }
+    if (selected.size() < options.scenes.size()) {
+        cerr << "Unknown scene name" << endl;
+        return EXIT_FAILURE;
+    }
+    if (options.update) {
+        mkdir("reference", 0755);
+        mkdir(options.dir.c_str(), 0755);
+    }
+
+    cout << (options.nightly ? "Nightly" : "Quick") << " regression, " << settings.width << " x " << settings.height << ", "
+         << settings.nsamples << " spp, references in " << options.dir << endl;
+    unsigned int failures = 0;
+    for (unsigned int index : selected) {
+        const string &name = scenes.name(index);
+        seed_random(settings.seed);
+        Scene &scene = scenes.get(index);
+        vector<Vec3> image;
+        Renderer(scene, RenderCamera(scene.camera, aspect_ratio), settings).render(image);
+
+        string reference = options.dir + "/" + name + ".pfm";
+        if (options.update) {
+            if (!save_pfm(reference, settings.width, settings.height, image)) {
+                cout << "FAIL   " << name << " : could not write " << reference << endl;
+                failures++;
+            } else {
+                cout << "UPDATE " << name << endl;
+            }
+            continue;
+        }
+
+        unsigned int w, h;
+        vector<Vec3> expected;
+        if (!load_pfm(reference, w, h, expected) || w != settings.width || h != settings.height) {
+            cout << "FAIL   " << name << " : no reference " << reference << " at this size, run with --update on a known good tree" << endl;
+            failures++;
+            continue;
+        }
+        Comparison c = compare(w, h, image, expected, options.tolerance);
+        bool pass = c.psnr >= options.min_psnr && c.ssim >= options.min_ssim && c.bad <= options.max_bad;
+        cout << (pass ? "PASS   " : "FAIL   ") << name << " : PSNR " << c.psnr << " dB, SSIM " << c.ssim
+             << ", " << 100. * c.bad << "% pixels off by more than " << options.tolerance << endl;
+        if (!pass) {
+            failures++;
+            vector<Vec3> diff(w * h);
+            for (unsigned int i = 0; i < w * h; i++) {
+                for (int k = 0; k < 3; k++) diff[i][k] = 10.f * fabsf(min(image[i][k], 1.f) - min(expected[i][k], 1.f));
+            }
+            save_ppm(options.dir + "/" + name + ".diff.ppm", w, h, diff);
+            save_ppm(options.dir + "/" + name + ".new.ppm", w, h, image);
+        }
+    }
+    if (failures) cout << failures << " of " << selected.size() << " scenes failed" << endl;
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,230 @@
+// -------------------------------------------
+// Headless render of a built-in scene with checkpoints : the samples
+// are added in passes of --pass-spp samples per pixel, and the float
+// sums and sample counts are saved every --interval seconds (and after
+// the last pass). After a crash or a kill, --resume continues from the
+// last checkpoint and gives the same image as an uninterrupted run.
+//
+// Usage : ./render --scene <name> [--width <w>] [--height <h>]
+//                  [--spp <n>] [--pass-spp <n>] [--seed <n>]
+//                  [--threads <n>] [--checkpoint <file>]
+//                  [--interval <seconds>] [--resume] [--output <file.ppm>]
+//                  [--workers <n>] [--band <lines>] [--timeout <seconds>]
+//                  [--worker-command <cmd>] [--sequence]
+//        ./render --worker
+// --spp is rounded up to a multiple of --pass-spp.
+//
+// With --workers <n>, the passes are rendered by n worker processes
+// (see RenderFarm.h), in bands of --band lines, with --threads threads
+// each (1 by default). --worker-command <cmd> starts them with sh -c
+// instead of running this executable with --worker, which serves one
+// coordinator on stdin / stdout. These renders do not checkpoint.
+//
+// With --sequence, the frames of an animated scene file (see frames in
+// SceneLoader.cpp) are written to <output>_0000.ppm and on. Two copies
+// of the scene are loaded : while one renders a frame, the animated
+// meshes of the other are placed for the next one, the trees of the
+// static meshes are built once.
+// -------------------------------------------
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdlib>
+#include <cstdio>
+#include <future>
+
+#include "src/Scene.h"
+#include "src/SceneRegistry.h"
+#include "src/Renderer.h"
+#include "src/Functions.h"
+#include "src/RenderFarm.h"
+
+#include <unistd.h>
+
+using namespace std;
+
+struct RenderOptions {
+    string scene;
+    RenderSettings settings; // nsamples : per pass
+    unsigned int spp;
+    string checkpoint, output;
+    double interval;
+    bool resume, sequence;
+    RenderFarmSettings farm;
+
+    RenderOptions() : spp(1000), checkpoint("rendu.checkpoint"), output("rendu.ppm"), interval(60.), resume(false), sequence(false) {
+        settings.nsamples = 8;
+        settings.seed = 1;
+    }
+};
+
+static void usage() {
+    cerr << "Usage : ./render --scene <name> [--width <w>] [--height <h>] [--spp <n>] [--pass-spp <n>] [--seed <n>] [--threads <n>] [--checkpoint <file>] [--interval <seconds>] [--resume] [--output <file.ppm>]"
+            " [--workers <n>] [--band <lines>] [--timeout <seconds>] [--worker-command <cmd>] [--sequence]" << endl;
+    cerr << "        ./render --worker" << endl;
+    exit(EXIT_FAILURE);
+}
+
+static RenderOptions parse_options(int argc, char **argv) {
+    RenderOptions options;
+    for (int i = 1; i < argc; i++) {
+        string option = argv[i];
+        if (option == "--resume") { options.resume = true; continue; }
+        if (option == "--sequence") { options.sequence = true; continue; }
+        if (i + 1 >= argc) usage();
+        const char *value = argv[++i];
+        if (option == "--scene") options.scene = value;
+        else if (option == "--width") options.settings.width = atoi(value);
+        else if (option == "--height") options.settings.height = atoi(value);
+        else if (option == "--spp") options.spp = atoi(value);
+        else if (option == "--pass-spp") options.settings.nsamples = atoi(value);
+        else if (option == "--seed") options.settings.seed = strtoull(value, nullptr, 10);
+        else if (option == "--threads") options.settings.threads = atoi(value);
+        else if (option == "--checkpoint") options.checkpoint = value;
+        else if (option == "--interval") options.interval = atof(value);
+        else if (option == "--output") options.output = value;
+        else if (option == "--workers") options.farm.workers = atoi(value);
+        else if (option == "--band") options.farm.band = atoi(value);
+        else if (option == "--timeout") options.farm.timeout = atof(value);
+        else if (option == "--worker-command") options.farm.worker_command = value;
+        else usage();
+    }
+    if (options.scene.empty() || options.settings.width == 0 || options.settings.height == 0 || options.settings.nsamples == 0) usage();
+    if (options.farm.workers && options.resume) usage();
+    if (options.sequence && (options.farm.workers || options.resume)) usage();
+    if (options.farm.workers && options.settings.threads == 0) options.settings.threads = 1;
+    return options;
+}
+
+// Two copies of the scene : one is placed for the next frame (on another thread) while the other one renders
+static int render_sequence(const RenderOptions &options, unsigned int passes) {
+    const RenderSettings &settings = options.settings;
+    float aspect_ratio = float(settings.width) / float(settings.height);
+    SceneRegistry registries[2];
+    Scene *scenes[2];
+    for (int k = 0; k < 2; k++) {
+        add_builtin_scenes(registries[k], aspect_ratio);
+        unsigned int index = find_scene(registries[k], options.scene);
+        if (index == registries[k].size()) {
+            cerr << "Unknown scene name" << endl;
+            return EXIT_FAILURE;
+        }
+        seed_random(settings.seed);
+        scenes[k] = &registries[k].get(index);
+    }
+    unsigned int frames = scenes[0]->animation.frames;
+    if (frames == 0) {
+        cerr << "Scene " << options.scene << " has no frames statement, it is not animated" << endl;
+        return EXIT_FAILURE;
+    }
+    string prefix = options.output;
+    if (prefix.size() > 4 && prefix.compare(prefix.size() - 4, 4, ".ppm") == 0) prefix.resize(prefix.size() - 4);
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    scenes[0]->animate(0.f);
+    double render_seconds = 0.;
+    for (unsigned int frame = 0; frame < frames; frame++) {
+        chrono::steady_clock::time_point frame_start = chrono::steady_clock::now();
+        future<double> next;
+        if (frame + 1 < frames) {
+            Scene *other = scenes[(frame + 1) % 2];
+            next = async(launch::async, [other, frame]() {
+                chrono::steady_clock::time_point start = chrono::steady_clock::now();
+                other->animate(frame + 1.f);
+                return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+            });
+        }
+
+        // Noise of its own for each frame, frame 0 is the still render
+        RenderSettings frame_settings = settings;
+        if (frame > 0) frame_settings.seed = hash_bytes(&frame, sizeof(frame), settings.seed);
+        Scene &scene = *scenes[frame % 2];
+        Renderer renderer(scene, RenderCamera(scene.camera_at(frame), aspect_ratio), frame_settings);
+        RenderAccumulation accumulation(frame_settings, 0);
+        double seconds = 0.;
+        while (accumulation.passes < passes) seconds += renderer.accumulate(accumulation).seconds;
+        render_seconds += seconds;
+        vector<Vec3> image;
+        accumulation.resolve(image);
+        char number[16];
+        snprintf(number, sizeof(number), "_%04u.ppm", frame);
+        if (!save_ppm(prefix + number, settings.width, settings.height, image)) cerr << "Could not open file: " << prefix + number << endl;
+
+        double setup_seconds = next.valid() ? next.get() : 0.;
+        cout << "Frame " << frame + 1 << " / " << frames << " : " << chrono::duration<double>(chrono::steady_clock::now() - frame_start).count()
+             << " seconds, render " << seconds << ", next frame setup " << setup_seconds << endl;
+    }
+    double total = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cout << frames << " frames in " << total << " seconds, " << 100. * render_seconds / total << "% rendering, "
+         << scenes[0]->kdtree_rebuilds() + scenes[1]->kdtree_rebuilds() << " tree rebuilds" << endl;
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, char **argv) {
+    if (argc == 2 && string(argv[1]) == "--worker") {
+        // stdout carries the results : what the scene setup prints goes to stderr
+        int out = dup(1);
+        dup2(2, 1);
+        return run_render_worker(0, out);
+    }
+    RenderOptions options = parse_options(argc, argv);
+    const RenderSettings &settings = options.settings;
+    float aspect_ratio = float(settings.width) / float(settings.height);
+    unsigned int passes = (max(options.spp, 1u) + settings.nsamples - 1) / settings.nsamples;
+    if (options.sequence) return render_sequence(options, passes);
+
+    SceneRegistry scenes;
+    add_builtin_scenes(scenes, aspect_ratio);
+    unsigned int index = find_scene(scenes, options.scene);
+    if (index == scenes.size()) {
+        cerr << "Unknown scene name" << endl;
+        return EXIT_FAILURE;
+    }
+
+    // What the sums depend on besides the size and seed (stored apart) : a checkpoint of another render is refused
+    uint64_t key = hash_bytes(options.scene.data(), options.scene.size());
+    key = hash_bytes(&settings.nsamples, sizeof(settings.nsamples), key);
+    RenderAccumulation accumulation(settings, key);
+    if (options.resume) {
+        if (!accumulation.load(options.checkpoint)) {
+            cerr << "Could not read checkpoint " << options.checkpoint << endl;
+            return EXIT_FAILURE;
+        }
+        if (accumulation.key != key || accumulation.width != settings.width || accumulation.height != settings.height || accumulation.seed != settings.seed) {
+            cerr << "Checkpoint " << options.checkpoint << " is not a render of this scene with these settings" << endl;
+            return EXIT_FAILURE;
+        }
+        cout << "Resuming after pass " << accumulation.passes << " of " << passes << endl;
+    }
+
+    if (options.farm.workers) {
+        // The coordinator does not load the scene
+        RenderFarmStats stats;
+        if (!render_farm(options.scene, settings, passes, options.farm, accumulation, stats)) return EXIT_FAILURE;
+        cout << stats.bands << " bands of " << options.farm.band << " lines on " << options.farm.workers << " workers in " << stats.seconds << " seconds ("
+             << stats.lost_workers << " workers lost, " << stats.reassigned << " bands reassigned, " << stats.duplicated << " duplicated)" << endl;
+    } else {
+        // Scenes drawing random numbers in their setup get the same ones on every run
+        seed_random(settings.seed);
+        Renderer renderer(scenes.get(index), RenderCamera(scenes.get(index).camera, aspect_ratio), settings);
+        chrono::steady_clock::time_point last_checkpoint = chrono::steady_clock::now();
+        while (accumulation.passes < passes) {
+            RenderStats stats = renderer.accumulate(accumulation);
+            cout << "Pass " << accumulation.passes << " / " << passes << " (" << accumulation.passes * settings.nsamples << " spp) in " << stats.seconds << " seconds" << endl;
+            if (accumulation.passes == passes || chrono::duration<double>(chrono::steady_clock::now() - last_checkpoint).count() >= options.interval) {
+                if (!accumulation.save(options.checkpoint)) cerr << "Could not write checkpoint " << options.checkpoint << endl;
+                last_checkpoint = chrono::steady_clock::now();
+            }
+        }
+    }
+
+    vector<Vec3> image;
+    accumulation.resolve(image);
+    if (!save_ppm(options.output, settings.width, settings.height, image)) {
+        cerr << "Could not open file: " << options.output << endl;
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -46,22 +46,17 @@ class AABB {
     }
 
     bool intersects(const Ray &ray, float tmin=EPSILON, float tmax=FLT_MAX) const {
-        for (int axis = 0; axis < 3; axis++) {
-            const double adinv = 1.0 / ray.direction()[axis];
-
-            float t0 = (p0[axis] - ray.origin()[axis]) * adinv;
-            float t1 = (p1[axis] - ray.origin()[axis]) * adinv;
+        Vec3A t0 = (Vec3A(p0) - ray.origin_a) * ray.inv_direction_a;
+        Vec3A t1 = (Vec3A(p1) - ray.origin_a) * ray.inv_direction_a;
+        // An axis parallel to the ray gives NaN when the origin is on the slab, max/min then keep tmin/tmax
+        Vec3A tnear = Vec3A(_mm_max_ps(_mm_min_ps(t0.v, t1.v), _mm_set1_ps(tmin)));
+        Vec3A tfar = Vec3A(_mm_min_ps(_mm_max_ps(t0.v, t1.v), _mm_set1_ps(tmax)));
+        return tfar.hmin() > tnear.hmax();
+    }
 
-            if (t0 < t1) {
-                if (t0 > tmin) tmin = t0;
-                if (t1 < tmax) tmax = t1;
-            } else {
-                if (t1 > tmin) tmin = t1;
-                if (t0 < tmax) tmax = t0;
-            }
-            if (tmax <= tmin) return false;
-        }
-        return true;
+    float area() const {
+        Vec3 d = p1 - p0;
+        return 2.f * (d[0] * d[1] + d[1] * d[2] + d[2] * d[0]);
     }
 
     std::pair<AABB, AABB> split(const AABBCuttingPlane &plane) const {
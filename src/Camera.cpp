@@ -132,6 +132,24 @@ void Camera::apply () {
 }
 
 
+void Camera::setView (const Vec3 & translation, float zoom, const Vec3 & rotation) {
+  x = translation[0];
+  y = translation[1];
+  z = translation[2];
+  _zoom = zoom;
+  trackball (curquat, 0.0, 0.0, 0.0, 0.0);
+  for (int axis = 0; axis < 3; axis++) {
+    float a[3] = {0.0, 0.0, 0.0};
+    a[axis] = 1.0;
+    float q[4];
+    axis_to_quat (a, rotation[axis] * M_PI / 180.0, q);
+    add_quats (q, curquat, curquat);
+  }
+  spinning = 0;
+  moving = 0;
+}
+
+
 void Camera::getPos (float & X, float & Y, float & Z) {
   GLfloat m[4][4]; 
   build_rotmatrix(m, curquat);
@@ -144,3 +162,18 @@ void Camera::getPos (float & X, float & Y, float & Z) {
 
 }
 
+void Camera::getFrame (Vec3 & position, Vec3 & xAxis, Vec3 & yAxis, Vec3 & zAxis) const {
+  GLfloat m[4][4];
+  float q[4] = {curquat[0], curquat[1], curquat[2], curquat[3]};
+  build_rotmatrix(m, q);
+  // The modelview is T(x, y, z - zoom) * R, the camera axes are the rows of R
+  float _x = -x;
+  float _y = -y;
+  float _z = -z + _zoom;
+  for (int i = 0; i < 3; i++) {
+    position[i] = m[i][0] * _x + m[i][1] * _y + m[i][2] * _z;
+    xAxis[i] = m[i][0];
+    yAxis[i] = m[i][1];
+    zAxis[i] = m[i][2];
+  }
+}
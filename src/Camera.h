@@ -37,7 +37,13 @@ public:
   void endRotate ();
   void zoom (float z);
   void apply ();
+
+  // Absolute placement : translation, zoom and rotation (euler angles in degrees, applied x, y then z)
+  void setView (const Vec3 & translation, float zoom, const Vec3 & rotation);
   
+  // Eye position and camera axes in world space (x right, y up, z backwards), as set by apply, without OpenGL
+  void getFrame (Vec3 & position, Vec3 & xAxis, Vec3 & yAxis, Vec3 & zAxis) const;
+
   void getPos (float & x, float & y, float & z);
   inline void getPos (Vec3 & p) { getPos (p[0], p[1], p[2]); }
   
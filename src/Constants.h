@@ -14,6 +14,18 @@
 // KDTree constants
 #define KDTREE_MAX_DEPTH 100 // Maximum depth of the KDTree
 #define KDTREE_TRIANGLES_PER_LEAF 40 // Maximum number of triangles per leaf
+#define KDTREE_REPORT 0 // 1 to print the shape, SAH cost and ray-cast probe of every KDTree once built (see KDTree::report)
+#define KDTREE_REFIT_LIMIT 1.5f // Trees of animated meshes are refitted, and rebuilt once their SAH cost exceeds this ratio of the cost after the last build
+#define KDTREE_PROBE_RAYS 10000 // Rays of the probe, from around the mesh towards points of its bounding box
+
+// Mesh constants
+#define MESH_CACHE 1 // 1 to write / read the binary mesh cache next to the OFF files, 0 to always parse them
+#define MESH_COMPACT_ATTRIBUTES 0 // 1 to keep the mesh normals, uvs, colors and small index buffers compressed once the KDTree is built (see PackedAttributes.h)
+
+// Texture constants
+#define TEXTURE_SRGB_DECODE 1 // 1 to convert the texture colors from sRGB to linear when they are loaded, 0 to use them as they are
+#define SKYBOX_SAMPLING 1 // 1 to sample the skybox explicitly on diffuse surfaces (next event estimation), 0 to reach it only by bouncing
+#define SKYBOX_SAMPLING_WIDTH 512 // Maximum width of the mip level the skybox distribution is built from
 
 #define EPSILON 0.00001
 
@@ -1,10 +1,24 @@
 #include "Functions.h"
 #include "Constants.h"
 
+#include <ctime>
+#include <thread>
+#include <functional>
+
+// One generator per thread, seeded from the clock until seed_random is called
+static std::mt19937 & random_generator() {
+    static thread_local std::mt19937 generator(static_cast<unsigned int>(time(nullptr)) ^ static_cast<unsigned int>(std::hash<std::thread::id>()(std::this_thread::get_id())));
+    return generator;
+}
+
+void seed_random(uint64_t seed) {
+    std::seed_seq sequence{static_cast<uint32_t>(seed), static_cast<uint32_t>(seed >> 32)};
+    random_generator().seed(sequence);
+}
+
 float random_float() {
-    static std::uniform_real_distribution<float> distribution(0.0, 1.0);
-    static std::mt19937 generator(static_cast<unsigned int>(time(nullptr)));
-    return distribution(generator);
+    std::uniform_real_distribution<float> distribution(0.0, 1.0);
+    return distribution(random_generator());
 }
 
 float random_float(float min, float max) {
@@ -57,4 +71,14 @@ void gamma_correct(Vec3 &color) {
     color[0] = pow(color[0], 1.0/2.2);
     color[1] = pow(color[1], 1.0/2.2);
     color[2] = pow(color[2], 1.0/2.2);
-}
\ No newline at end of file
+}
+
+// FNV-1a 64 bits, chain calls by passing the previous hash
+uint64_t hash_bytes(const void *data, size_t size, uint64_t hash) {
+    const unsigned char *bytes = (const unsigned char *)data;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
@@ -1,10 +1,15 @@
 #include <random>
+#include <cstdint>
+#include <cstddef>
 #include "Vec3.h"
 
 #ifndef FUNCTIONS_H
 #define FUNCTIONS_H
 
+// Uniform in [0, 1), from the calling thread's generator
 float random_float();
+// Restarts the calling thread's sequence, renders seed each line so that they do not depend on the scheduling
+void seed_random(uint64_t seed);
 float random_float(float min, float max);
 Vec3 random_unit_vector();
 Vec3 random_on_hemisphere(const Vec3 &normal);
@@ -15,5 +20,6 @@ Vec3 reflect(const Vec3 &direction_in, const Vec3 &n);
 Vec3 refract(const Vec3 &direction_in, const Vec3 &n, float etai_over_etat);
 float reflectance(float cosine, float ref_idx);
 void gamma_correct(Vec3 &color);
+uint64_t hash_bytes(const void *data, size_t size, uint64_t hash = 14695981039346656037ULL);
 
 #endif // FUNCTIONS_H
@@ -2,156 +2,314 @@
 #include <algorithm>
 #include "Functions.h"
 #include "Constants.h"
-
-class KDTree::Node {
-public:
-    AABB aabb;
-    Node *left;
-    Node *right;
-    const std::vector<MeshVertex>& vertices;
-
-    std::vector<MeshTriangle> triangles; // Leaf
-    AABBCuttingPlane plane; // Node
-
-    Node(const AABB& aabb, const std::vector<MeshVertex>& vertices) : aabb(aabb), vertices(vertices), left(nullptr), right(nullptr) {
-
-    }
-    ~Node() {
-        if (left) delete left;
-        if (right) delete right;
-        if (leaf()) triangles.clear();
+#include "RenderCounters.h"
+#include "Trace.h"
+
+// Build state : bounds of every triangle, computed once, and scratch lists reused by all the nodes.
+// The tree itself only grows its two arrays, so a build does a handful of allocations whatever the number of nodes.
+struct KDTree::Builder {
+    KDTree& tree;
+    std::vector<AABB> bounds;
+    std::vector<float> mins; // cut
+    // Left and right lists of each depth : a node's lists stay untouched while its children, one level deeper, are built
+    std::vector< std::vector<unsigned int> > lists;
+
+    Builder(KDTree& tree) : tree(tree), lists(2 * (KDTREE_MAX_DEPTH + 2)) {
+        unsigned int n = tree.mesh.triangleCount();
+        bounds.resize(n);
+        for (unsigned int i = 0; i < n; i++) {
+            MeshTriangle triangle = tree.mesh.triangle(i);
+            bounds[i] = Triangle(tree.mesh.positions[triangle[0]], tree.mesh.positions[triangle[1]], tree.mesh.positions[triangle[2]]).getAABB();
+        }
+        mins.reserve(n);
+        tree.nodes.reserve(4 * n / KDTREE_TRIANGLES_PER_LEAF + 1);
+        tree.references.reserve(2 * n);
     }
 
-    bool leaf() const { return left == nullptr && right == nullptr;}
+    // Median of the lower bounds on the axis of the depth
+    AABBCuttingPlane cut(const unsigned int* indices, unsigned int n, unsigned int depth) {
+        AABBCuttingPlane plane = AABBCuttingPlane(depth % 3, 0);
+        mins.clear();
+        for (unsigned int i = 0; i < n; i++) mins.push_back(bounds[indices[i]].p0[plane.axis]);
+        std::nth_element(mins.begin(), mins.begin() + n / 2, mins.end());
+        plane.position = mins[n / 2] + EPSILON;
+        return plane;
+    }
 
-    void addTriangle(const MeshTriangle& triangle) {
-        triangles.push_back(triangle);
+    void leaf(int index, const unsigned int* indices, unsigned int n) {
+        tree.nodes[index].first = tree.references.size();
+        tree.nodes[index].count = n;
+        tree.references.insert(tree.references.end(), indices, indices + n);
     }
 
-    inline RayTriangleIntersection intersect(const Ray& ray) const {
-        if (!aabb.intersects(ray)) return RayTriangleIntersection();
-        if (leaf()) {
-            if (triangles.size() == 0) return RayTriangleIntersection();
-            RayTriangleIntersection closestIntersection;
-            closestIntersection.t = FLT_MAX;
-            for (unsigned int i = 0; i < triangles.size(); i++) {
-                Triangle triangle(vertices[triangles[i][0]].position * TRIANGLE_SCALING,
-                                  vertices[triangles[i][1]].position * TRIANGLE_SCALING,
-                                  vertices[triangles[i][2]].position * TRIANGLE_SCALING);
-                RayTriangleIntersection intersection = triangle.getIntersection(ray);
-                if (intersection.t < closestIntersection.t) {
-                    closestIntersection = intersection;
-                    closestIntersection.tIndex = triangles[i][3];
-                }
-            }
-            return closestIntersection;
-        } else {
-            RayTriangleIntersection leftIntersection, rightIntersection;
+    // Returns the index of the node, -1 if there is none
+    int build(const unsigned int* indices, unsigned int n, const AABB& aabb, unsigned int depth) {
+        if (n == 0 || depth > KDTREE_MAX_DEPTH) return -1;
 
-            if (left) {
-                leftIntersection = left->intersect(ray);
-            } else {
-                leftIntersection.t = FLT_MAX;
-            }
+        int index = tree.nodes.size();
+        tree.nodes.push_back(Node{aabb, AABBCuttingPlane(), -1, -1, 0, 0});
+        if (n <= KDTREE_TRIANGLES_PER_LEAF) {
+            leaf(index, indices, n);
+            return index;
+        }
 
-            if (right) {
-                rightIntersection = right->intersect(ray);
+        AABBCuttingPlane plane = cut(indices, n, depth);
+        std::pair<AABB, AABB> aabbs = aabb.split(plane);
+        tree.nodes[index].plane = plane;
+
+        std::vector<unsigned int>& left = lists[2 * depth];
+        std::vector<unsigned int>& right = lists[2 * depth + 1];
+        left.clear();
+        right.clear();
+        for (unsigned int i = 0; i < n; i++) {
+            const AABB& box = bounds[indices[i]];
+            if (box.p1[plane.axis] <= plane.position - EPSILON) {
+                left.push_back(indices[i]);
+            } else if (box.p0[plane.axis] >= plane.position + EPSILON) {
+                right.push_back(indices[i]);
             } else {
-                rightIntersection.t = FLT_MAX;
+                left.push_back(indices[i]);
+                right.push_back(indices[i]);
             }
+        }
 
-            if (leftIntersection.t < rightIntersection.t) {
-                return leftIntersection;
-            } else {
-                return rightIntersection;
-            }
+        if (left.size() == right.size()) {
+            leaf(index, indices, n);
+            return index;
         }
+
+        int l = build(left.data(), left.size(), aabbs.first, depth + 1);
+        int r = build(right.data(), right.size(), aabbs.second, depth + 1);
+        tree.nodes[index].left = l;
+        tree.nodes[index].right = r;
+        return index;
     }
 };
 
-KDTree::KDTree(const std::vector<MeshTriangle>& triangles, const AABB& aabb, const std::vector<MeshVertex>& vertices) : vertices(vertices), aabb(aabb) {
-    root = buildTree(triangles, aabb, 0);
+KDTree::KDTree(const Mesh& mesh) : mesh(mesh), aabb(mesh.aabb) {
+    Builder builder(*this);
+    std::vector<unsigned int> indices(mesh.triangleCount());
+    for (unsigned int i = 0; i < indices.size(); i++) indices[i] = i;
+    builder.build(indices.data(), indices.size(), aabb, 0);
 }
 
-KDTree::~KDTree() {
-    if (root) delete root;
+KDTree::KDTree(const Mesh& mesh, const KDTreeFlatNode* flat, unsigned int nNodes, const unsigned int* references) : mesh(mesh), aabb(mesh.aabb) {
+    nodes.resize(nNodes);
+    unsigned int nReferences = 0;
+    for (unsigned int i = 0; i < nNodes; i++) {
+        nodes[i].aabb = AABB(Vec3(flat[i].p0[0], flat[i].p0[1], flat[i].p0[2]), Vec3(flat[i].p1[0], flat[i].p1[1], flat[i].p1[2]));
+        nodes[i].plane = AABBCuttingPlane(flat[i].axis, flat[i].position);
+        nodes[i].left = flat[i].left;
+        nodes[i].right = flat[i].right;
+        nodes[i].first = flat[i].first;
+        nodes[i].count = flat[i].count;
+        nReferences = std::max(nReferences, flat[i].first + flat[i].count);
+    }
+    this->references.assign(references, references + nReferences);
 }
 
 RayTriangleIntersection KDTree::intersect(const Ray& ray) const {
-    if (!root) return RayTriangleIntersection();
+    if (nodes.empty()) return RayTriangleIntersection();
     if (!aabb.intersects(ray)) return RayTriangleIntersection();
-    RayTriangleIntersection intersection = root->intersect(ray);
-    return intersection;
+    return intersectNode(0, ray);
 }
 
-AABBCuttingPlane KDTree::cut(const std::vector<MeshTriangle>& triangles, int depth) const {
-    AABBCuttingPlane plane = AABBCuttingPlane(depth % 3, 0);
+RayTriangleIntersection KDTree::intersectNode(int index, const Ray& ray) const {
+    const Node& node = nodes[index];
+    RENDER_STAT(kd_nodes, 1);
+    if (!node.aabb.intersects(ray)) return RayTriangleIntersection();
+    if (node.left < 0 && node.right < 0) {
+        RENDER_STAT(kd_leaves, 1);
+        RENDER_STAT(triangle_tests, node.count);
+        if (node.count == 0) return RayTriangleIntersection();
+        RayTriangleIntersection closestIntersection;
+        closestIntersection.t = FLT_MAX;
+        // 4 triangles per test, the last group repeats its last triangle
+        Vec3x4 origin(ray.origin()), direction(ray.direction());
+        const unsigned int* triangles = &references[node.first];
+        unsigned int n = node.count;
+        for (unsigned int i = 0; i < n; i += 4) {
+            Vec3 c[3][4];
+            for (unsigned int lane = 0; lane < 4; lane++) {
+                MeshTriangle triangle = mesh.triangle(triangles[std::min(i + lane, n - 1)]);
+                for (unsigned int k = 0; k < 3; k++) c[k][lane] = mesh.positions[triangle[k]] * TRIANGLE_SCALING;
+            }
+            alignas(16) float t[4], w1[4], w2[4];
+            int hits = Triangle::intersect4(origin, direction,
+                                            Vec3x4(c[0][0], c[0][1], c[0][2], c[0][3]),
+                                            Vec3x4(c[1][0], c[1][1], c[1][2], c[1][3]),
+                                            Vec3x4(c[2][0], c[2][1], c[2][2], c[2][3]), t, w1, w2);
+            for (unsigned int lane = 0; hits && lane < 4 && i + lane < n; lane++) {
+                if ((hits & (1 << lane)) && t[lane] < closestIntersection.t) {
+                    closestIntersection.intersectionExists = true;
+                    closestIntersection.t = t[lane];
+                    closestIntersection.w0 = 1 - w1[lane] - w2[lane];
+                    closestIntersection.w1 = w1[lane];
+                    closestIntersection.w2 = w2[lane];
+                    closestIntersection.tIndex = triangles[i + lane];
+                }
+            }
+        }
+        return closestIntersection;
+    }
 
-    std::vector<float> min_list;
-    for (unsigned int i = 0; i < triangles.size(); i++) {
-        AABB aabb = Triangle(vertices[triangles[i][0]].position, vertices[triangles[i][1]].position, vertices[triangles[i][2]].position).getAABB();
-        min_list.push_back( aabb.p0[plane.axis] );
+    RayTriangleIntersection leftIntersection, rightIntersection;
+    if (node.left >= 0) leftIntersection = intersectNode(node.left, ray);
+    if (node.right >= 0) rightIntersection = intersectNode(node.right, ray);
+    if (leftIntersection.t < rightIntersection.t) {
+        return leftIntersection;
+    } else {
+        return rightIntersection;
     }
-    std::sort(min_list.begin(), min_list.end());
-    plane.position = min_list[min_list.size() / 2] + EPSILON;
-    return plane;
 }
 
-KDTree::Node* KDTree::buildTree(const std::vector<MeshTriangle>& triangles, const AABB& aabb, unsigned int depth) {
-    if (triangles.size() == 0 || depth > KDTREE_MAX_DEPTH) {
-        return nullptr;
+void KDTree::flatten(std::vector<KDTreeFlatNode>& flat, std::vector<unsigned int>& references) const {
+    flat.resize(nodes.size());
+    for (unsigned int i = 0; i < nodes.size(); i++) {
+        for (int c = 0; c < 3; c++) {
+            flat[i].p0[c] = nodes[i].aabb.p0[c];
+            flat[i].p1[c] = nodes[i].aabb.p1[c];
+        }
+        flat[i].position = nodes[i].plane.position;
+        flat[i].axis = nodes[i].plane.axis;
+        flat[i].left = nodes[i].left;
+        flat[i].right = nodes[i].right;
+        flat[i].first = nodes[i].first;
+        flat[i].count = nodes[i].count;
     }
+    references = this->references;
+}
 
-    KDTree::Node* ret = new KDTree::Node(aabb, vertices);
+KDTreeReport KDTree::report() const {
+    KDTreeReport report = KDTreeReport();
+    report.references = references.size();
+    report.memory = nodes.size() * sizeof(Node) + references.size() * sizeof(unsigned int);
+    if (nodes.empty()) return report;
+    reportNode(0, 0, report);
+    if (report.leaves) report.average_leaf_depth /= report.leaves;
+    report.sah = sah();
+
+    std::vector<unsigned int> unique(references);
+    std::sort(unique.begin(), unique.end());
+    report.duplicates = report.references - (std::unique(unique.begin(), unique.end()) - unique.begin());
+    return report;
+}
 
-    int nTris = triangles.size();
-    if (nTris <= KDTREE_TRIANGLES_PER_LEAF) {
-        for (const auto& triangle : triangles) ret->addTriangle(triangle);
-        return ret;
+void KDTree::reportNode(int index, unsigned int depth, KDTreeReport& report) const {
+    const Node& node = nodes[index];
+    report.nodes++;
+    report.max_depth = std::max(report.max_depth, depth);
+    if (node.left < 0 && node.right < 0) {
+        report.leaves++;
+        report.average_leaf_depth += depth;
+        unsigned int bucket = 0;
+        while ((1u << bucket) < node.count) bucket++;
+        if (report.leaf_sizes.size() <= bucket) report.leaf_sizes.resize(bucket + 1, 0);
+        report.leaf_sizes[bucket]++;
+        if (node.count > KDTREE_TRIANGLES_PER_LEAF) {
+            report.oversized_leaves++;
+            report.oversized_references += node.count;
+        }
+        return;
     }
-    std::pair<AABB, AABB> aabbs;
-    AABBCuttingPlane bestPlane;
-    float min_cost = FLT_MAX;
-
-    bestPlane = cut(triangles, depth);
+    if (node.left >= 0) reportNode(node.left, depth + 1, report);
+    if (node.right >= 0) reportNode(node.right, depth + 1, report);
+}
 
-    try {
-        aabbs = aabb.split(bestPlane);
-    } catch (const std::exception& e) {
-        for (const auto& triangle : triangles) ret->addTriangle(triangle);
-        return ret;
+// Sum over the nodes of P(ray through the root crosses the node) * cost of the node
+float KDTree::sah() const {
+    if (nodes.empty()) return 0.f;
+    float root_area = nodes[0].aabb.area();
+    double sah = 0.;
+    for (const Node& node : nodes) {
+        double probability = root_area > 0.f ? node.aabb.area() / root_area : 1.;
+        sah += probability;
+        if (node.left < 0 && node.right < 0) sah += probability * node.count;
     }
+    return sah;
+}
 
-    ret->plane = bestPlane;
-
-    std::vector<MeshTriangle> leftTriangles;
-    std::vector<MeshTriangle> rightTriangles;
-
-    for (const auto& triangle : triangles) {
-        AABB triangleAABB = Triangle(vertices[triangle[0]].position, vertices[triangle[1]].position, vertices[triangle[2]].position).getAABB();
-        if (triangleAABB.p1[bestPlane.axis] <= bestPlane.position - EPSILON) {
-            leftTriangles.push_back(triangle);
-        } else if (triangleAABB.p0[bestPlane.axis] >= bestPlane.position + EPSILON) {
-            rightTriangles.push_back(triangle);
+float KDTree::refit() {
+    TRACE_SPAN("KDTree::refit");
+    for (int i = nodes.size() - 1; i >= 0; i--) {
+        Node& node = nodes[i];
+        AABB box;
+        if (node.left < 0 && node.right < 0) {
+            // The intersection tests the triangles scaled by TRIANGLE_SCALING
+            for (unsigned int r = node.first; r < node.first + node.count; r++) {
+                MeshTriangle triangle = mesh.triangle(references[r]);
+                for (unsigned int k = 0; k < 3; k++) {
+                    const Vec3& p = mesh.positions[triangle[k]];
+                    box.extend(AABB(p, p * TRIANGLE_SCALING));
+                }
+            }
+            box.p0 -= Vec3(EPSILON);
+            box.p1 += Vec3(EPSILON);
         } else {
-            leftTriangles.push_back(triangle);
-            rightTriangles.push_back(triangle);
+            if (node.left >= 0) box.extend(nodes[node.left].aabb);
+            if (node.right >= 0) box.extend(nodes[node.right].aabb);
         }
+        node.aabb = box;
+    }
+    aabb = nodes.empty() ? mesh.aabb : nodes[0].aabb;
+    return sah();
+}
+
+KDTreeProbe KDTree::probe(const std::vector<Ray>& rays) const {
+    KDTreeProbe probe = KDTreeProbe();
+    probe.rays = rays.size();
+    if (rays.empty()) return probe;
+    unsigned int hits = 0;
+    for (const Ray& ray : rays) {
+        if (!nodes.empty() && aabb.intersects(ray)) probeNode(0, ray, probe);
+        if (intersect(ray).intersectionExists) hits++;
     }
+    probe.nodes /= rays.size();
+    probe.leaves /= rays.size();
+    probe.triangles /= rays.size();
+    probe.hit_rate = float(hits) / rays.size();
+    return probe;
+}
 
-    if (leftTriangles.size() == rightTriangles.size()) {
-        for (const auto& triangle : triangles) ret->addTriangle(triangle);
-        return ret;
+// Same walk as intersectNode, without the triangles
+void KDTree::probeNode(int index, const Ray& ray, KDTreeProbe& probe) const {
+    const Node& node = nodes[index];
+    probe.nodes++;
+    if (!node.aabb.intersects(ray)) return;
+    if (node.left < 0 && node.right < 0) {
+        probe.leaves++;
+        probe.triangles += node.count;
+        return;
     }
+    if (node.left >= 0) probeNode(node.left, ray, probe);
+    if (node.right >= 0) probeNode(node.right, ray, probe);
+}
 
-    ret->left = buildTree(leftTriangles, aabbs.first, depth + 1);
-    ret->right = buildTree(rightTriangles, aabbs.second, depth + 1);
+std::ostream& operator<<(std::ostream& out, const KDTreeReport& report) {
+    out << report.nodes << " nodes, " << report.leaves << " leaves, max depth " << report.max_depth
+        << ", average leaf depth " << report.average_leaf_depth << std::endl;
+    out << report.references << " triangle references, " << report.duplicates << " duplicates, "
+        << report.memory / 1024. << " KiB, SAH cost " << report.sah << std::endl;
+    out << "leaf sizes :";
+    for (unsigned int i = 0; i < report.leaf_sizes.size(); i++) {
+        if (report.leaf_sizes[i]) out << " <=" << (1u << i) << ":" << report.leaf_sizes[i];
+    }
+    out << std::endl;
+    if (report.oversized_leaves) {
+        out << "warning : " << report.oversized_leaves << " leaves over " << KDTREE_TRIANGLES_PER_LEAF
+            << " triangles (" << report.oversized_references << " references), the splits stopped early" << std::endl;
+    }
+    return out;
+}
 
-    return ret;
+std::ostream& operator<<(std::ostream& out, const KDTreeProbe& probe) {
+    out << probe.rays << " probe rays : " << probe.nodes << " nodes, " << probe.leaves << " leaves, "
+        << probe.triangles << " triangles per ray, " << 100. * probe.hit_rate << "% hits" << std::endl;
+    return out;
 }
 
 void KDTree::draw() const {
-    if (root) {
+    if (!nodes.empty()) {
         GLfloat material_color[4] = {1.0, 1.0, 1.0, 1.0};
         GLfloat material_specular[4] = {1.0, 1.0, 1.0, 1.0};
         GLfloat material_ambient[4] = {1.0, 1.0, 1.0, 1.0};
@@ -2,6 +2,7 @@
 #define KDTREE_H
 
 #include <vector>
+#include <ostream>
 #include "Mesh.h"
 #include "AABB.h"
 #include "Ray.h"
@@ -10,28 +11,81 @@
 
 #include "Constants.h"
 
-struct MeshVertex;
-struct MeshTriangle;
+class Mesh;
 
-class KDTree {
-public:
-    struct Node;
+// Node of a KDTree stored in a flat array (preorder), used by the mesh cache
+struct KDTreeFlatNode {
+    float p0[3], p1[3];
+    float position; // cutting plane
+    unsigned int axis;
+    int left, right; // index of the children, -1 if none
+    unsigned int first, count; // leaf triangles in the reference list
+};
 
-    const std::vector<MeshVertex>& vertices;
+// Shape and expected cost of a tree, see KDTree::report
+struct KDTreeReport {
+    unsigned int nodes, leaves, max_depth;
+    float average_leaf_depth;
+    unsigned int references, duplicates; // triangle indices in the leaves, and how many are beyond one per triangle
+    // Leaves over KDTREE_TRIANGLES_PER_LEAF : stopped by KDTREE_MAX_DEPTH or by a split that separates nothing
+    unsigned int oversized_leaves, oversized_references;
+    std::vector<unsigned int> leaf_sizes; // histogram, [i] : leaves of 2^(i-1) + 1 to 2^i triangles
+    size_t memory; // bytes
+    // Surface area heuristic : expected node visits + triangle tests of a ray through the root box (both cost 1)
+    float sah;
+};
 
-    Node* root;
+// Work of the traversal averaged over a set of rays, see KDTree::probe
+struct KDTreeProbe {
+    unsigned int rays;
+    float nodes, leaves, triangles; // per ray
+    float hit_rate;
+};
+
+std::ostream& operator<<(std::ostream& out, const KDTreeReport& report);
+std::ostream& operator<<(std::ostream& out, const KDTreeProbe& probe);
+
+class KDTree {
+public:
+    // Leaves hold triangle indices in the mesh
+    const Mesh& mesh;
 
     AABB aabb;
 
-    KDTree(const std::vector<MeshTriangle>& triangles, const AABB& aabb, const std::vector<MeshVertex>& vertices);
-    ~KDTree();
+    // Built from the triangles and the bounding box of the mesh, or read back from flatten's output
+    KDTree(const Mesh& mesh);
+    KDTree(const Mesh& mesh, const KDTreeFlatNode* nodes, unsigned int nNodes, const unsigned int* references);
 
     RayTriangleIntersection intersect(const Ray& ray) const;
     void draw() const;
+    void flatten(std::vector<KDTreeFlatNode>& nodes, std::vector<unsigned int>& references) const;
+
+    KDTreeReport report() const;
+    float sah() const;
+    // Node bounds recomputed bottom-up (children come after their parent) from the current positions of the mesh, for
+    // meshes that moved since the build. The planes are kept : the traversal only tests the boxes, so a refitted tree
+    // stays exact, it only gets slower as the boxes overlap. Returns the new SAH cost.
+    float refit();
+
+    // Nodes, leaves and triangles the traversal tests for each ray (intersect visits every node the ray crosses)
+    KDTreeProbe probe(const std::vector<Ray>& rays) const;
 
 private:
-    Node* buildTree(const std::vector<MeshTriangle>& triangles, const AABB& aabb, unsigned int depth);
-    AABBCuttingPlane cut(const std::vector<MeshTriangle>& triangles, int depth) const;
+    struct Node {
+        AABB aabb;
+        AABBCuttingPlane plane;
+        int left, right; // -1 if none, a node without children is a leaf
+        unsigned int first, count; // leaf triangles in references
+    };
+    struct Builder;
+
+    // The whole tree : nodes in preorder (the root is nodes[0]) and the triangle indices of the leaves
+    std::vector<Node> nodes;
+    std::vector<unsigned int> references;
+
+    RayTriangleIntersection intersectNode(int index, const Ray& ray) const;
+    void reportNode(int index, unsigned int depth, KDTreeReport& report) const;
+    void probeNode(int index, const Ray& ray, KDTreeProbe& probe) const;
 };
 
 #endif // KDTREE_H
\ No newline at end of file
@@ -0,0 +1,33 @@
+#include "MappedFile.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+bool MappedFile::open(const std::string &filename) {
+    close();
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        ::close(fd);
+        return false;
+    }
+
+    void *ptr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // The mapping keeps its own reference to the file
+    ::close(fd);
+    if (ptr == MAP_FAILED) return false;
+
+    m_data = ptr;
+    m_size = st.st_size;
+    return true;
+}
+
+void MappedFile::close() {
+    if (m_data) munmap(m_data, m_size);
+    m_data = nullptr;
+    m_size = 0;
+}
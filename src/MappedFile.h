@@ -0,0 +1,30 @@
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include <string>
+#include <cstddef>
+
+// Read-only memory mapping of a whole file (mmap).
+// The mapping stays valid as long as the object lives, even if the file is replaced on disk.
+class MappedFile {
+public:
+    MappedFile() : m_data(nullptr), m_size(0) {}
+    MappedFile(const std::string &filename) : m_data(nullptr), m_size(0) { open(filename); }
+    ~MappedFile() { close(); }
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile & operator = (const MappedFile &) = delete;
+
+    bool open(const std::string &filename);
+    void close();
+
+    bool is_open() const { return m_data != nullptr; }
+    const unsigned char * data() const { return (const unsigned char *)m_data; }
+    size_t size() const { return m_size; }
+
+private:
+    void *m_data;
+    size_t m_size;
+};
+
+#endif // MAPPEDFILE_H
@@ -1,16 +1,24 @@
 #include "Material.h"
+#include "RenderCounters.h"
 #include "imageLoader.h"    
 #include "Constants.h"
 
+#include <algorithm>
+
 Material::Material() {
     type = Material_Diffuse_Blinn_Phong;
     texture_type = Texture_None;
     transparency = 0.0;
     index_medium = 1.0;
     ambient_material = Vec3(0., 0., 0.);
+    shininess = 0.;
+    emissive = false;
+    light_intensity = 0.;
+    image = nullptr;
+    normals = nullptr;
 }
 
-void Material::emit(Vec3 &color, float u, float v) {
+void Material::emit(Vec3 &color, float u, float v, float footprint_u, float footprint_v) const {
     if (!emissive) {
         color = Vec3(0., 0., 0.);
         return;
@@ -18,12 +26,12 @@ void Material::emit(Vec3 &color, float u, float v) {
     if (texture_type == Texture_None) {
         color = light_color;
     } else {
-        texture(color, u, v);
+        texture(color, u, v, footprint_u, footprint_v);
     }
     color *= light_intensity;
 }
 
-void Material::scatter(const Ray &ray_in, const Vec3 &normal, const Vec3 &intersection, Ray &ray_out) {
+void Material::scatter(const Ray &ray_in, const Vec3 &normal, const Vec3 &intersection, Ray &ray_out) const {
     float ri, cos_theta, sin_theta;
     bool cannot_refract;
     Vec3 direction;
@@ -60,18 +68,63 @@ void Material::scatter(const Ray &ray_in, const Vec3 &normal, const Vec3 &inters
 }
 
 
-void Material::texture(Vec3 &color, float u, float v) {
-    int x, y, index;
+// Bilinear lookup in one level, wrapping around the edges (u and v in [0, 1] cover the level once)
+static Vec3 sample_level(const ppmLoader::ImageLevel &level, float u, float v) {
+    float x = u * level.w - 0.5f, y = v * level.h - 0.5f;
+    float fx = floorf(x), fy = floorf(y);
+    float tx = x - fx, ty = y - fy;
+    int x0 = (int)fx, y0 = (int)fy, x1 = x0 + 1, y1 = y0 + 1;
+    if (level.mask_x >= 0) {
+        x0 &= level.mask_x;
+        x1 &= level.mask_x;
+    } else {
+        x0 = ((x0 % level.w) + level.w) % level.w;
+        x1 = x1 % level.w;
+        if (x1 < 0) x1 += level.w;
+    }
+    if (level.mask_y >= 0) {
+        y0 &= level.mask_y;
+        y1 &= level.mask_y;
+    } else {
+        y0 = ((y0 % level.h) + level.h) % level.h;
+        y1 = y1 % level.h;
+        if (y1 < 0) y1 += level.h;
+    }
+    const Vec3 *row0 = level.texels + y0 * level.w, *row1 = level.texels + y1 * level.w;
+    return (1 - ty) * ((1 - tx) * row0[x0] + tx * row0[x1]) + ty * ((1 - tx) * row1[x0] + tx * row1[x1]);
+}
+
+// Trilinear lookup, the level is chosen so that the footprint covers about one texel
+static Vec3 sample_image(const ppmLoader::ImageRGB &image, float u, float v, float footprint_u, float footprint_v) {
+    RENDER_STAT(texture_lookups, 1);
+    float texels = std::max(footprint_u * image.w, footprint_v * image.h);
+    float lod = texels > 1.f ? log2f(texels) : 0.f;
+    int last = (int)image.levels.size() - 1;
+    if (lod >= last) return sample_level(image.levels[last], u, v);
+    int level = (int)lod;
+    float t = lod - level;
+    Vec3 color = sample_level(image.levels[level], u, v);
+    if (t > 0.f) color = (1.f - t) * color + t * sample_level(image.levels[level + 1], u, v);
+    return color;
+}
+
+// Checkerboard parity of p (in cells) box-filtered over a width w : +1 on even cells, -1 on odd cells, 0 when w is large
+static float filtered_parity(float p, float w) {
+    if (w < 1e-4f) return ((int)floorf(p) % 2 == 0) ? 1.f : -1.f;
+    float a = p - 0.5f * w, b = p + 0.5f * w;
+    return 2.f * (fabsf(a * 0.5f - floorf(a * 0.5f) - 0.5f) - fabsf(b * 0.5f - floorf(b * 0.5f) - 0.5f)) / w;
+}
+
+void Material::texture(Vec3 &color, float u, float v, float footprint_u, float footprint_v) const {
+    float same;
     switch (texture_type) {
         case Texture_Checkerboard:
-            if ((int)(u*texture_scale_x) % 2 == (int)(v*texture_scale_y) % 2) {
-                color = checkerboard_color1;
-            } else {
-                color = checkerboard_color2;
-            }
+            // weight of color1 : 1 where both parities are equal
+            same = 0.5f + 0.5f * filtered_parity(u*texture_scale_x, footprint_u*texture_scale_x) * filtered_parity(v*texture_scale_y, footprint_v*texture_scale_y);
+            color = same * checkerboard_color1 + (1.f - same) * checkerboard_color2;
             break;
         case Texture_Image:
-            if (image->w < 1 || image->h < 1) {
+            if (image->levels.empty()) {
                     if ((int)(u*8.) % 2 == (int)(v*8.) % 2) {
                         color = Vec3(0., 0., 0.);
                     } else {
@@ -79,50 +132,40 @@ void Material::texture(Vec3 &color, float u, float v) {
                     }
                 break;
             }
-            u = fmod(u*texture_scale_x, 1.);
-            v = 1 - fmod(v*texture_scale_y, 1.);
-            x = int(u * (image->w - 1));
-            y = int(v * (image->h - 1));
-            index = y * image->w + x;
-            color = Vec3(image->data[index].r/255., image->data[index].g/255., image->data[index].b/255.);
+            // sample_image wraps, no need to bring u and v back to [0, 1]
+            color = sample_image(*image, u*texture_scale_x, 1.f - v*texture_scale_y, footprint_u*texture_scale_x, footprint_v*texture_scale_y);
             break;
         default:
             break;
     }
 }
 
-void Material::sphere_texture(Vec3 &color, const float phi, const float theta) {
+void Material::sphere_texture(Vec3 &color, const float phi, const float theta, float footprint_u, float footprint_v) const {
     switch (texture_type) {
         case Texture_Checkerboard:
         case Texture_Image:
-            texture(color, phi/(2*M_PI), theta/M_PI);
+            texture(color, phi/(2*M_PI), theta/M_PI, footprint_u, footprint_v);
             break;
         default:
             break;
     }
 }
 
-void Material::set_texture(ppmLoader::ImageRGB *img) {
+void Material::set_texture(const ppmLoader::ImageRGB *img) {
     image = img;
 }
 
-void Material::set_normals(ppmLoader::ImageRGB *img) {
+void Material::set_normals(const ppmLoader::ImageRGB *img) {
     normals = img;
     has_normal_map = true;
 }
 
-void Material::get_normal(Vec3& normal, float u, float v, Vec3 &T, Vec3 &B) {
-    if (!has_normal_map) {
+void Material::get_normal(Vec3& normal, float u, float v, const Vec3 &T, const Vec3 &B, float footprint_u, float footprint_v) const {
+    if (!has_normal_map || normals->levels.empty()) {
         return;
     }
-    int x, y, index;
-    u = fmod(u*texture_scale_x, 1.);
-    v = 1 - fmod(v*texture_scale_y, 1.);
-    x = int(u * (normals->w - 1));
-    y = int(v * (normals->h - 1));
-    index = y * normals->w + x;
-    // Map the normal values from [0, 255] to [-1, 1]
-    Vec3 normal_from_map = Vec3(normals->data[index].r/127.5 - 1., normals->data[index].g/127.5 - 1., normals->data[index].b/127.5 - 1.);
+    // Unpacked when loaded, filtered normals are renormalized below
+    Vec3 normal_from_map = sample_image(*normals, u*texture_scale_x, 1.f - v*texture_scale_y, footprint_u*texture_scale_x, footprint_v*texture_scale_y);
     
     normal = normal_from_map[0] * T + normal_from_map[1] * B + normal_from_map[2] * normal;
     
@@ -25,7 +25,6 @@ struct Material {
     Vec3 diffuse_material;
     Vec3 specular_material;
     double shininess;
-    Vec3 motion_blur_translation = Vec3(0.);
 
     float index_medium;
     float transparency = 0.;
@@ -43,20 +42,32 @@ struct Material {
     Vec3 light_color;
     float light_intensity;
 
-    ppmLoader::ImageRGB *image;
-    ppmLoader::ImageRGB *normals;
+    const ppmLoader::ImageRGB *image;
+    const ppmLoader::ImageRGB *normals;
     bool has_normal_map = false;
 
     Material();
 
-    void scatter(const Ray &ray_in, const Vec3 &normal, const Vec3 &intersection, Ray &ray_out);
-    void emit(Vec3 &color, float u, float v);
+    void scatter(const Ray &ray_in, const Vec3 &normal, const Vec3 &intersection, Ray &ray_out) const;
 
-    void texture(Vec3 &color, float u, float v);
-    void sphere_texture(Vec3 &color, const float phi, const float theta);
-    void set_texture(ppmLoader::ImageRGB *img);
-    void set_normals(ppmLoader::ImageRGB *img);
-    void get_normal(Vec3& normal, float u, float v, Vec3 &T, Vec3 &B);
+    // footprint_u / footprint_v : size of the ray cone on the surface in uv units, selects the mip level
+    // (0 : finest level, bilinear) and the filter width of the checkerboard
+    void emit(Vec3 &color, float u, float v, float footprint_u = 0.f, float footprint_v = 0.f) const;
+    void texture(Vec3 &color, float u, float v, float footprint_u = 0.f, float footprint_v = 0.f) const;
+    void sphere_texture(Vec3 &color, const float phi, const float theta, float footprint_u = 0.f, float footprint_v = 0.f) const;
+    void set_texture(const ppmLoader::ImageRGB *img);
+    void set_normals(const ppmLoader::ImageRGB *img);
+    void get_normal(Vec3& normal, float u, float v, const Vec3 &T, const Vec3 &B, float footprint_u = 0.f, float footprint_v = 0.f) const;
+};
+
+// Surface evaluated at an intersection, used for shading instead of a modified copy of the material
+struct SurfaceSample {
+    Vec3 position;
+    Vec3 normal;   // after normal mapping
+    Vec3 albedo;   // diffuse color after texturing
+    Vec3 emission;
+    float cone_width; // width of the ray cone at the intersection
+    const Material *material;
 };
 
 #endif // MATERIAL_H
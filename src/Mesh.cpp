@@ -1,13 +1,35 @@
 #include "Mesh.h"
+#include "Trace.h"
 #include <iostream>
 #include <fstream>
 #include <sstream>
+#include <random>
 
 // Loads colored or uncolored mesh from OFF file
 // Uncolored vertices line : x y z
 // Colored vertices line : x y z r g b rgbmax
+// A binary cache of the parsed file is written next to it and memory-mapped on later runs (see MeshCache.h)
 void Mesh::loadOFF(const std::string & filename) {
-    
+    TRACE_SPAN("loadOFF", filename);
+    source_file.clear();
+    source_hash = 0;
+    build_hash = 0;
+    build_cache.reset();
+    {
+        MappedFile source(filename);
+        if (!source.is_open()) {
+            std::cout << "Could not open file: " << filename << std::endl;
+            positions.clear();
+            normals.clear();
+            uvs.clear();
+            triangles.clear();
+            return;
+        }
+        source_file = filename;
+        source_hash = hash_bytes(source.data(), source.size());
+    }
+    if (MeshCache::load_source(*this)) return;
+
     std::ifstream in(filename.c_str());
     if (!in)
         exit(EXIT_FAILURE);
@@ -15,7 +37,7 @@ void Mesh::loadOFF(const std::string & filename) {
     std::string offString;
     unsigned int sizeV, sizeT, tmp;
     in >> offString >> sizeV >> sizeT >> tmp;
-    vertices.resize(sizeV);
+    positions.resize(sizeV);
     triangles.resize(sizeT);
     
     colorType = (offString == "COFF") ? ColorType_Vertex : ColorType_None;
@@ -23,12 +45,12 @@ void Mesh::loadOFF(const std::string & filename) {
     if (colorType == ColorType_Vertex) {
         vertColors.resize(sizeV);
         for (unsigned int i = 0; i < sizeV; i++) {
-            in >> vertices[i].position >> vertColors[i] >> tmp;
+            in >> positions[i] >> vertColors[i] >> tmp;
             vertColors[i] /= 255.0;
         }
     } else {
         for (unsigned int i = 0; i < sizeV; i++) {
-            in >> vertices[i].position;
+            in >> positions[i];
         }
     }
 
@@ -68,45 +90,172 @@ void Mesh::loadOFF(const std::string & filename) {
 
     in.close();
 
-    for (unsigned int i = 0; i < triangles.size(); i++) {
-        triangles[i].v[3] = i;
-    }
+    MeshCache::save_source(*this);
 }
 
 
 void Mesh::recomputeNormals () {
-    for (unsigned int i = 0; i < vertices.size (); i++)
-        vertices[i].normal = Vec3 (0.0, 0.0, 0.0);
+    normals.assign (positions.size (), Vec3 (0.0, 0.0, 0.0));
     for (unsigned int i = 0; i < triangles.size (); i++) {
-        Vec3 e01 = vertices[triangles[i].v[1]].position -  vertices[triangles[i].v[0]].position;
-        Vec3 e02 = vertices[triangles[i].v[2]].position -  vertices[triangles[i].v[0]].position;
+        Vec3 e01 = positions[triangles[i].v[1]] -  positions[triangles[i].v[0]];
+        Vec3 e02 = positions[triangles[i].v[2]] -  positions[triangles[i].v[0]];
         Vec3 n = Vec3::cross (e01, e02);
         n.normalize ();
         for (unsigned int j = 0; j < 3; j++)
-            vertices[triangles[i].v[j]].normal += n;
+            normals[triangles[i].v[j]] += n;
     }
-    for (unsigned int i = 0; i < vertices.size (); i++)
-        vertices[i].normal.normalize ();
+    for (unsigned int i = 0; i < normals.size (); i++)
+        normals[i].normalize ();
 }
 
 void Mesh::centerAndScaleToUnit () {
+    if (positions.empty()) return;
+    const float op = 2.f;
+    build_hash = hash_bytes(&op, sizeof(op), build_hash);
     Vec3 c(0,0,0);
-    for  (unsigned int i = 0; i < vertices.size (); i++)
-        c += vertices[i].position;
-    c /= vertices.size ();
-    float maxD = (vertices[0].position - c).length();
-    for (unsigned int i = 0; i < vertices.size (); i++){
-        float m = (vertices[i].position - c).length();
+    for  (unsigned int i = 0; i < positions.size (); i++)
+        c += positions[i];
+    c /= positions.size ();
+    float maxD = (positions[0] - c).length();
+    for (unsigned int i = 0; i < positions.size (); i++){
+        float m = (positions[i] - c).length();
         if (m > maxD)
             maxD = m;
     }
-    for  (unsigned int i = 0; i < vertices.size (); i++)
-        vertices[i].position = (vertices[i].position - c) / maxD;
+    for  (unsigned int i = 0; i < positions.size (); i++)
+        positions[i] = (positions[i] - c) / maxD;
 }
 
 void Mesh::computeKDTree() {
+    TRACE_SPAN("computeKDTree", source_file);
     computeAABB();
-    kdtree = new KDTree(triangles, aabb, vertices);
+    kdtree = MeshCache::load_kdtree(*this);
+    if (!kdtree) {
+        kdtree = new KDTree(*this);
+        MeshCache::save_build(*this);
+    }
+    if (KDTREE_REPORT) printKDTreeReport();
+    if (MESH_COMPACT_ATTRIBUTES) compress();
+}
+
+void Mesh::place(const Vec3 & rotation, const Vec3 & translation) {
+    TRACE_SPAN("Mesh::place", source_file);
+    if (!kdtree) return;
+    if (rest_positions.empty()) {
+        rest_positions = positions;
+        rest_center = 0.5f * (aabb.p0 + aabb.p1);
+        kdtree_sah = kdtree->refit();
+    }
+    Mat3 transform = Mat3(1., 0., 0., 0., 1., 0., 0., 0., 1.);
+    for (int axis = 0; axis < 3; axis++) {
+        float a = rotation[axis] * M_PI / 180.;
+        float c = cos(a), s = sin(a);
+        Mat3 r = axis == 0 ? Mat3(1., 0., 0., 0., c, -s, 0., s, c)
+               : axis == 1 ? Mat3(c, 0., s, 0., 1., 0., -s, 0., c)
+                           : Mat3(c, -s, 0., s, c, 0., 0., 0., 1.);
+        transform = r * transform;
+    }
+    // Without rotation the rest pose is given back exactly
+    bool rotated = rotation[0] != 0.f || rotation[1] != 0.f || rotation[2] != 0.f;
+    for (unsigned int v = 0; v < positions.size(); v++) {
+        positions[v] = rotated ? transform * (rest_positions[v] - rest_center) + rest_center + translation : rest_positions[v] + translation;
+    }
+    computeAABB();
+    if (kdtree->refit() > KDTREE_REFIT_LIMIT * kdtree_sah) {
+        delete kdtree;
+        kdtree = new KDTree(*this);
+        kdtree_sah = kdtree->refit();
+        kdtree_rebuilds++;
+    }
+}
+
+void Mesh::printKDTreeReport() const {
+    // Own generator : the report must not change the random sequence of the scene setup
+    std::mt19937 generator(1);
+    std::uniform_real_distribution<float> uniform(0.f, 1.f);
+    Vec3 center = 0.5f * (aabb.p0 + aabb.p1);
+    float radius = (aabb.p1 - aabb.p0).length();
+    std::vector<Ray> rays(KDTREE_PROBE_RAYS);
+    for (Ray& ray : rays) {
+        Vec3 origin;
+        do {
+            origin = Vec3(2.f * uniform(generator) - 1.f, 2.f * uniform(generator) - 1.f, 2.f * uniform(generator) - 1.f);
+        } while (origin.squareLength() > 1.f || origin.squareLength() < 1e-6f);
+        origin.normalize();
+        origin = center + radius * origin;
+        Vec3 target;
+        for (int axis = 0; axis < 3; axis++) target[axis] = aabb.p0[axis] + uniform(generator) * (aabb.p1[axis] - aabb.p0[axis]);
+        Vec3 direction = target - origin;
+        direction.normalize();
+        ray = Ray(origin, direction, 0.f);
+    }
+    std::cout << "KDTree of " << (source_file.empty() ? std::string("mesh") : source_file) << ", " << triangleCount() << " triangles" << std::endl
+              << kdtree->report() << kdtree->probe(rays);
+}
+
+void Mesh::compress() {
+    if (compact) return;
+    packed_normals.resize(normals.size());
+    for (unsigned int i = 0; i < normals.size(); i++) packed_normals[i] = pack_normal(normals[i]);
+
+    for (int c = 0; c < 2; c++) {
+        float lo = FLT_MAX, hi = -FLT_MAX;
+        for (unsigned int i = c; i < uvs.size(); i += 2) {
+            lo = std::min(lo, uvs[i]);
+            hi = std::max(hi, uvs[i]);
+        }
+        uv_min[c] = uvs.empty() ? 0.f : lo;
+        uv_range[c] = uvs.empty() ? 0.f : hi - lo;
+    }
+    packed_uvs.resize(uvs.size());
+    for (unsigned int i = 0; i < uvs.size(); i++) {
+        float range = uv_range[i % 2];
+        packed_uvs[i] = range > 0.f ? pack_unorm16((uvs[i] - uv_min[i % 2]) / range) : 0;
+    }
+
+    packed_vertColors.resize(vertColors.size());
+    for (unsigned int i = 0; i < vertColors.size(); i++) packed_vertColors[i] = pack_color(vertColors[i]);
+    packed_faceColors.resize(faceColors.size());
+    for (unsigned int i = 0; i < faceColors.size(); i++) packed_faceColors[i] = pack_color(faceColors[i]);
+
+    if (positions.size() <= 65536) {
+        packed_triangles.resize(3 * triangles.size());
+        for (unsigned int i = 0; i < triangles.size(); i++) {
+            for (int j = 0; j < 3; j++) packed_triangles[3*i + j] = triangles[i][j];
+        }
+        std::vector< MeshTriangle >().swap(triangles);
+    }
+    std::vector< Vec3 >().swap(normals);
+    std::vector< float >().swap(uvs);
+    std::vector< Vec3 >().swap(vertColors);
+    std::vector< Vec3 >().swap(faceColors);
+    compact = true;
+}
+
+void Mesh::expand() {
+    if (!compact) return;
+    unsigned int nV = packed_normals.size();
+    normals.resize(nV);
+    uvs.resize(2 * nV);
+    for (unsigned int i = 0; i < nV; i++) {
+        normals[i] = vertexNormal(i);
+        vertexUV(i, uvs[2*i + 0], uvs[2*i + 1]);
+    }
+    vertColors.resize(packed_vertColors.size());
+    for (unsigned int i = 0; i < vertColors.size(); i++) vertColors[i] = unpack_color(packed_vertColors[i]);
+    faceColors.resize(packed_faceColors.size());
+    for (unsigned int i = 0; i < faceColors.size(); i++) faceColors[i] = unpack_color(packed_faceColors[i]);
+    if (!packed_triangles.empty()) {
+        triangles.resize(packed_triangles.size() / 3);
+        for (unsigned int i = 0; i < triangles.size(); i++) triangles[i] = triangle(i);
+    }
+    std::vector< uint16_t >().swap(packed_normals);
+    std::vector< uint16_t >().swap(packed_uvs);
+    std::vector< Color8 >().swap(packed_vertColors);
+    std::vector< Color8 >().swap(packed_faceColors);
+    std::vector< uint16_t >().swap(packed_triangles);
+    std::vector< Vec3 >().swap(preview_normals);
+    compact = false;
 }
 
 RayTriangleIntersection Mesh::intersect( Ray const & ray ) const {
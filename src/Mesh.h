@@ -12,9 +12,17 @@
 #include <GL/glut.h>
 
 #include <cfloat>
+#include <memory>
+#include <cstdint>
+#include <algorithm>
+#include <type_traits>
 
 
 #include "AABB.h"
+#include "MappedFile.h"
+#include "MeshCache.h"
+#include "PackedAttributes.h"
+#include "RenderCounters.h"
 
 class KDTree;
 
@@ -29,114 +37,131 @@ class KDTree;
 
 
 
-struct MeshVertex {
-    inline MeshVertex () {}
-    inline MeshVertex (const Vec3 & _p, const Vec3 & _n) : position (_p), normal (_n) , u(0) , v(0) {}
-    inline MeshVertex (const MeshVertex & vertex) : position (vertex.position), normal (vertex.normal) , u(vertex.u) , v(vertex.v) {}
-    inline virtual ~MeshVertex () {}
-    inline MeshVertex & operator = (const MeshVertex & vertex) {
-        position = vertex.position;
-        normal = vertex.normal;
-        u = vertex.u;
-        v = vertex.v;
-        return (*this);
-    }
-    // membres :
-    Vec3 position; // une position
-    Vec3 normal; // une normale
-    float u,v; // coordonnees uv
-};
-
+// Plain indices, so that the triangle list can be copied as a block and handed to OpenGL as is
 struct MeshTriangle {
-    inline MeshTriangle () {
-        v[0] = v[1] = v[2] = v[3] = 0;
-    }
-    inline MeshTriangle (const MeshTriangle & t) {
-        v[0] = t.v[0];   v[1] = t.v[1];   v[2] = t.v[2];  v[3] = t.v[3];
-    }
-    inline MeshTriangle (unsigned int v0, unsigned int v1, unsigned int v2) {
-        v[0] = v0;   v[1] = v1;   v[2] = v2;  v[3] = 0;
+    MeshTriangle () = default;
+    MeshTriangle (unsigned int v0, unsigned int v1, unsigned int v2) {
+        v[0] = v0;   v[1] = v1;   v[2] = v2;
     }
     unsigned int & operator [] (unsigned int iv) { return v[iv]; }
     unsigned int operator [] (unsigned int iv) const { return v[iv]; }
-    inline virtual ~MeshTriangle () {}
-    inline MeshTriangle & operator = (const MeshTriangle & t) {
-        v[0] = t.v[0];   v[1] = t.v[1];   v[2] = t.v[2];   v[3] = t.v[3];
-        return (*this);
-    }
     // membres :
-    unsigned int v[4]; // v[0 - 2] : indices des 3 sommets du triangle, v[3] : index du triangle
+    unsigned int v[3]; // indices des 3 sommets du triangle
 };
 
+static_assert(std::is_trivially_copyable<Vec3>::value && sizeof(Vec3) == 3 * sizeof(float), "Vec3 arrays are used as float arrays");
+static_assert(std::is_trivially_copyable<MeshTriangle>::value && sizeof(MeshTriangle) == 3 * sizeof(unsigned int), "MeshTriangle arrays are used as index arrays");
+
 enum ColorType {
     ColorType_Vertex,
     ColorType_Face,
     ColorType_None
 };
 
+// Structure of arrays : one entry per vertex in positions, normals and uvs (2 floats), one per triangle in triangles.
+// OpenGL draws straight from these arrays.
+// Once compressed (see compress), the attributes other than the positions are only available through
+// triangle / vertexNormal / vertexUV / vertexColor / faceColor, which work in both states.
 class Mesh {
-protected:
-    void build_positions_array() {
-        positions_array.resize( 3 * vertices.size() );
-        for( unsigned int v = 0 ; v < vertices.size() ; ++v ) {
-            positions_array[3*v + 0] = vertices[v].position[0];
-            positions_array[3*v + 1] = vertices[v].position[1];
-            positions_array[3*v + 2] = vertices[v].position[2];
-        }
-    }
-    void build_normals_array() {
-        normalsArray.resize( 3 * vertices.size() );
-        for( unsigned int v = 0 ; v < vertices.size() ; ++v ) {
-            normalsArray[3*v + 0] = vertices[v].normal[0];
-            normalsArray[3*v + 1] = vertices[v].normal[1];
-            normalsArray[3*v + 2] = vertices[v].normal[2];
-        }
-    }
-    void build_UVs_array() {
-        uvs_array.resize( 2 * vertices.size() );
-        for( unsigned int vert = 0 ; vert < vertices.size() ; ++vert ) {
-            uvs_array[2*vert + 0] = vertices[vert].u;
-            uvs_array[2*vert + 1] = vertices[vert].v;
-        }
-    }
-    void build_triangles_array() {
-        triangles_array.resize( 3 * triangles.size() );
-        for( unsigned int t = 0 ; t < triangles.size() ; ++t ) {
-            triangles_array[3*t + 0] = triangles[t].v[0];
-            triangles_array[3*t + 1] = triangles[t].v[1];
-            triangles_array[3*t + 2] = triangles[t].v[2];
-        }
-    }
 public:
-    std::vector<MeshVertex> vertices;
-    std::vector<MeshTriangle> triangles;
+    std::vector< Vec3 > positions;
+    std::vector< Vec3 > normals;
+    std::vector< float > uvs;
+    std::vector< MeshTriangle > triangles;
     std::vector< Vec3 > vertColors;
     std::vector< Vec3 > faceColors;
     ColorType colorType;
     AABB aabb;
     KDTree * kdtree;
 
-    std::vector< float > positions_array;
-    std::vector< float > normalsArray;
-    std::vector< float > uvs_array;
-    std::vector< unsigned int > triangles_array;
-
-    Material material;
+    // Compressed attributes, see PackedAttributes.h
+    bool compact;
+    std::vector< uint16_t > packed_normals;
+    std::vector< uint16_t > packed_uvs; // over [uv_min, uv_min + uv_range]
+    float uv_min[2], uv_range[2];
+    std::vector< Color8 > packed_vertColors;
+    std::vector< Color8 > packed_faceColors;
+    std::vector< uint16_t > packed_triangles; // 3 per triangle, only for meshes of at most 65536 vertices (triangles is kept otherwise)
+    mutable std::vector< Vec3 > preview_normals; // packed_normals decoded by the first draw, only for the OpenGL preview
+
+    unsigned int material_index; // in the scene's material table
+    Vec3 motion_blur_translation;
+
+    // Mesh cache (see MeshCache.h)
+    std::string source_file; // OFF file the mesh was loaded from, empty otherwise
+    uint64_t source_hash;
+    uint64_t build_hash; // transformations applied since loading
+    std::shared_ptr<MappedFile> build_cache;
+
+    // Animation (see place) : positions of the first placement, and SAH cost of the tree after its last build
+    std::vector< Vec3 > rest_positions;
+    Vec3 rest_center;
+    float kdtree_sah;
+    unsigned int kdtree_rebuilds;
+
+    Mesh() : colorType(ColorType_None), kdtree(nullptr), compact(false), uv_min{0.f, 0.f}, uv_range{0.f, 0.f}, material_index(0), motion_blur_translation(0.), source_hash(0), build_hash(0), kdtree_sah(0.f), kdtree_rebuilds(0) {}
 
     void loadOFF (const std::string & filename);
     void recomputeNormals ();
     void centerAndScaleToUnit ();
     void scaleUnit ();
     void computeKDTree();
+    // Rigid motion from the pose of the first call : rotation (degrees, around x then y then z, like rotate) about the
+    // center of that pose, then translation. The KD-tree is refitted, and rebuilt past KDTREE_REFIT_LIMIT, without
+    // going through the mesh cache. Vertex normals, only used by the OpenGL preview, are left as they were.
+    void place(const Vec3 & rotation, const Vec3 & translation);
+
+    // KDTree::report and a probe with rays through the bounding box, on the standard output
+    void printKDTreeReport() const;
+
+    // Replaces the normals, uvs, colors and (small meshes) indices by their compressed form, the positions are kept as is.
+    // Called by computeKDTree if MESH_COMPACT_ATTRIBUTES is set. expand brings the float arrays back (lossy for normals and uvs).
+    void compress();
+    void expand();
+
+    unsigned int triangleCount() const {
+        return packed_triangles.empty() ? triangles.size() : packed_triangles.size() / 3;
+    }
+    MeshTriangle triangle( unsigned int t ) const {
+        if (packed_triangles.empty()) return triangles[t];
+        const uint16_t *p = &packed_triangles[3 * t];
+        return MeshTriangle(p[0], p[1], p[2]);
+    }
+    Vec3 vertexNormal( unsigned int v ) const {
+        return compact ? unpack_normal(packed_normals[v]) : normals[v];
+    }
+    void vertexUV( unsigned int v , float & u , float & uv_v ) const {
+        if (compact) {
+            u = uv_min[0] + packed_uvs[2*v + 0] * (uv_range[0] / 65535.f);
+            uv_v = uv_min[1] + packed_uvs[2*v + 1] * (uv_range[1] / 65535.f);
+        } else {
+            u = uvs[2*v + 0];
+            uv_v = uvs[2*v + 1];
+        }
+    }
+    Vec3 vertexColor( unsigned int v ) const {
+        return compact ? unpack_color(packed_vertColors[v]) : vertColors[v];
+    }
+    Vec3 faceColor( unsigned int t ) const {
+        return compact ? unpack_color(packed_faceColors[t]) : faceColors[t];
+    }
+
 
+    // Key of the cached normals and KD-tree : source, transformations and build parameters
+    uint64_t build_key() const {
+        uint64_t key = hash_bytes(&source_hash, sizeof(source_hash), build_hash);
+        const float params[] = {KDTREE_MAX_DEPTH, KDTREE_TRIANGLES_PER_LEAF, TRIANGLE_SCALING, EPSILON};
+        return hash_bytes(params, sizeof(params), key);
+    }
 
+    // Normals (from the cache or recomputed), uvs and bounding box
     virtual
     void build_arrays() {
-        recomputeNormals();
-        build_positions_array();
-        build_normals_array();
-        build_UVs_array();
-        build_triangles_array();
+        if (compact) expand();
+        if (!MeshCache::load_build(*this)) {
+            recomputeNormals();
+            if (uvs.size() != 2 * positions.size()) uvs.assign(2 * positions.size(), 0.f);
+        }
         computeAABB();
     }
 
@@ -144,25 +169,10 @@ public:
         Vec3 p0, p1;
         p0 = Vec3(FLT_MAX);
         p1 = Vec3(FLT_MIN);
-        for (int i = 0; i < vertices.size(); i++) {
+        for (unsigned int i = 0; i < positions.size(); i++) {
             for (int axis = 0; axis < 3; axis++) {
-                if (vertices[i].position[axis] < p0[axis]) p0[axis] = vertices[i].position[axis];
-                if (vertices[i].position[axis] > p1[axis]) p1[axis] = vertices[i].position[axis];
-            }
-        }
-        p0 -= Vec3(EPSILON);
-        p1 += Vec3(EPSILON);
-        aabb = AABB(p0, p1);
-    }
-
-    void computeAABBFromPosArray() {
-        Vec3 p0, p1;
-        p0 = Vec3(FLT_MAX);
-        p1 = Vec3(FLT_MIN);
-        for (int i = 0; i < positions_array.size(); i += 3) {
-            for (int axis = 0; axis < 3; axis++) {
-                if (positions_array[i + axis] < p0[axis]) p0[axis] = positions_array[i + axis];
-                if (positions_array[i + axis] > p1[axis]) p1[axis] = positions_array[i + axis];
+                p0[axis] = std::min(p0[axis], positions[i][axis]);
+                p1[axis] = std::max(p1[axis], positions[i][axis]);
             }
         }
         p0 -= Vec3(EPSILON);
@@ -171,19 +181,20 @@ public:
     }
 
     void translate( Vec3 const & translation ){
-        for( unsigned int v = 0 ; v < vertices.size() ; ++v ) {
-            vertices[v].position += translation;
+        const float op[] = {0.f, translation[0], translation[1], translation[2]};
+        build_hash = hash_bytes(op, sizeof(op), build_hash);
+        for( unsigned int v = 0 ; v < positions.size() ; ++v ) {
+            positions[v] += translation;
         }
     }
 
     void apply_transformation_matrix( Mat3 transform ){
-        for( unsigned int v = 0 ; v < vertices.size() ; ++v ) {
-            vertices[v].position = transform*vertices[v].position;
+        float op[10] = {1.f};
+        for (int i = 0; i < 9; i++) op[i + 1] = transform(i / 3, i % 3);
+        build_hash = hash_bytes(op, sizeof(op), build_hash);
+        for( unsigned int v = 0 ; v < positions.size() ; ++v ) {
+            positions[v] = transform*positions[v];
         }
-
-        //        recomputeNormals();
-        //        build_positions_array();
-        //        build_normals_array();
     }
 
     void scale( Vec3 const & scale ){
@@ -224,8 +235,8 @@ public:
     }
 
 
-    void draw() const {
-        if( triangles_array.size() == 0 ) return;
+    void draw(const Material & material) const {
+        if( triangleCount() == 0 || (!compact && normals.size() != positions.size()) ) return;
         GLfloat material_color[4] = {material.diffuse_material[0],
                                      material.diffuse_material[1],
                                      material.diffuse_material[2],
@@ -248,9 +259,18 @@ public:
 
         glEnableClientState(GL_VERTEX_ARRAY) ;
         glEnableClientState (GL_NORMAL_ARRAY);
-        glNormalPointer (GL_FLOAT, 3*sizeof (float), (GLvoid*)(normalsArray.data()));
-        glVertexPointer (3, GL_FLOAT, 3*sizeof (float) , (GLvoid*)(positions_array.data()));
-        glDrawElements(GL_TRIANGLES, triangles_array.size(), GL_UNSIGNED_INT, (GLvoid*)(triangles_array.data()));
+        // Compressed normals are decoded for the preview once and kept, the indices can be drawn as they are
+        if (compact && preview_normals.size() != positions.size()) {
+            preview_normals.resize(positions.size());
+            for (unsigned int v = 0; v < positions.size(); v++) preview_normals[v] = unpack_normal(packed_normals[v]);
+        }
+        glNormalPointer (GL_FLOAT, sizeof (Vec3), (GLvoid*)(compact ? preview_normals.data() : normals.data()));
+        glVertexPointer (3, GL_FLOAT, sizeof (Vec3) , (GLvoid*)(positions.data()));
+        if (packed_triangles.empty()) {
+            glDrawElements(GL_TRIANGLES, 3 * triangles.size(), GL_UNSIGNED_INT, (GLvoid*)(triangles.data()));
+        } else {
+            glDrawElements(GL_TRIANGLES, packed_triangles.size(), GL_UNSIGNED_SHORT, (GLvoid*)(packed_triangles.data()));
+        }
 
     }
 
@@ -259,14 +279,16 @@ public:
         closestIntersection.t = FLT_MAX;
         // Accelerer en testant avec l'AABB du mesh avant le triangle
         if (!aabb.intersects(ray)) return closestIntersection;
+        RENDER_STAT(triangle_tests, triangleCount());
         // Note :
         // Creer un objet Triangle pour chaque face
         // Vous constaterez des problemes de précision
         // solution : ajouter un facteur d'échelle lors de la création du Triangle : float triangleScaling = 1.000001;
-        for (unsigned int i = 0; i < triangles.size(); i++) {
-            Triangle triangle(vertices[triangles[i][0]].position * TRIANGLE_SCALING,
-                              vertices[triangles[i][1]].position * TRIANGLE_SCALING,
-                              vertices[triangles[i][2]].position * TRIANGLE_SCALING);
+        for (unsigned int i = 0; i < triangleCount(); i++) {
+            MeshTriangle t = this->triangle(i);
+            Triangle triangle(positions[t[0]] * TRIANGLE_SCALING,
+                              positions[t[1]] * TRIANGLE_SCALING,
+                              positions[t[2]] * TRIANGLE_SCALING);
             RayTriangleIntersection intersection = triangle.getIntersection(ray);
             if (intersection.intersectionExists && intersection.t < closestIntersection.t) {
                 closestIntersection = intersection;
@@ -277,6 +299,14 @@ public:
     }
 
     RayTriangleIntersection intersect( Ray const & ray ) const;
+
+    // Face normal of the triangle, as used by the intersection
+    Vec3 triangleNormal( unsigned int t ) const {
+        MeshTriangle triangle = this->triangle(t);
+        return Triangle(positions[triangle[0]] * TRIANGLE_SCALING,
+                        positions[triangle[1]] * TRIANGLE_SCALING,
+                        positions[triangle[2]] * TRIANGLE_SCALING).normal();
+    }
 };
 
 
@@ -0,0 +1,227 @@
+#include "MeshCache.h"
+#include "Mesh.h"
+#include "KDTree.hpp"
+#include "MappedFile.h"
+#include "Constants.h"
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <iostream>
+#include <thread>
+#include <functional>
+
+namespace MeshCache {
+
+struct SectionData {
+    uint32_t id;
+    const void *data;
+    uint64_t size;
+};
+
+static std::string source_cache_path(const Mesh &mesh) {
+    return mesh.source_file + ".cache";
+}
+
+static std::string build_cache_path(const Mesh &mesh) {
+    char key[17];
+    snprintf(key, sizeof(key), "%016llx", (unsigned long long)mesh.build_key());
+    return mesh.source_file + "." + key + ".cache";
+}
+
+static uint64_t align16(uint64_t offset) {
+    return (offset + 15) & ~uint64_t(15);
+}
+
+// Writes to a temporary file then renames it, so a mapped cache is never modified in place
+static bool write_file(const std::string &filename, MeshCacheHeader header, const std::vector<SectionData> &sections) {
+    std::memcpy(header.magic, "RTMC", 4);
+    header.version = MESH_CACHE_VERSION;
+    header.nSections = sections.size();
+
+    std::vector<MeshCacheSection> table(sections.size());
+    uint64_t offset = align16(sizeof(MeshCacheHeader) + sections.size() * sizeof(MeshCacheSection));
+    for (unsigned int i = 0; i < sections.size(); i++) {
+        table[i].id = sections[i].id;
+        table[i].reserved = 0;
+        table[i].offset = offset;
+        table[i].size = sections[i].size;
+        offset = align16(offset + sections[i].size);
+    }
+
+    // Scenes built concurrently may write the same cache
+    std::string tmp = filename + ".tmp" + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id()));
+    FILE *f = fopen(tmp.c_str(), "wb");
+    if (!f) return false;
+    static const char padding[16] = {0};
+    bool ok = fwrite(&header, sizeof(header), 1, f) == 1;
+    ok = ok && (table.empty() || fwrite(table.data(), sizeof(MeshCacheSection), table.size(), f) == table.size());
+    uint64_t written = sizeof(MeshCacheHeader) + table.size() * sizeof(MeshCacheSection);
+    for (unsigned int i = 0; ok && i < sections.size(); i++) {
+        ok = fwrite(padding, 1, table[i].offset - written, f) == table[i].offset - written;
+        ok = ok && (sections[i].size == 0 || fwrite(sections[i].data, 1, sections[i].size, f) == sections[i].size);
+        written = table[i].offset + sections[i].size;
+    }
+    ok = (fclose(f) == 0) && ok;
+    if (!ok || rename(tmp.c_str(), filename.c_str()) != 0) {
+        remove(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+static const MeshCacheHeader * check_header(const MappedFile &file, uint32_t kind, uint64_t source_hash, uint64_t build_hash) {
+    if (!file.is_open() || file.size() < sizeof(MeshCacheHeader)) return nullptr;
+    const MeshCacheHeader *header = (const MeshCacheHeader *)file.data();
+    if (std::memcmp(header->magic, "RTMC", 4) != 0 || header->version != MESH_CACHE_VERSION || header->kind != kind) return nullptr;
+    if (header->source_hash != source_hash || header->build_hash != build_hash) return nullptr;
+    if (sizeof(MeshCacheHeader) + header->nSections * sizeof(MeshCacheSection) > file.size()) return nullptr;
+    return header;
+}
+
+// Returns nullptr if the section is missing, truncated or does not have the expected size
+static const void * find_section(const MappedFile &file, uint32_t id, uint64_t expectedSize) {
+    const MeshCacheHeader *header = (const MeshCacheHeader *)file.data();
+    const MeshCacheSection *table = (const MeshCacheSection *)(file.data() + sizeof(MeshCacheHeader));
+    for (unsigned int i = 0; i < header->nSections; i++) {
+        if (table[i].id != id) continue;
+        if (table[i].size != expectedSize || table[i].offset + table[i].size > file.size()) return nullptr;
+        return file.data() + table[i].offset;
+    }
+    return nullptr;
+}
+
+static uint64_t section_size(const MappedFile &file, uint32_t id) {
+    const MeshCacheHeader *header = (const MeshCacheHeader *)file.data();
+    const MeshCacheSection *table = (const MeshCacheSection *)(file.data() + sizeof(MeshCacheHeader));
+    for (unsigned int i = 0; i < header->nSections; i++) {
+        if (table[i].id == id) return table[i].size;
+    }
+    return 0;
+}
+
+bool load_source(Mesh &mesh) {
+    if (!MESH_CACHE || mesh.source_file.empty()) return false;
+    MappedFile file(source_cache_path(mesh));
+    const MeshCacheHeader *header = check_header(file, MeshCacheKind_Source, mesh.source_hash, 0);
+    if (!header) return false;
+
+    unsigned int nV = header->nVertices, nT = header->nTriangles;
+    ColorType colorType = (ColorType)header->colorType;
+    const float *positions = (const float *)find_section(file, MeshCacheSection_Positions, nV * 3 * sizeof(float));
+    const uint32_t *triangles = (const uint32_t *)find_section(file, MeshCacheSection_Triangles, nT * 3 * sizeof(uint32_t));
+    const void *vertColors = find_section(file, MeshCacheSection_VertColors, nV * sizeof(Vec3));
+    const void *faceColors = find_section(file, MeshCacheSection_FaceColors, nT * sizeof(Vec3));
+    if (!positions || !triangles) return false;
+    if (colorType == ColorType_Vertex && !vertColors) return false;
+    if (colorType == ColorType_Face && !faceColors) return false;
+
+    mesh.colorType = colorType;
+    // Same layout as the mesh arrays
+    mesh.positions.assign((const Vec3 *)positions, (const Vec3 *)positions + nV);
+    mesh.triangles.assign((const MeshTriangle *)triangles, (const MeshTriangle *)triangles + nT);
+    mesh.vertColors.clear();
+    mesh.faceColors.clear();
+    if (colorType == ColorType_Vertex) {
+        mesh.vertColors.assign((const Vec3 *)vertColors, (const Vec3 *)vertColors + nV);
+    } else if (colorType == ColorType_Face) {
+        mesh.faceColors.assign((const Vec3 *)faceColors, (const Vec3 *)faceColors + nT);
+    }
+    return true;
+}
+
+void save_source(const Mesh &mesh) {
+    if (!MESH_CACHE || mesh.source_file.empty()) return;
+    MeshCacheHeader header;
+    std::memset(&header, 0, sizeof(header));
+    header.kind = MeshCacheKind_Source;
+    header.source_hash = mesh.source_hash;
+    header.nVertices = mesh.positions.size();
+    header.nTriangles = mesh.triangles.size();
+    header.colorType = mesh.colorType;
+
+    std::vector<SectionData> sections;
+    sections.push_back({MeshCacheSection_Positions, mesh.positions.data(), mesh.positions.size() * sizeof(Vec3)});
+    sections.push_back({MeshCacheSection_Triangles, mesh.triangles.data(), mesh.triangles.size() * sizeof(MeshTriangle)});
+    if (mesh.colorType == ColorType_Vertex) {
+        sections.push_back({MeshCacheSection_VertColors, mesh.vertColors.data(), mesh.vertColors.size() * sizeof(Vec3)});
+    } else if (mesh.colorType == ColorType_Face) {
+        sections.push_back({MeshCacheSection_FaceColors, mesh.faceColors.data(), mesh.faceColors.size() * sizeof(Vec3)});
+    }
+    if (!write_file(source_cache_path(mesh), header, sections)) {
+        std::cout << "Could not write mesh cache for " << mesh.source_file << std::endl;
+    }
+}
+
+bool load_build(Mesh &mesh) {
+    mesh.build_cache.reset();
+    if (!MESH_CACHE || mesh.source_file.empty()) return false;
+    std::shared_ptr<MappedFile> file = std::make_shared<MappedFile>(build_cache_path(mesh));
+    const MeshCacheHeader *header = check_header(*file, MeshCacheKind_Build, mesh.source_hash, mesh.build_key());
+    if (!header || header->nVertices != mesh.positions.size() || header->nTriangles != mesh.triangles.size()) return false;
+
+    unsigned int nV = header->nVertices;
+    const float *normals = (const float *)find_section(*file, MeshCacheSection_Normals, nV * 3 * sizeof(float));
+    const float *uvs = (const float *)find_section(*file, MeshCacheSection_UVs, nV * 2 * sizeof(float));
+    if (!normals || !uvs) return false;
+    mesh.normals.assign((const Vec3 *)normals, (const Vec3 *)normals + nV);
+    mesh.uvs.assign(uvs, uvs + 2 * nV);
+    mesh.build_cache = file;
+    return true;
+}
+
+KDTree * load_kdtree(Mesh &mesh) {
+    if (!MESH_CACHE || mesh.source_file.empty()) return nullptr;
+    // The mesh may have been transformed since build_arrays
+    if (!mesh.build_cache || !check_header(*mesh.build_cache, MeshCacheKind_Build, mesh.source_hash, mesh.build_key())) {
+        if (!load_build(mesh)) return nullptr;
+    }
+    const MappedFile &file = *mesh.build_cache;
+    uint64_t nodesSize = section_size(file, MeshCacheSection_KDNodes);
+    uint64_t referencesSize = section_size(file, MeshCacheSection_KDReferences);
+    const KDTreeFlatNode *nodes = (const KDTreeFlatNode *)find_section(file, MeshCacheSection_KDNodes, nodesSize);
+    const unsigned int *references = (const unsigned int *)find_section(file, MeshCacheSection_KDReferences, referencesSize);
+    if (!nodes || nodesSize % sizeof(KDTreeFlatNode) != 0) return nullptr;
+    unsigned int nNodes = nodesSize / sizeof(KDTreeFlatNode);
+    unsigned int nReferences = referencesSize / sizeof(unsigned int);
+
+    // Validate the tree before trusting it
+    for (unsigned int i = 0; i < nNodes; i++) {
+        if (nodes[i].left >= (int)nNodes || nodes[i].right >= (int)nNodes) return nullptr;
+        if ((nodes[i].left >= 0 && nodes[i].left <= (int)i) || (nodes[i].right >= 0 && nodes[i].right <= (int)i)) return nullptr;
+        if ((uint64_t)nodes[i].first + nodes[i].count > nReferences) return nullptr;
+    }
+    for (unsigned int i = 0; i < nReferences; i++) {
+        if (references[i] >= mesh.triangles.size()) return nullptr;
+    }
+    return new KDTree(mesh, nodes, nNodes, references);
+}
+
+void save_build(const Mesh &mesh) {
+    if (!MESH_CACHE || mesh.source_file.empty()) return;
+    std::vector<KDTreeFlatNode> nodes;
+    std::vector<unsigned int> references;
+    if (mesh.kdtree) mesh.kdtree->flatten(nodes, references);
+
+    MeshCacheHeader header;
+    std::memset(&header, 0, sizeof(header));
+    header.kind = MeshCacheKind_Build;
+    header.source_hash = mesh.source_hash;
+    header.build_hash = mesh.build_key();
+    header.nVertices = mesh.positions.size();
+    header.nTriangles = mesh.triangles.size();
+    header.colorType = mesh.colorType;
+
+    std::vector<SectionData> sections;
+    sections.push_back({MeshCacheSection_Normals, mesh.normals.data(), mesh.normals.size() * sizeof(Vec3)});
+    sections.push_back({MeshCacheSection_UVs, mesh.uvs.data(), mesh.uvs.size() * sizeof(float)});
+    if (mesh.kdtree) {
+        sections.push_back({MeshCacheSection_KDNodes, nodes.data(), nodes.size() * sizeof(KDTreeFlatNode)});
+        sections.push_back({MeshCacheSection_KDReferences, references.data(), references.size() * sizeof(unsigned int)});
+    }
+    if (!write_file(build_cache_path(mesh), header, sections)) {
+        std::cout << "Could not write mesh cache for " << mesh.source_file << std::endl;
+    }
+}
+
+}
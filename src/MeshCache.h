@@ -0,0 +1,68 @@
+#ifndef MESHCACHE_H
+#define MESHCACHE_H
+
+#include <string>
+#include <cstdint>
+
+class Mesh;
+class KDTree;
+
+// Versioned binary cache for the meshes loaded from OFF files, memory-mapped when read back. Nothing is parsed, but
+// it is not zero-copy : the mesh keeps its std::vector arrays (transformed in place, placed by animations) and the
+// KDTree its node array, so every section is copied once out of the mapping.
+//   <file>.off.cache       : parsed OFF data (positions, vertex/face colors, triangles), keyed by the hash of the OFF file
+//   <file>.off.<key>.cache : what build_arrays / computeKDTree produce (normals, uvs, KD-tree), keyed by the hash of
+//                            the OFF file, the transformations applied to the mesh and the KD-tree build constants
+// Stale or unreadable caches are ignored and rewritten.
+
+#define MESH_CACHE_VERSION 1
+
+enum MeshCacheKind {
+    MeshCacheKind_Source = 0,
+    MeshCacheKind_Build = 1
+};
+
+enum MeshCacheSectionId {
+    MeshCacheSection_Positions = 0,   // float[3] per vertex
+    MeshCacheSection_VertColors = 1,  // float[3] per vertex
+    MeshCacheSection_FaceColors = 2,  // float[3] per triangle
+    MeshCacheSection_Triangles = 3,   // uint32[3] per triangle
+    MeshCacheSection_Normals = 4,     // float[3] per vertex
+    MeshCacheSection_UVs = 5,         // float[2] per vertex
+    MeshCacheSection_KDNodes = 6,     // KDTreeFlatNode
+    MeshCacheSection_KDReferences = 7 // uint32 per leaf triangle reference
+};
+
+struct MeshCacheHeader {
+    char magic[4]; // "RTMC"
+    uint32_t version;
+    uint32_t kind;
+    uint32_t nSections;
+    uint64_t source_hash;
+    uint64_t build_hash;
+    uint32_t nVertices;
+    uint32_t nTriangles;
+    uint32_t colorType;
+    uint32_t reserved;
+};
+
+struct MeshCacheSection {
+    uint32_t id;
+    uint32_t reserved;
+    uint64_t offset; // from the beginning of the file, 16 bytes aligned
+    uint64_t size;
+};
+
+namespace MeshCache {
+    // OFF data, called by Mesh::loadOFF
+    bool load_source(Mesh &mesh);
+    void save_source(const Mesh &mesh);
+
+    // Normals and uvs, called by Mesh::build_arrays. Keeps the file mapped for load_kdtree.
+    bool load_build(Mesh &mesh);
+    // Returns nullptr if there is no prebuilt tree for the current state of the mesh
+    KDTree * load_kdtree(Mesh &mesh);
+    void save_build(const Mesh &mesh);
+}
+
+#endif // MESHCACHE_H
@@ -0,0 +1,62 @@
+#ifndef PACKEDATTRIBUTES_H
+#define PACKEDATTRIBUTES_H
+
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+#include "Vec3.h"
+
+// Compact encodings of the mesh attributes (see Mesh::compress)
+//   normals : octahedral mapping, 8 bits per coordinate (16 bits per normal, error under 1 degree)
+//   uvs     : 16 bits fixed point over the range of the mesh
+//   colors  : 8 bits per channel, exact for the colors read from OFF files
+
+struct Color8 {
+    uint8_t r, g, b;
+};
+
+static inline uint8_t pack_unorm8(float x) {
+    return (uint8_t)std::lround(std::min(std::max(x, 0.f), 1.f) * 255.f);
+}
+
+static inline uint16_t pack_unorm16(float x) {
+    return (uint16_t)std::lround(std::min(std::max(x, 0.f), 1.f) * 65535.f);
+}
+
+static inline Color8 pack_color(const Vec3 &c) {
+    return Color8{pack_unorm8(c[0]), pack_unorm8(c[1]), pack_unorm8(c[2])};
+}
+
+static inline Vec3 unpack_color(Color8 c) {
+    return Vec3(c.r, c.g, c.b) / 255.f;
+}
+
+// n is projected on the octahedron |x| + |y| + |z| = 1, whose lower half is folded over the upper half
+static inline uint16_t pack_normal(const Vec3 &n) {
+    float l1 = fabsf(n[0]) + fabsf(n[1]) + fabsf(n[2]);
+    if (l1 == 0.f) return pack_unorm8(0.5f) | (pack_unorm8(0.5f) << 8);
+    float x = n[0] / l1, y = n[1] / l1;
+    if (n[2] < 0.f) {
+        float fx = (1.f - fabsf(y)) * (x >= 0.f ? 1.f : -1.f);
+        float fy = (1.f - fabsf(x)) * (y >= 0.f ? 1.f : -1.f);
+        x = fx;
+        y = fy;
+    }
+    return pack_unorm8(x * 0.5f + 0.5f) | (pack_unorm8(y * 0.5f + 0.5f) << 8);
+}
+
+static inline Vec3 unpack_normal(uint16_t p) {
+    float x = (p & 0xff) / 127.5f - 1.f, y = (p >> 8) / 127.5f - 1.f;
+    float z = 1.f - fabsf(x) - fabsf(y);
+    if (z < 0.f) {
+        float fx = (1.f - fabsf(y)) * (x >= 0.f ? 1.f : -1.f);
+        float fy = (1.f - fabsf(x)) * (y >= 0.f ? 1.f : -1.f);
+        x = fx;
+        y = fy;
+    }
+    Vec3 n(x, y, z);
+    n.normalize();
+    return n;
+}
+
+#endif // PACKEDATTRIBUTES_H
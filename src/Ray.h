@@ -1,10 +1,17 @@
 #ifndef RAY_H
 #define RAY_H
 #include "Line.h"
+#include "Vec3A.h"
 class Ray : public Line {
 public:
     float time;
-    Ray() : Line() {}
-    Ray( Vec3 const & o , Vec3 const & d, float time ) : Line(o,d), time(time) {}
+    // Ray cone (adaptation of ray differentials) used to choose the texture mip level :
+    // the footprint of the ray at distance t is cone_width + t * cone_spread
+    float cone_width, cone_spread;
+    // SIMD copies for the intersection code
+    Vec3A origin_a, direction_a, inv_direction_a;
+    Ray() : Line(), cone_width(0.f), cone_spread(0.f) {}
+    Ray( Vec3 const & o , Vec3 const & d, float time ) : Line(o,d), time(time), cone_width(0.f), cone_spread(0.f),
+        origin_a(origin()), direction_a(direction()), inv_direction_a(_mm_div_ps(_mm_set1_ps(1.f), direction_a.v)) {}
 };
 #endif
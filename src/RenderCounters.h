@@ -0,0 +1,70 @@
+#ifndef RENDERCOUNTERS_H
+#define RENDERCOUNTERS_H
+
+#include <cstdint>
+#include <ostream>
+
+// Work done by the calling thread, merged by the Renderer at the end of a render.
+// The ray counts are always kept (one increment per ray, the benchmark reports them). The other counters sit in
+// the traversal and shading loops : RENDER_STAT compiles to nothing unless RENDER_STATS is defined (make STATS=1).
+// No user constructor : the thread_local of thread_ray_counters is constant-initialized, an increment needs no
+// initialization guard.
+struct RayCounters {
+    uint64_t primary = 0, secondary = 0, shadow = 0; // rays traced, secondary are the bounces
+    uint64_t shadow_occluded = 0;
+    uint64_t kd_nodes = 0, kd_leaves = 0;            // visited : bounding box tested, reached
+    uint64_t triangle_tests = 0, sphere_tests = 0, square_tests = 0;
+    uint64_t texture_lookups = 0;                    // image textures, normal maps and skybox
+
+    void operator += (const RayCounters &o) {
+        primary += o.primary;                 secondary += o.secondary;
+        shadow += o.shadow;                   shadow_occluded += o.shadow_occluded;
+        kd_nodes += o.kd_nodes;               kd_leaves += o.kd_leaves;
+        triangle_tests += o.triangle_tests;   sphere_tests += o.sphere_tests;
+        square_tests += o.square_tests;       texture_lookups += o.texture_lookups;
+    }
+    void operator -= (const RayCounters &o) {
+        primary -= o.primary;                 secondary -= o.secondary;
+        shadow -= o.shadow;                   shadow_occluded -= o.shadow_occluded;
+        kd_nodes -= o.kd_nodes;               kd_leaves -= o.kd_leaves;
+        triangle_tests -= o.triangle_tests;   sphere_tests -= o.sphere_tests;
+        square_tests -= o.square_tests;       texture_lookups -= o.texture_lookups;
+    }
+
+    // name value pairs, in the order above (the detailed counters only with RENDER_STATS)
+    template <class F> void for_each(F f) const {
+        f("primary", primary);
+        f("secondary", secondary);
+        f("shadow", shadow);
+#ifdef RENDER_STATS
+        f("shadow_occluded", shadow_occluded);
+        f("kd_nodes", kd_nodes);
+        f("kd_leaves", kd_leaves);
+        f("triangle_tests", triangle_tests);
+        f("sphere_tests", sphere_tests);
+        f("square_tests", square_tests);
+        f("texture_lookups", texture_lookups);
+#endif
+    }
+};
+
+inline RayCounters & thread_ray_counters() {
+    static thread_local RayCounters counters;
+    return counters;
+}
+
+// Counts per ray, and per camera ray for the detailed counters
+inline void print_counters(std::ostream &out, const RayCounters &c) {
+    double per_ray = c.primary ? 1. / c.primary : 0.;
+    c.for_each([&](const char *name, uint64_t value) {
+        out << "  " << name << " : " << value << " (" << value * per_ray << " per camera ray)" << std::endl;
+    });
+}
+
+#ifdef RENDER_STATS
+#define RENDER_STAT(counter, n) (thread_ray_counters().counter += (n))
+#else
+#define RENDER_STAT(counter, n) ((void)0)
+#endif
+
+#endif // RENDERCOUNTERS_H
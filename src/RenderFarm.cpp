@@ -0,0 +1,282 @@
+#include "RenderFarm.h"
+#include "SceneRegistry.h"
+#include "Functions.h"
+#include "Trace.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <vector>
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+static bool read_all(int fd, void *data, size_t size) {
+    char *p = (char *)data;
+    while (size > 0) {
+        ssize_t n = read(fd, p, size);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+
+static bool write_all(int fd, const void *data, size_t size) {
+    const char *p = (const char *)data;
+    while (size > 0) {
+        ssize_t n = write(fd, p, size);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+
+int run_render_worker(int in, int out) {
+    RenderFarmHello hello;
+    if (!read_all(in, &hello, sizeof(hello)) || std::memcmp(hello.magic, "RTRF", 4) != 0 || hello.version != RENDER_FARM_VERSION) {
+        std::cerr << "Worker : not a render coordinator" << std::endl;
+        return EXIT_FAILURE;
+    }
+    hello.scene[sizeof(hello.scene) - 1] = 0;
+    RenderSettings settings;
+    settings.width = hello.width;
+    settings.height = hello.height;
+    settings.nsamples = hello.pass_samples;
+    settings.threads = hello.threads;
+    settings.seed = hello.seed;
+    float aspect_ratio = float(settings.width) / float(settings.height);
+
+    SceneRegistry scenes;
+    add_builtin_scenes(scenes, aspect_ratio);
+    unsigned int index = find_scene(scenes, hello.scene);
+    if (index == scenes.size()) {
+        std::cerr << "Worker : unknown scene " << hello.scene << std::endl;
+        return EXIT_FAILURE;
+    }
+    // Same random numbers in the setup as a single process render
+    seed_random(settings.seed);
+    Scene &scene = scenes.get(index);
+    Renderer renderer(scene, RenderCamera(scene.camera, aspect_ratio), settings);
+
+    RenderFarmTile tile = RenderFarmTile();
+    if (!write_all(out, &tile, sizeof(tile))) return EXIT_FAILURE;
+    std::vector<Vec3> sum;
+    while (read_all(in, &tile, sizeof(tile))) {
+        if (tile.first >= settings.height || tile.count > settings.height - tile.first) return EXIT_FAILURE;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        sum.assign(settings.width * tile.count, Vec3(0.));
+        for (unsigned int pass = 0; pass < hello.passes; pass++) renderer.accumulate_lines(pass, tile.first, tile.count, sum.data());
+        tile.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (!write_all(out, &tile, sizeof(tile)) || !write_all(out, sum.data(), sum.size() * sizeof(Vec3))) return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+namespace {
+
+struct Worker {
+    pid_t pid;
+    int fd;     // -1 once lost
+    bool ready;
+    int band;   // in progress, -1 if idle
+    std::chrono::steady_clock::time_point start;
+};
+
+struct Band {
+    bool done;
+    unsigned int running; // workers on it
+};
+
+// The worker gets its end of a socket pair as stdin and stdout. Close on exec : the later workers must not keep
+// the coordinator ends of the earlier ones open (dup2 clears the flag on 0 and 1).
+bool spawn_worker(const RenderFarmSettings &farm, Worker &worker) {
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) != 0) return false;
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(fds[0]);
+        close(fds[1]);
+        return false;
+    }
+    if (pid == 0) {
+        dup2(fds[1], 0);
+        dup2(fds[1], 1);
+        close(fds[0]);
+        close(fds[1]);
+        if (farm.worker_command.empty()) execl("/proc/self/exe", "render", "--worker", (char *)nullptr);
+        else execl("/bin/sh", "sh", "-c", farm.worker_command.c_str(), (char *)nullptr);
+        _exit(127);
+    }
+    close(fds[1]);
+    worker.pid = pid;
+    worker.fd = fds[0];
+    worker.ready = false;
+    worker.band = -1;
+    return true;
+}
+
+} // namespace
+
+bool render_farm(const std::string &scene, const RenderSettings &settings, unsigned int passes,
+                 const RenderFarmSettings &farm, RenderAccumulation &accumulation, RenderFarmStats &stats) {
+    TRACE_SPAN("render farm", scene);
+    typedef std::chrono::steady_clock clock;
+    clock::time_point start = clock::now();
+    stats = RenderFarmStats();
+    if (scene.size() >= sizeof(RenderFarmHello::scene)) {
+        std::cerr << "Scene name too long for the workers : " << scene << std::endl;
+        return false;
+    }
+    // A worker dying while we write to it must not kill the coordinator, the caller's handler is put back at the end
+    void (*sigpipe)(int) = signal(SIGPIPE, SIG_IGN);
+
+    RenderFarmHello hello = RenderFarmHello();
+    std::memcpy(hello.magic, "RTRF", 4);
+    hello.version = RENDER_FARM_VERSION;
+    hello.width = settings.width;
+    hello.height = settings.height;
+    hello.pass_samples = settings.nsamples;
+    hello.passes = passes;
+    hello.threads = settings.threads;
+    hello.seed = settings.seed;
+    std::strncpy(hello.scene, scene.c_str(), sizeof(hello.scene) - 1);
+
+    std::vector<Worker> workers;
+    for (unsigned int i = 0; i < farm.workers; i++) {
+        Worker worker;
+        if (!spawn_worker(farm, worker)) continue;
+        workers.push_back(worker);
+        if (!write_all(worker.fd, &hello, sizeof(hello))) {
+            close(workers.back().fd);
+            workers.back().fd = -1;
+        }
+    }
+
+    unsigned int band = std::max(farm.band, 1u);
+    std::vector<Band> bands((settings.height + band - 1) / band, Band{false, 0});
+    std::deque<unsigned int> queue;
+    for (unsigned int b = 0; b < bands.size(); b++) queue.push_back(b);
+    stats.bands = bands.size();
+    unsigned int done = 0;
+    std::vector<double> times; // of the bands done, for the slow band check
+    std::vector<Vec3> sum;
+
+    auto lose = [&](Worker &worker) {
+        close(worker.fd);
+        worker.fd = -1;
+        kill(worker.pid, SIGKILL);
+        stats.lost_workers++;
+        if (worker.band >= 0) {
+            Band &b = bands[worker.band];
+            b.running--;
+            if (!b.done && b.running == 0) {
+                queue.push_front(worker.band);
+                stats.reassigned++;
+            }
+            worker.band = -1;
+        }
+    };
+
+    while (done < bands.size()) {
+        clock::time_point now = clock::now();
+        // Hand out the bands : queued ones first, then a second run of a band much slower than the median
+        double median = 0.;
+        if (!times.empty()) {
+            std::vector<double> sorted = times;
+            std::nth_element(sorted.begin(), sorted.begin() + sorted.size() / 2, sorted.end());
+            median = sorted[sorted.size() / 2];
+        }
+        for (Worker &worker : workers) {
+            if (worker.fd < 0 || !worker.ready || worker.band >= 0) continue;
+            int next = -1;
+            if (!queue.empty()) {
+                next = queue.front();
+                queue.pop_front();
+            } else if (median > 0.) {
+                for (const Worker &other : workers) {
+                    if (other.fd >= 0 && other.band >= 0 && bands[other.band].running == 1 &&
+                        std::chrono::duration<double>(now - other.start).count() > 3. * median) {
+                        next = other.band;
+                        stats.duplicated++;
+                        break;
+                    }
+                }
+            }
+            if (next < 0) continue;
+            RenderFarmTile tile = {next * band, std::min(band, settings.height - next * band), 0.};
+            worker.band = next;
+            worker.start = now;
+            bands[next].running++;
+            if (!write_all(worker.fd, &tile, sizeof(tile))) lose(worker);
+        }
+
+        std::vector<pollfd> fds;
+        std::vector<Worker *> polled;
+        for (Worker &worker : workers) {
+            if (worker.fd < 0) continue;
+            if (farm.timeout > 0. && worker.band >= 0 && std::chrono::duration<double>(now - worker.start).count() > farm.timeout) {
+                std::cerr << "Worker " << worker.pid << " timed out on lines " << worker.band * band << "+" << std::endl;
+                lose(worker);
+                continue;
+            }
+            fds.push_back(pollfd{worker.fd, POLLIN, 0});
+            polled.push_back(&worker);
+        }
+        if (fds.empty()) {
+            std::cerr << "All the workers were lost, " << done << " of " << bands.size() << " bands done" << std::endl;
+            break;
+        }
+        if (poll(fds.data(), fds.size(), 100) < 0 && errno != EINTR) break;
+
+        for (unsigned int i = 0; i < fds.size(); i++) {
+            if (!(fds[i].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+            Worker &worker = *polled[i];
+            RenderFarmTile tile;
+            if (!read_all(worker.fd, &tile, sizeof(tile))) {
+                lose(worker);
+                continue;
+            }
+            if (tile.count == 0) {
+                worker.ready = true;
+                continue;
+            }
+            sum.resize(settings.width * tile.count);
+            if (worker.band < 0 || tile.first != worker.band * band || !read_all(worker.fd, sum.data(), sum.size() * sizeof(Vec3))) {
+                lose(worker);
+                continue;
+            }
+            Band &b = bands[worker.band];
+            b.running--;
+            worker.band = -1;
+            if (b.done) continue;
+            b.done = true;
+            done++;
+            times.push_back(tile.seconds);
+            std::copy(sum.begin(), sum.end(), accumulation.sum.begin() + tile.first * settings.width);
+            std::fill(accumulation.samples.begin() + tile.first * settings.width,
+                      accumulation.samples.begin() + (tile.first + tile.count) * settings.width, passes * settings.nsamples);
+        }
+    }
+
+    // Closing the connections ends the workers, the ones still on a duplicated band are not waited for
+    for (Worker &worker : workers) {
+        if (worker.fd < 0) continue;
+        close(worker.fd);
+        if (worker.band >= 0) kill(worker.pid, SIGKILL);
+    }
+    for (Worker &worker : workers) waitpid(worker.pid, nullptr, 0);
+    signal(SIGPIPE, sigpipe);
+    if (done == bands.size()) accumulation.passes = passes;
+    stats.seconds = std::chrono::duration<double>(clock::now() - start).count();
+    return done == bands.size();
+}
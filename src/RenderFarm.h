@@ -0,0 +1,62 @@
+#ifndef RENDERFARM_H
+#define RENDERFARM_H
+
+#include <string>
+#include <cstdint>
+
+#include "Renderer.h"
+
+// Render split over worker processes. The coordinator cuts the image into bands of whole lines (so that the
+// random sequences, hence the image, are those of a single process render) and hands them to the workers one at a
+// time. Each worker loads the scene once, renders all the passes of a band and sends back its float sums.
+// A worker speaks on two file descriptors (stdin / stdout of "render --worker"), so that a remote one is only a
+// command away (ssh host ./render --worker). The messages are in the byte order of the machines, which must share it.
+// Bands of a worker that dies or overruns the timeout go to the others, and idle workers also take over the bands
+// that run much longer than the others : the first result wins.
+
+#define RENDER_FARM_VERSION 1
+
+struct RenderFarmHello { // coordinator -> worker, once
+    char magic[4]; // "RTRF"
+    uint32_t version;
+    uint32_t width, height;
+    uint32_t pass_samples, passes;
+    uint32_t threads;
+    uint32_t reserved;
+    uint64_t seed;
+    char scene[256]; // name or scene file, see find_scene
+};
+
+// coordinator -> worker : a band to render. worker -> coordinator : its result, followed by width * count float[3]
+// sums over all the passes (count = 0 once the scene is loaded, the worker is ready)
+struct RenderFarmTile {
+    uint32_t first, count;
+    double seconds;
+};
+
+struct RenderFarmSettings {
+    unsigned int workers;
+    unsigned int band;          // lines
+    double timeout;             // seconds per band before the worker is given up, 0 : none
+    std::string worker_command; // run with sh -c, this executable with --worker if empty
+
+    RenderFarmSettings() : workers(0), band(8), timeout(0.) {}
+};
+
+struct RenderFarmStats {
+    double seconds;
+    unsigned int bands;
+    unsigned int reassigned;  // after a worker died or timed out
+    unsigned int duplicated;  // slow bands also given to an idle worker
+    unsigned int lost_workers;
+};
+
+// Serves the bands of one coordinator until it closes the connection
+int run_render_worker(int in, int out);
+
+// Fills accumulation (made for settings) with passes passes of settings.nsamples samples per pixel.
+// settings.threads : threads of each worker. Returns false if all the workers died before the end.
+bool render_farm(const std::string &scene, const RenderSettings &settings, unsigned int passes,
+                 const RenderFarmSettings &farm, RenderAccumulation &accumulation, RenderFarmStats &stats);
+
+#endif // RENDERFARM_H
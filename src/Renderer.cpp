@@ -0,0 +1,232 @@
+#include "Renderer.h"
+#include "Functions.h"
+#include "Trace.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <thread>
+
+RenderCamera::RenderCamera(const Camera &camera, float aspect_ratio) {
+    Vec3 x_axis, y_axis, z_axis;
+    camera.getFrame(position, x_axis, y_axis, z_axis);
+    // gluPerspective : the vertical field of view spans the height of the image
+    float half_height = tanf(camera.getFovAngle() * M_PI / 360.);
+    right = x_axis * (half_height * aspect_ratio);
+    up = y_axis * half_height;
+    forward = -1.f * z_axis;
+}
+
+static RenderCamera scene_camera(const SceneCamera &placement, float aspect_ratio) {
+    Camera camera;
+    camera.setView(placement.translation, placement.zoom, placement.rotation);
+    return RenderCamera(camera, aspect_ratio);
+}
+
+RenderCamera::RenderCamera(const SceneCamera &placement, float aspect_ratio) : RenderCamera(scene_camera(placement, aspect_ratio)) {}
+
+void RenderCamera::ray(float u, float v, Vec3 &origin, Vec3 &direction) const {
+    origin = position;
+    direction = forward + (2.f * u - 1.f) * right - (2.f * v - 1.f) * up;
+    direction.normalize();
+}
+
+const char *render_mode_name(RenderMode mode) {
+    switch (mode) {
+        case RenderMode_HeatmapNodes: return "nodes";
+        case RenderMode_HeatmapTests: return "tests";
+        case RenderMode_HeatmapTime: return "time";
+        default: return "color";
+    }
+}
+
+// Cost of what the thread did since start, in the unit of the heatmap
+static float pixel_cost(RenderMode mode, const RayCounters &start, std::chrono::steady_clock::time_point start_time) {
+    const RayCounters &now = thread_ray_counters();
+    switch (mode) {
+        case RenderMode_HeatmapNodes:
+            return now.kd_nodes - start.kd_nodes;
+        case RenderMode_HeatmapTests:
+            return (now.triangle_tests - start.triangle_tests) + (now.sphere_tests - start.sphere_tests) + (now.square_tests - start.square_tests);
+        default:
+            return std::chrono::duration<float, std::nano>(std::chrono::steady_clock::now() - start_time).count();
+    }
+}
+
+// Blue (0), cyan, green, yellow, red (1)
+static Vec3 heat_color(float t) {
+    static const Vec3 stops[5] = {Vec3(0., 0., 1.), Vec3(0., 1., 1.), Vec3(0., 1., 0.), Vec3(1., 1., 0.), Vec3(1., 0., 0.)};
+    t = std::min(std::max(t, 0.f), 1.f) * 4.f;
+    int i = std::min((int)t, 3);
+    float f = t - i;
+    return (1.f - f) * stops[i] + f * stops[i + 1];
+}
+
+void Renderer::trace_line(unsigned int y, unsigned int pass, Vec3 *sum, float *cost) const {
+    const unsigned int w = settings.width, h = settings.height;
+    uint64_t line_seed = hash_bytes(&y, sizeof(y), hash_bytes(&settings.seed, sizeof(settings.seed)));
+    if (pass > 0) line_seed = hash_bytes(&pass, sizeof(pass), line_seed);
+    seed_random(line_seed);
+
+    // Ray cone spread : angle between the rays of two neighbouring pixels, used to filter the textures
+    Vec3 pos, dir, dir_next;
+    camera.ray(0.5f, (y + 0.5f) / h, pos, dir);
+    camera.ray(0.5f + 1.f / w, (y + 0.5f) / h, pos, dir_next);
+    float spread = acosf(std::min(Vec3::dot(dir, dir_next), 1.f));
+
+    bool heatmap = cost != nullptr;
+    for (unsigned int x = 0; x < w; x++) {
+        RayCounters start;
+        std::chrono::steady_clock::time_point start_time;
+        if (heatmap) {
+            start = thread_ray_counters();
+            start_time = std::chrono::steady_clock::now();
+        }
+        Vec3 color(0.);
+        for (unsigned int s = 0; s < settings.nsamples; ++s) {
+            float u = ((float)(x) + random_float()) / w;
+            float v = ((float)(y) + random_float()) / h;
+            camera.ray(u, v, pos, dir);
+            Ray ray(pos, dir, random_float());
+            ray.cone_spread = spread;
+            color += scene.rayTrace(ray);
+        }
+        sum[x] += color;
+        if (heatmap) cost[x] = pixel_cost(settings.mode, start, start_time);
+    }
+}
+
+RenderStats Renderer::render(std::vector<Vec3> &image) const {
+    TRACE_SPAN("render", std::to_string(settings.width) + "x" + std::to_string(settings.height) + ", " + std::to_string(settings.nsamples) + " spp");
+    std::vector<float> cost(settings.mode == RenderMode_Color ? 0 : settings.width * settings.height);
+    if (cost.empty()) {
+        RenderAccumulation accumulation(settings, 0);
+        RenderStats stats = accumulate(accumulation);
+        accumulation.resolve(image);
+        return stats;
+    }
+
+    std::vector<Vec3> sum(settings.width * settings.height, Vec3(0.));
+    RenderStats stats = trace_lines(0, 0, settings.height, sum.data(), cost.data());
+    // A few expensive pixels would leave the rest of the image blue
+    std::vector<float> sorted = cost;
+    std::nth_element(sorted.begin(), sorted.begin() + sorted.size() * 99 / 100, sorted.end());
+    stats.heatmap_scale = std::max(sorted[sorted.size() * 99 / 100], 1e-6f);
+    image.resize(cost.size());
+    for (unsigned int i = 0; i < cost.size(); i++) image[i] = heat_color(cost[i] / stats.heatmap_scale);
+    return stats;
+}
+
+RenderStats Renderer::accumulate(RenderAccumulation &accumulation) const {
+    TRACE_SPAN("render pass", std::to_string(accumulation.passes));
+    RenderStats stats = trace_lines(accumulation.passes, 0, settings.height, accumulation.sum.data(), nullptr);
+    for (uint32_t &n : accumulation.samples) n += settings.nsamples;
+    accumulation.passes++;
+    return stats;
+}
+
+RenderStats Renderer::accumulate_lines(unsigned int pass, unsigned int first, unsigned int count, Vec3 *sum) const {
+    TRACE_SPAN("render lines", std::to_string(first) + "+" + std::to_string(count) + ", pass " + std::to_string(pass));
+    return trace_lines(pass, first, count, sum, nullptr);
+}
+
+RenderStats Renderer::trace_lines(unsigned int pass, unsigned int first, unsigned int count, Vec3 *sum, float *cost) const {
+    const unsigned int w = settings.width;
+    RenderStats stats = RenderStats();
+    stats.threads = settings.threads ? settings.threads : std::max(1u, std::thread::hardware_concurrency());
+    stats.threads = std::max(1u, std::min(stats.threads, count));
+
+    std::atomic<unsigned int> next_line(0);
+    std::mutex mutex;
+    auto worker = [&]() {
+        TRACE_SPAN("render worker");
+        RayCounters start = thread_ray_counters();
+        for (unsigned int i = next_line++; i < count; i = next_line++) {
+            Trace::Span span("line", Trace::enabled() ? std::to_string(first + i) : std::string());
+            trace_line(first + i, pass, sum + i * w, cost ? cost + i * w : nullptr);
+        }
+        RayCounters done = thread_ray_counters();
+        done -= start;
+        std::lock_guard<std::mutex> lock(mutex);
+        stats.counters += done;
+    };
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (unsigned int i = 1; i < stats.threads; i++) threads.emplace_back(worker);
+    worker();
+    for (auto &t : threads) t.join();
+    stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return stats;
+}
+
+RenderAccumulation::RenderAccumulation(const RenderSettings &settings, uint64_t key)
+    : width(settings.width), height(settings.height), seed(settings.seed), key(key), passes(0),
+      sum(settings.width * settings.height, Vec3(0.)), samples(settings.width * settings.height, 0) {}
+
+void RenderAccumulation::resolve(std::vector<Vec3> &image) const {
+    image.resize(sum.size());
+    for (unsigned int i = 0; i < sum.size(); i++) {
+        Vec3 color = sum[i];
+        if (samples[i]) color /= samples[i];
+        gamma_correct(color);
+        image[i] = color;
+    }
+}
+
+bool RenderAccumulation::save(const std::string &filename) const {
+    TRACE_SPAN("save checkpoint", filename);
+    RenderCheckpointHeader header = RenderCheckpointHeader();
+    std::memcpy(header.magic, "RTCP", 4);
+    header.version = RENDER_CHECKPOINT_VERSION;
+    header.width = width;
+    header.height = height;
+    header.seed = seed;
+    header.key = key;
+    header.passes = passes;
+
+    std::string tmp = filename + ".tmp";
+    std::ofstream f(tmp.c_str(), std::ios::binary);
+    f.write((const char *)&header, sizeof(header));
+    f.write((const char *)sum.data(), sum.size() * sizeof(Vec3));
+    f.write((const char *)samples.data(), samples.size() * sizeof(uint32_t));
+    f.close();
+    if (f.fail() || rename(tmp.c_str(), filename.c_str()) != 0) {
+        remove(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool RenderAccumulation::load(const std::string &filename) {
+    std::ifstream f(filename.c_str(), std::ios::binary);
+    RenderCheckpointHeader header;
+    if (!f.read((char *)&header, sizeof(header))) return false;
+    if (std::memcmp(header.magic, "RTCP", 4) != 0 || header.version != RENDER_CHECKPOINT_VERSION) return false;
+    width = header.width;
+    height = header.height;
+    seed = header.seed;
+    key = header.key;
+    passes = header.passes;
+    sum.resize(width * height);
+    samples.resize(width * height);
+    f.read((char *)sum.data(), sum.size() * sizeof(Vec3));
+    f.read((char *)samples.data(), samples.size() * sizeof(uint32_t));
+    return !f.fail();
+}
+
+bool save_ppm(const std::string &filename, unsigned int width, unsigned int height, const std::vector<Vec3> &image) {
+    TRACE_SPAN("save_ppm", filename);
+    std::ofstream f(filename.c_str(), std::ios::binary);
+    if (f.fail()) return false;
+    f << "P3" << std::endl << width << " " << height << std::endl << 255 << std::endl;
+    for (unsigned int i = 0; i < width * height; i++)
+        f << (int)(255.f*std::min<float>(1.f,image[i][0])) << " " << (int)(255.f*std::min<float>(1.f,image[i][1])) << " " << (int)(255.f*std::min<float>(1.f,image[i][2])) << " ";
+    f << std::endl;
+    return !f.fail();
+}
@@ -0,0 +1,121 @@
+#ifndef RENDERER_H
+#define RENDERER_H
+
+#include <vector>
+#include <string>
+#include <cstdint>
+
+#include "Vec3.h"
+#include "Camera.h"
+#include "Scene.h"
+#include "RenderCounters.h"
+
+// Pinhole camera giving the rays of the OpenGL preview (Camera::apply + gluPerspective), computed without a GL
+// context so that renders can run headless
+struct RenderCamera {
+    Vec3 position;
+    Vec3 right, up, forward; // right and up reach the borders of the image at distance 1 along forward
+
+    RenderCamera() : position(0.), right(1., 0., 0.), up(0., 1., 0.), forward(0., 0., -1.) {}
+    RenderCamera(const Camera &camera, float aspect_ratio);
+    // Placement of a scene file (see Camera::setView), default camera of the viewer otherwise
+    RenderCamera(const SceneCamera &placement, float aspect_ratio);
+
+    // u, v in [0, 1], v going down
+    void ray(float u, float v, Vec3 &origin, Vec3 &direction) const;
+};
+
+// Heatmaps replace the color by the cost of each pixel (all its samples), in false colors from blue to red.
+// Nodes and tests are only counted with RENDER_STATS (see RenderCounters.h), the time is always measured.
+enum RenderMode {
+    RenderMode_Color,
+    RenderMode_HeatmapNodes, // KD-tree nodes visited
+    RenderMode_HeatmapTests, // triangle, sphere and square tests
+    RenderMode_HeatmapTime,  // nanoseconds
+    RenderMode_Count
+};
+
+const char *render_mode_name(RenderMode mode);
+
+struct RenderSettings {
+    unsigned int width, height;
+    unsigned int nsamples;
+    unsigned int threads; // 0 : one per core
+    uint64_t seed;
+    RenderMode mode;
+
+    RenderSettings() : width(850), height(480), nsamples(1), threads(0), seed(0), mode(RenderMode_Color) {}
+};
+
+struct RenderStats {
+    double seconds; // wall time
+    unsigned int threads;
+    RayCounters counters; // summed over the threads
+    float heatmap_scale;  // cost shown in red (99th percentile of the pixels), heatmaps only
+};
+
+// Progressive render : sums of the samples of every pixel over the passes done so far.
+// Saved as a checkpoint (see save / load) so that a long render can be resumed. The random state needs no saving :
+// every line of every pass restarts its sequence from (seed, line, pass).
+struct RenderAccumulation {
+    unsigned int width, height;
+    uint64_t seed;
+    uint64_t key;           // scene and settings the sums belong to, checked on resume
+    unsigned int passes;    // done
+    std::vector<Vec3> sum;  // linear colors
+    std::vector<uint32_t> samples;
+
+    RenderAccumulation() : width(0), height(0), seed(0), key(0), passes(0) {}
+    RenderAccumulation(const RenderSettings &settings, uint64_t key);
+
+    // Mean of the samples, gamma corrected
+    void resolve(std::vector<Vec3> &image) const;
+
+    // Written to a temporary file then renamed : a crash while saving leaves the previous checkpoint
+    bool save(const std::string &filename) const;
+    bool load(const std::string &filename);
+};
+
+#define RENDER_CHECKPOINT_VERSION 1
+
+struct RenderCheckpointHeader {
+    char magic[4]; // "RTCP"
+    uint32_t version;
+    uint32_t width, height;
+    uint64_t seed;
+    uint64_t key;
+    uint32_t passes;
+    uint32_t reserved;
+    // followed by width * height float[3] sums and width * height uint32 sample counts
+};
+
+// Renders an image with a pool of threads taking lines in turn.
+// Each line restarts the random sequence from (seed, line), the image does not depend on the number of threads.
+class Renderer {
+public:
+    Renderer(Scene &scene, const RenderCamera &camera, const RenderSettings &settings) : scene(scene), camera(camera), settings(settings) {}
+
+    // Gamma corrected colors (or the heatmap), width * height
+    RenderStats render(std::vector<Vec3> &image) const;
+
+    // Adds settings.nsamples samples to every pixel (color mode). The first pass draws the samples of render, so
+    // one pass gives its image and n passes give the same image whether or not they were interrupted and resumed.
+    RenderStats accumulate(RenderAccumulation &accumulation) const;
+    // Same samples for the lines [first, first + count) only, sum holds these lines (width * count)
+    RenderStats accumulate_lines(unsigned int pass, unsigned int first, unsigned int count, Vec3 *sum) const;
+
+private:
+    Scene &scene;
+    RenderCamera camera;
+    RenderSettings settings;
+
+    // Adds the samples of the pass to the line in sum. cost : the line of the heatmap cost, nullptr if none
+    void trace_line(unsigned int y, unsigned int pass, Vec3 *sum, float *cost) const;
+    // sum and cost start at line first
+    RenderStats trace_lines(unsigned int pass, unsigned int first, unsigned int count, Vec3 *sum, float *cost) const;
+};
+
+// Plain text PPM, colors clamped to [0, 1]
+bool save_ppm(const std::string &filename, unsigned int width, unsigned int height, const std::vector<Vec3> &image);
+
+#endif // RENDERER_H
@@ -3,6 +3,8 @@
 
 #include <vector>
 #include <string>
+#include <map>
+#include <functional>
 #include "Material.h"
 #include "Mesh.h"
 #include "Sphere.h"
@@ -12,12 +14,18 @@
 #include <cstdlib>
 #include <ctime>
 #include <iostream>
+#include <chrono>
+#include <cstdint>
 
 #include <GL/glut.h>
 
 #include "Functions.h"
 #include "Constants.h"
 #include "imageLoader.h"
+#include "TextureCache.h"
+#include "Skybox.h"
+#include "RenderCounters.h"
+#include "Trace.h"
 
 enum LightType {
     LightType_Spherical,
@@ -41,55 +49,142 @@ struct Light {
 
 };
 
+// Camera placement stored in scene files (see Camera::setView)
+struct SceneCamera {
+    bool defined;
+    Vec3 translation;
+    float zoom;
+    Vec3 rotation;
+
+    SceneCamera() : defined(false), translation(0., 0., -3.1), zoom(3.), rotation(0.) {}
+};
+
+// Keyframes of a scene file (see SceneLoader.cpp), linear between the keys and constant outside
+struct SceneCameraKey {
+    float frame;
+    SceneCamera camera;
+};
+
+struct SceneMeshKey {
+    unsigned int mesh;
+    float frame;
+    Vec3 translation, rotation; // see Mesh::place
+};
+
+struct SceneAnimation {
+    unsigned int frames; // 0 : not animated
+    std::vector< SceneCameraKey > camera; // sorted by frame
+    std::vector< SceneMeshKey > meshes;   // sorted by mesh then frame
+
+    SceneAnimation() : frames(0) {}
+};
+
+// Closest hit only, the surface is evaluated once by Scene::computeSurface
 struct RaySceneIntersection{
     bool intersectionExists;
-    unsigned int typeOfIntersectedObject;
+    unsigned int typeOfIntersectedObject; // 1 : sphere, 2 : square, 3 : mesh
     unsigned int objectIndex;
     float t;
-    RayTriangleIntersection rayMeshIntersection; // 3
-    RaySphereIntersection raySphereIntersection; // 1
-    RaySquareIntersection raySquareIntersection; // 2
+    float u, v; // square : uv, mesh : barycentric coordinates w1, w2
+    unsigned int tIndex; // mesh triangle
     RaySceneIntersection() : intersectionExists(false) , t(FLT_MAX) {}
 };
 
 
 
 class Scene {
+    std::vector< Material > materials; // indexed by Mesh::material_index, materials[0] is the default material
     std::vector< Mesh > meshes;
     std::vector< Sphere > spheres;
     std::vector< Square > squares;
     std::vector< Light > lights;
-    std::vector< ppmLoader::ImageRGB > textures;
-    std::vector< ppmLoader::ImageRGB > normals;
-    ppmLoader::ImageRGB skybox;
+    std::vector< TextureHandle > textures;
+    std::vector< TextureHandle > normals;
+    Skybox skybox;
     bool dark_sky = true;
 
 public:
+    SceneCamera camera;
+    SceneAnimation animation;
+    double kdtree_seconds = 0.; // spent in the last computeKDTrees, trees read from the mesh cache included
+
+    // Parameters exposed by a setup, changed through set_parameter without rebuilding the scene
+    typedef std::function<void(Scene &, float)> ParameterUpdate;
+    std::map<std::string, ParameterUpdate> parameters;
+
+
+    Scene() : materials(1) {
+    }
 
+    // Updates only the primitives that depend on the parameter, returns false if the scene does not expose it
+    bool set_parameter(const std::string &name, float value) {
+        auto it = parameters.find(name);
+        if (it == parameters.end()) return false;
+        it->second(*this, value);
+        return true;
+    }
 
-    Scene() {
+    // Data-driven scene, see SceneLoader.cpp for the format
+    bool setup_from_file(const std::string &filename);
+
+    // Camera placement at a frame of the animation
+    SceneCamera camera_at(float frame) const {
+        const std::vector< SceneCameraKey > &keys = animation.camera;
+        if (keys.empty()) return camera;
+        if (frame <= keys.front().frame) return keys.front().camera;
+        unsigned int k = 1;
+        while (k < keys.size() && keys[k].frame < frame) k++;
+        if (k == keys.size()) return keys.back().camera;
+        const SceneCamera &a = keys[k - 1].camera, &b = keys[k].camera;
+        float f = (frame - keys[k - 1].frame) / (keys[k].frame - keys[k - 1].frame);
+        SceneCamera result = a;
+        result.translation = (1.f - f) * a.translation + f * b.translation;
+        result.zoom = (1.f - f) * a.zoom + f * b.zoom;
+        result.rotation = (1.f - f) * a.rotation + f * b.rotation;
+        return result;
+    }
+
+    // Places the animated meshes for a frame, their trees are refitted or rebuilt (see Mesh::place), the others kept
+    void animate(float frame) {
+        TRACE_SPAN("animate", std::to_string(frame));
+        const std::vector< SceneMeshKey > &keys = animation.meshes;
+        for (unsigned int first = 0, last; first < keys.size(); first = last) {
+            last = first + 1;
+            while (last < keys.size() && keys[last].mesh == keys[first].mesh) last++;
+            unsigned int k = first;
+            while (k + 1 < last && keys[k + 1].frame < frame) k++;
+            const SceneMeshKey &a = keys[k], &b = keys[std::min(k + 1, last - 1)];
+            float f = b.frame > a.frame ? std::min(std::max((frame - a.frame) / (b.frame - a.frame), 0.f), 1.f) : 0.f;
+            meshes[a.mesh].place((1.f - f) * a.rotation + f * b.rotation, (1.f - f) * a.translation + f * b.translation);
+        }
+    }
+
+    unsigned int kdtree_rebuilds() const {
+        unsigned int n = 0;
+        for (const Mesh &mesh : meshes) n += mesh.kdtree_rebuilds;
+        return n;
     }
 
     void draw() {
         // iterer sur l'ensemble des objets, et faire leur rendu :
         for( unsigned int It = 0 ; It < meshes.size() ; ++It ) {
             Mesh const & mesh = meshes[It];
-            mesh.draw();
+            mesh.draw(materials[mesh.material_index]);
             if (mesh.kdtree) {
                 mesh.kdtree->draw();
             }
         }
         for( unsigned int It = 0 ; It < spheres.size() ; ++It ) {
             Sphere const & sphere = spheres[It];
-            sphere.draw();
+            sphere.draw(materials[sphere.material_index]);
         }
         for( unsigned int It = 0 ; It < squares.size() ; ++It ) {
             Square const & square = squares[It];
-            square.draw();
+            square.draw(materials[square.material_index]);
         }
     }
 
-    void addBox(std::vector<Material> const & materials, bool faces[6], Vec3 const & pos, Vec3 const rotation, float const size = 1.f, bool facing_out = true) {
+    void addBox(std::vector<Material> const & box_materials, bool faces[6], Vec3 const & pos, Vec3 const rotation, float const size = 1.f, bool facing_out = true) {
         Vec3 base_bottom_left = Vec3(-size/2.);
         Vec3 base_right_vector = Vec3(size, 0., 0.);
         Vec3 base_up_vector = Vec3(0., 0., size);
@@ -141,44 +236,56 @@ public:
             squares[i].translate(pos);
             squares[i].build_arrays();
             if (!facing_out) squares[i].m_normal *= -1.;
-            squares[i].material = materials[i - squares.size() + nfaces];
+            squares[i].material_index = add_material(box_materials[i - squares.size() + nfaces]);
         }
     }
 
 
     Vec3 skyboxTexture(Vec3 direction, int NRemainingBounces) {
-        if (skybox.w < 1 || skybox.h < 1) {
+        if (skybox.empty()) {
             if (dark_sky) return Vec3(0.);
             float a = 0.5*(direction[1] + 1.0);
             return (1.0-a)*Vec3(1.0, 1.0, 1.0) + a*Vec3(0.5, 0.7, 1.0) * (NRemainingBounces+1);
         }
-        float u = 0.5 + atan2(direction[2], direction[0]) / (2 * M_PI);
-        float v = 0.5 - asin(direction[1]) / M_PI;
-        int x = u * skybox.w;
-        int y = v * skybox.h;
-        int index = y * skybox.w + x;
-        return Vec3(skybox.data[index].r/255., skybox.data[index].g/255., skybox.data[index].b/255.) * NRemainingBounces;
+        return skybox.radiance(direction) * NRemainingBounces;
+    }
+
+    bool sampleSkybox() const {
+        return SKYBOX_SAMPLING && skybox.can_sample();
     }
 
     void loadSkybox(const std::string &filename) {
-        ppmLoader::load_ppm(skybox, filename);
+        skybox.load(TextureCache::get(filename));
     }
 
     int load_texture(const std::string &filename) {
-        ppmLoader::ImageRGB img;
-        ppmLoader::load_ppm(img, filename);
-        textures.push_back(img);
+        textures.push_back(TextureCache::get(filename));
         return textures.size() - 1;
     }
 
+    unsigned int add_material(const Material &material) {
+        materials.push_back(material);
+        return materials.size() - 1;
+    }
+
+    // Adds a default material to the table and assigns it to the mesh.
+    // The reference is only valid until the next material is added.
+    Material & new_material(Mesh &mesh) {
+        mesh.material_index = add_material(Material());
+        return materials.back();
+    }
+
     int load_normal_map(const std::string &filename) {
-        ppmLoader::ImageRGB img;
-        ppmLoader::load_ppm(img, filename);
-        normals.push_back(img);
+        normals.push_back(TextureCache::get(filename, ppmLoader::TextureFormat_Normal));
         return normals.size() - 1;
     }
 
     void clear() {
+        camera = SceneCamera();
+        animation = SceneAnimation();
+        kdtree_seconds = 0.;
+        parameters.clear();
+        materials.assign(1, Material());
         meshes.clear();
         spheres.clear();
         squares.clear();
@@ -205,25 +312,30 @@ public:
         result.typeOfIntersectedObject = 0;
         result.objectIndex = -1;
         result.t = tmax;
-        for (int i = 0; i < spheres.size(); i++) {
-            RaySphereIntersection intersection = spheres[i].intersect(ray);
-            if (intersection.intersectionExists && intersection.t < result.t && intersection.t >= EPSILON) {
-                setResult(result, 1, i, intersection.t);
-                result.raySphereIntersection = intersection;
-            } 
+        for (unsigned int i = 0; i < spheres.size(); i += 4) {
+            float t[4];
+            RENDER_STAT(sphere_tests, std::min<unsigned int>(4, spheres.size() - i));
+            if (!Sphere::intersect4(ray, &spheres[i], std::min<unsigned int>(4, spheres.size() - i), t)) continue;
+            for (unsigned int lane = 0; lane < 4; lane++) {
+                if (t[lane] < result.t && t[lane] >= EPSILON) setResult(result, 1, i + lane, t[lane]);
+            }
         }
+        RENDER_STAT(square_tests, squares.size());
         for (int i = 0; i < squares.size(); i++) {
-            RaySquareIntersection intersection = squares[i].intersect(ray);
+            RaySquareIntersection intersection = squares[i].intersect(ray, materials[squares[i].material_index].type != Material_Glass);
             if (intersection.intersectionExists && intersection.t < result.t && intersection.t >= EPSILON) {
                 setResult(result, 2, i, intersection.t);
-                result.raySquareIntersection = intersection;
+                result.u = intersection.u;
+                result.v = intersection.v;
             } 
         }
         for (int i = 0; i < meshes.size(); i++) {
             RayTriangleIntersection intersection = meshes[i].intersect(ray);
             if (intersection.intersectionExists && intersection.t < result.t && intersection.t >= EPSILON) {
                 setResult(result, 3, i, intersection.t);
-                result.rayMeshIntersection = intersection;  
+                result.u = intersection.w1;
+                result.v = intersection.w2;
+                result.tIndex = intersection.tIndex;
             } 
         }
         return result;
@@ -233,85 +345,126 @@ public:
      * Retourne vrai si une intersection est trouvée avec un objet de la scène avant t
      */
     bool computeShadow(Ray const & ray, float t = FLT_MAX) {
-        for (int i = 0; i < spheres.size(); i++) {
-            RaySphereIntersection intersection = spheres[i].intersect(ray);
-            if (intersection.intersectionExists && intersection.t < t && intersection.t >= EPSILON) {
-                if (random_float() > spheres[i].material.transparency) return true;
+        thread_ray_counters().shadow++;
+        for (unsigned int i = 0; i < spheres.size(); i += 4) {
+            float ts[4];
+            RENDER_STAT(sphere_tests, std::min<unsigned int>(4, spheres.size() - i));
+            if (!Sphere::intersect4(ray, &spheres[i], std::min<unsigned int>(4, spheres.size() - i), ts)) continue;
+            for (unsigned int lane = 0; lane < 4; lane++) {
+                if (ts[lane] < t && ts[lane] >= EPSILON) {
+                    if (random_float() > materials[spheres[i + lane].material_index].transparency) { RENDER_STAT(shadow_occluded, 1); return true; }
+                }
             }
         }
         for (int i = 0; i < squares.size(); i++) {
-            RaySquareIntersection intersection = squares[i].intersect(ray);
+            RENDER_STAT(square_tests, 1);
+            RaySquareIntersection intersection = squares[i].intersect(ray, materials[squares[i].material_index].type != Material_Glass);
             if (intersection.intersectionExists && intersection.t < t && intersection.t >= EPSILON) {
-                if (random_float() > squares[i].material.transparency) return true;
+                if (random_float() > materials[squares[i].material_index].transparency) { RENDER_STAT(shadow_occluded, 1); return true; }
             }
         }
         for (int i = 0; i < meshes.size(); i++) {
             RayTriangleIntersection intersection = meshes[i].intersect(ray);
             if (intersection.intersectionExists && intersection.t < t && intersection.t >= EPSILON) {
-                if (random_float() > meshes[i].material.transparency) return true;
+                if (random_float() > materials[meshes[i].material_index].transparency) { RENDER_STAT(shadow_occluded, 1); return true; }
             }
         }
         return false;
     }
 
     
-    Vec3 rayTraceRecursive( Ray ray , int NRemainingBounces ) {
-        Vec3 color = Vec3(0.f);
-        if (NRemainingBounces == 0) return color;
-        RaySceneIntersection raySceneIntersection = computeIntersection(ray);
-        Material material;
-
-        Vec3 normal;
-        Vec3 intersection;
-        Vec3 emission;
-        Vec3 L, R, V;
+    /**
+     * Evalue la surface au point d'intersection : position, normale, couleur (textures, couleurs du maillage) et emission
+     * Retourne faux s'il n'y a pas d'intersection
+     */
+    // Width of the ray cone at t, stored in cone_width, and the same width stretched along the surface by the grazing angle
+    static float footprint_width(Ray const & ray, float t, Vec3 const & normal, float & cone_width) {
+        cone_width = ray.cone_width + t * ray.cone_spread;
+        float cos_angle = std::max(fabsf(Vec3::dot(ray.direction(), normal)), 1e-3f);
+        return cone_width / cos_angle;
+    }
 
-       
-        switch (raySceneIntersection.typeOfIntersectedObject) {
-            case 1: // Sphere
-                material = spheres[raySceneIntersection.objectIndex].material;
-                intersection = raySceneIntersection.raySphereIntersection.intersection;
-                normal = raySceneIntersection.raySphereIntersection.normal;
-                material.sphere_texture(material.diffuse_material, raySceneIntersection.raySphereIntersection.phi, raySceneIntersection.raySphereIntersection.theta);
-                //material.get_normal(normal, raySceneIntersection.raySphereIntersection.phi / (2 * M_PI), raySceneIntersection.raySphereIntersection.theta / M_PI);
-                material.emit(emission, raySceneIntersection.raySphereIntersection.phi / (2 * M_PI), raySceneIntersection.raySphereIntersection.theta / M_PI);
+    bool computeSurface(Ray const & ray, RaySceneIntersection const & hit, SurfaceSample & surface) const {
+        const Material *material;
+        switch (hit.typeOfIntersectedObject) {
+            case 1: { // Sphere
+                const Sphere & sphere = spheres[hit.objectIndex];
+                material = &materials[sphere.material_index];
+                float theta, phi;
+                sphere.surface(ray, hit.t, surface.position, surface.normal, theta, phi);
+                // Cone footprint projected on the surface, in uv units (u : 2 pi r sin(theta) per turn, v : pi r)
+                float width = footprint_width(ray, hit.t, surface.normal, surface.cone_width);
+                float fu = width / (2 * M_PI * sphere.m_radius * std::max(sinf(theta), 1e-3f));
+                float fv = width / (M_PI * sphere.m_radius);
+                surface.albedo = material->diffuse_material;
+                material->sphere_texture(surface.albedo, phi, theta, fu, fv);
+                material->emit(surface.emission, phi / (2 * M_PI), theta / M_PI, fu, fv);
                 break;
-            case 2: // Square
-                material = squares[raySceneIntersection.objectIndex].material;
-                intersection = raySceneIntersection.raySquareIntersection.intersection;
-                normal = raySceneIntersection.raySquareIntersection.normal;
-                material.texture(material.diffuse_material, raySceneIntersection.raySquareIntersection.u, raySceneIntersection.raySquareIntersection.v);
-                material.get_normal(normal, raySceneIntersection.raySquareIntersection.u, raySceneIntersection.raySquareIntersection.v, squares[raySceneIntersection.objectIndex].m_right_vector, squares[raySceneIntersection.objectIndex].m_up_vector);
-                material.emit(emission, raySceneIntersection.raySquareIntersection.u, raySceneIntersection.raySquareIntersection.v);
+            }
+            case 2: { // Square
+                const Square & square = squares[hit.objectIndex];
+                material = &materials[square.material_index];
+                surface.position = ray.origin() + hit.t*ray.direction();
+                surface.normal = square.normal();
+                float width = footprint_width(ray, hit.t, surface.normal, surface.cone_width);
+                float fu = width * square.inv_width(), fv = width * square.inv_height();
+                surface.albedo = material->diffuse_material;
+                material->texture(surface.albedo, hit.u, hit.v, fu, fv);
+                material->get_normal(surface.normal, hit.u, hit.v, square.m_right_vector, square.m_up_vector, fu, fv);
+                material->emit(surface.emission, hit.u, hit.v, fu, fv);
                 break;
-            case 3: // Mesh
-                material = meshes[raySceneIntersection.objectIndex].material;
-                intersection = raySceneIntersection.rayMeshIntersection.intersection;
-                normal = raySceneIntersection.rayMeshIntersection.normal;
-                if (meshes[raySceneIntersection.objectIndex].colorType == ColorType_Vertex) {
-                    L = meshes[raySceneIntersection.objectIndex].vertColors[meshes[raySceneIntersection.objectIndex].triangles[raySceneIntersection.rayMeshIntersection.tIndex][0]];
-                    R = meshes[raySceneIntersection.objectIndex].vertColors[meshes[raySceneIntersection.objectIndex].triangles[raySceneIntersection.rayMeshIntersection.tIndex][1]];
-                    V = meshes[raySceneIntersection.objectIndex].vertColors[meshes[raySceneIntersection.objectIndex].triangles[raySceneIntersection.rayMeshIntersection.tIndex][2]];
-                    material.diffuse_material = raySceneIntersection.rayMeshIntersection.w0 * L + raySceneIntersection.rayMeshIntersection.w1 * R + raySceneIntersection.rayMeshIntersection.w2 * V;
-                } else if (meshes[raySceneIntersection.objectIndex].colorType == ColorType_Face) {
-                    material.diffuse_material = meshes[raySceneIntersection.objectIndex].faceColors[raySceneIntersection.rayMeshIntersection.tIndex];
+            }
+            case 3: { // Mesh
+                const Mesh & mesh = meshes[hit.objectIndex];
+                material = &materials[mesh.material_index];
+                surface.position = ray.origin() + hit.t*ray.direction();
+                surface.normal = mesh.triangleNormal(hit.tIndex);
+                surface.cone_width = ray.cone_width + hit.t * ray.cone_spread;
+                if (mesh.colorType == ColorType_Vertex) {
+                    MeshTriangle triangle = mesh.triangle(hit.tIndex);
+                    float w0 = 1 - hit.u - hit.v;
+                    surface.albedo = w0 * mesh.vertexColor(triangle[0]) + hit.u * mesh.vertexColor(triangle[1]) + hit.v * mesh.vertexColor(triangle[2]);
+                } else if (mesh.colorType == ColorType_Face) {
+                    surface.albedo = mesh.faceColor(hit.tIndex);
+                } else {
+                    surface.albedo = material->diffuse_material;
                 }
+                surface.emission = Vec3(0.);
                 break;
+            }
             case 0: // No intersection
             default:
-                return skyboxTexture(ray.direction(), NRemainingBounces);
-                break;
+                return false;
+        }
+        surface.material = material;
+        return true;
+    }
+
+    // bsdf_pdf : pdf of the diffuse bounce that produced the ray, 0 for camera rays and specular bounces.
+    // When it is set, the sky reached by the ray is weighted against the skybox sampling (balance heuristic).
+    Vec3 rayTraceRecursive( Ray ray , int NRemainingBounces , float bsdf_pdf = 0.f ) {
+        Vec3 color = Vec3(0.f);
+        if (NRemainingBounces == 0) return color;
+        RaySceneIntersection raySceneIntersection = computeIntersection(ray);
+        SurfaceSample surface;
+        if (!computeSurface(ray, raySceneIntersection, surface)) {
+            Vec3 sky = skyboxTexture(ray.direction(), NRemainingBounces);
+            if (bsdf_pdf > 0.f && sampleSkybox()) sky *= bsdf_pdf / (bsdf_pdf + skybox.pdf(ray.direction()));
+            return sky;
         }
+        const Material & material = *surface.material;
+
+        Vec3 L, R, V;
         for (int i = 0; i < lights.size(); i++) {
-            L = lights[i].pos - intersection;
+            L = lights[i].pos - surface.position;
             L.normalize();
-            float dotLN = Vec3::dot(L, normal);
+            float dotLN = Vec3::dot(L, surface.normal);
 
             // Diffuse
-            color += Vec3::compProduct(lights[0].material, material.diffuse_material) * max(0.0, dotLN) * (1. - material.transparency);
+            color += Vec3::compProduct(lights[0].material, surface.albedo) * max(0.0, dotLN) * (1. - material.transparency);
 
             // Specular
-            R = 2.*(dotLN)*normal-L;
+            R = 2.*(dotLN)*surface.normal-L;
             R.normalize();
             V = ray.direction() * -1.;
             //color += Vec3::compProduct(lights[0].material, material.specular_material)  * pow(max(0.0, Vec3::dot(R, V)),material.shininess);
@@ -324,35 +477,58 @@ public:
             float delta = lights[i].radius/2.;
             for (int j = 0; j < nb_ech; j++) {
                 random_light.pos = lights[i].pos + random_unit_vector() * delta;
-                L = random_light.pos - intersection;
+                L = random_light.pos - surface.position;
                 L.normalize();
-                float tLight = (random_light.pos - intersection).length();
-                if (computeShadow(Ray(intersection + L * EPSILON, L, ray.time), tLight)) blocked++;
+                float tLight = (random_light.pos - surface.position).length();
+                if (computeShadow(Ray(surface.position + L * EPSILON, L, ray.time), tLight)) blocked++;
             }
             float shadow = 1. - float(blocked) / float(nb_ech);
             color *= shadow;
         }
+
+        // Skybox sampled explicitly, weighted against the diffuse bounce (balance heuristic).
+        // Scaled like the sky the bounce would reach, see skyboxTexture.
+        bool diffuse = material.type == Material_Diffuse_Blinn_Phong;
+        if (diffuse && sampleSkybox() && NRemainingBounces > 1) {
+            float sky_pdf;
+            Vec3 direction = skybox.sample(random_float(), random_float(), sky_pdf);
+            float cos_theta = Vec3::dot(direction, surface.normal);
+            if (cos_theta > 0.f && sky_pdf > 0.f && !computeShadow(Ray(surface.position + direction * EPSILON, direction, ray.time))) {
+                float pdf = cos_theta / M_PI;
+                color += Vec3::compProduct(surface.albedo, skybox.radiance(direction)) * ((NRemainingBounces - 1) * pdf / (pdf + sky_pdf));
+            }
+        }
+
         Vec3 newColor;
         Ray newRay;
-        material.scatter(ray, normal, intersection, newRay);
+        material.scatter(ray, surface.normal, surface.position, newRay);
         newRay.time = ray.time;
-        newColor = rayTraceRecursive(newRay, NRemainingBounces-1);
-        newColor = Vec3::compProduct(newColor, material.diffuse_material);
-        return color + newColor + emission;
+        newRay.cone_width = surface.cone_width;
+        newRay.cone_spread = ray.cone_spread;
+        // The diffuse bounce is cosine distributed around the normal
+        float newPdf = diffuse ? std::max(Vec3::dot(newRay.direction(), surface.normal), 0.f) / (float)M_PI : 0.f;
+        if (NRemainingBounces > 1) thread_ray_counters().secondary++;
+        newColor = rayTraceRecursive(newRay, NRemainingBounces-1, newPdf);
+        newColor = Vec3::compProduct(newColor, surface.albedo);
+        return color + newColor + surface.emission;
     }
 
 
     Vec3 rayTrace( Ray const & rayStart ) {
         int bounces = MAXBOUNCES;
+        thread_ray_counters().primary++;
         Vec3 color = Vec3(0.) + rayTraceRecursive(rayStart, bounces);
         color /= (float)bounces;
         return color;
     }
 
     void computeKDTrees() {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        TRACE_SPAN("computeKDTrees");
         for (int i = 0; i < meshes.size(); i++) {
             meshes[i].computeKDTree();
         }
+        kdtree_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
     }
 
     void setup_single_sphere() {
@@ -371,13 +547,14 @@ public:
         {
             spheres.resize( spheres.size() + 1 );
             Sphere & s = spheres[spheres.size() - 1];
+            Material & material = new_material(s);
             s.m_center = Vec3(0. , 0. , 0.);
             s.m_radius = 1.f;
             s.build_arrays();
-            s.material.type = Material_Mirror;
-            s.material.diffuse_material = Vec3( 1. );
-            s.material.specular_material = Vec3( 0.2,0.2,0.2 );
-            s.material.shininess = 20;
+            material.type = Material_Mirror;
+            material.diffuse_material = Vec3( 1. );
+            material.specular_material = Vec3( 0.2,0.2,0.2 );
+            material.shininess = 20;
         }
     }
 
@@ -398,29 +575,31 @@ public:
         {
             squares.resize( squares.size() + 1 );
             Square & s = squares[squares.size() - 1];
+            Material & material = new_material(s);
             s.setQuad(Vec3(-1., -1., 0.), Vec3(1., 0, 0.), Vec3(0., 1, 0.), 6., 2.);
             s.build_arrays();
-            s.material.diffuse_material = Vec3( 1.,0.,0. );
-            s.material.specular_material = Vec3( 0.8,0.8,0.8 );
-            s.material.shininess = 20;
+            material.diffuse_material = Vec3( 1.,0.,0. );
+            material.specular_material = Vec3( 0.8,0.8,0.8 );
+            material.shininess = 20;
         }
         { //Right Wall
             squares.resize( squares.size() + 1 );
             Square & s = squares[squares.size() - 1];
+            Material & material = new_material(s);
             s.setQuad(Vec3(-1., -1., 0.), Vec3(1., 0, 0.), Vec3(0., 1, 0.), 2., 2.);
             s.translate(Vec3(0., 0., -2.));
             s.scale(Vec3(2., 2., 1.));
             s.rotate_y(-90);
             s.build_arrays();
-            s.material.diffuse_material = Vec3( 0.0,1.0,0.0 );
-            s.material.specular_material = Vec3( 0.0,1.0,0.0 );
-            s.material.shininess = 16;
+            material.diffuse_material = Vec3( 0.0,1.0,0.0 );
+            material.specular_material = Vec3( 0.0,1.0,0.0 );
+            material.shininess = 16;
         }
     }
 
     void setup_cornell_box(float aspect_ratio) {
         clear();
-        skybox = ppmLoader::ImageRGB();
+        skybox.reset();
         int brickwall_texture = load_texture("img/planeTextures/brickwall.ppm");
         int brickwall_normal = load_normal_map("img/normalMaps/brickwall_normal.ppm");
         int floor_normal = load_normal_map("img/normalMaps/n1.ppm");
@@ -473,7 +652,7 @@ public:
         //     s.material.light_intensity = 50.;
         // }
 
-        std::vector<Material> materials;
+        std::vector<Material> box_materials;
         Material white = Material();
         white.diffuse_material = Vec3(0.9);
         white.specular_material = Vec3(1.);
@@ -482,139 +661,159 @@ public:
         emissive.emissive = true;
         emissive.light_color = Vec3(1.);
         emissive.light_intensity = 60.;
-        materials.push_back(emissive);
+        box_materials.push_back(emissive);
         for (int i = 0; i < 4; i++) {
-            materials.push_back(white);
+            box_materials.push_back(white);
         }
         Vec3 pos = Vec3(0., 1.95, 0.);
         bool faces[6] = {true, false, true, true, true, true};
-        addBox(materials, faces, pos, Vec3(45.), 1., false);
+        addBox(box_materials, faces, pos, Vec3(45.), 1., false);
 
+        // Walls : the geometry depends on the aspect ratio and is set by place_cornell_walls
+        unsigned int walls = squares.size();
+        squares.resize( squares.size() + 6 );
         { //Back Wall
-            squares.resize( squares.size() + 1 );
-            Square & s = squares[squares.size() - 1];
-            s.setQuad(Vec3(-1., -1., 0.), Vec3(1., 0, 0.), Vec3(0., 1, 0.), 2., 2.);
-            s.scale(Vec3(2.*aspect_ratio, 2., 1.));
-            s.translate(Vec3(0., 0., -2.));
+            Square & s = squares[walls + 0];
+            Material & material = new_material(s);
+            material.diffuse_material = Vec3( 1.,1.,1. );
+            material.specular_material = Vec3( 1.,1.,1. );
+            material.shininess = 16;
+            material.texture_type = Texture_Image;
+            material.set_texture(textures[brickwall_texture].get());
+            material.set_normals(normals[brickwall_normal].get());
+            material.texture_scale_y = 1.;
+        }
+        { //Left Wall
+            Square & s = squares[walls + 1];
+            Material & material = new_material(s);
+            material.diffuse_material = Vec3( 1.,0.,0. );
+            material.specular_material = Vec3( 1.,0.,0. );
+            material.shininess = 16;
+            material.texture_type = Texture_Image;
+            material.set_texture(textures[brickwall_texture].get());
+            material.set_normals(normals[brickwall_normal].get());
+        }
+        { //Right Wall
+            Square & s = squares[walls + 2];
+            Material & material = new_material(s);
+            material.diffuse_material = Vec3( 0.0,1.0,0.0 );
+            material.specular_material = Vec3( 0.0,1.0,0.0 );
+            material.shininess = 16;
+            material.texture_type = Texture_Image;
+            material.set_texture(textures[brickwall_texture].get());
+            material.set_normals(normals[brickwall_normal].get());
+        }
+        { //Floor
+            Square & s = squares[walls + 3];
+            Material & material = new_material(s);
+            material.diffuse_material = Vec3( 246./255., 204./255., 162./255. );
+            material.specular_material = Vec3( 1.0,1.0,1.0 );
+            material.shininess = 1;
+            material.texture_type = Texture_Image;
+            material.set_texture(textures[sand_texture].get());
+            material.set_normals(normals[floor_normal].get());
+        }
+        { //Ceiling
+            Square & s = squares[walls + 4];
+            Material & material = new_material(s);
+            material.diffuse_material = Vec3( 1.0,1.0,1.0 );
+            material.specular_material = Vec3( 1.0,1.0,1.0 );
+            material.shininess = 16;
+            material.texture_type = Texture_Checkerboard;
+            material.checkerboard_color1 = Vec3(0.95);
+            material.checkerboard_color2 = Vec3(0.5);
+            material.texture_scale_y = 8.;
+        }
+        { //Front Wall
+            Square & s = squares[walls + 5];
+            Material & material = new_material(s);
+            material.diffuse_material = Vec3( 1.0,1.0,1.0 );
+            material.specular_material = Vec3( 1.0,1.0,1.0 );
+            material.shininess = 16;
+            material.texture_type = Texture_Image;
+            material.set_texture(textures[brickwall_texture].get());
+            material.set_normals(normals[brickwall_normal].get());
+        }
+        place_cornell_walls(walls, aspect_ratio);
+        parameters["aspect_ratio"] = [walls](Scene & scene, float value) { scene.place_cornell_walls(walls, value); };
+
+        { //GLASS Sphere
+
+            spheres.resize( spheres.size() + 1 );
+            Sphere & s = spheres[spheres.size() - 1];
+            Material & material = new_material(s);
+            s.m_center = Vec3(1.0, -1.25, 0.5);
+            s.m_radius = 0.75f;
+            s.build_arrays();
+            material.type = Material_Glass;
+            material.diffuse_material = Vec3( 1.);
+            material.specular_material = Vec3( 1.);
+            material.shininess = 16;
+            material.transparency = 1.0;
+            material.index_medium = 1.4;
+        }
+        { //MIRRORED Sphere
+            spheres.resize( spheres.size() + 1 );
+            Sphere & s = spheres[spheres.size() - 1];
+            Material & material = new_material(s);
+            s.m_center = Vec3(-1.0, -1.25, -0.5);
+            s.m_radius = 0.75f;
             s.build_arrays();
-            s.material.diffuse_material = Vec3( 1.,1.,1. );
-            s.material.specular_material = Vec3( 1.,1.,1. );
-            s.material.shininess = 16;
-            s.material.texture_type = Texture_Image;
-            s.material.set_texture(&textures[brickwall_texture]);
-            s.material.set_normals(&normals[brickwall_normal]);
-            s.material.texture_scale_x = 1.*aspect_ratio;
-            s.material.texture_scale_y = 1.;
+            material.type = Material_Mirror; 
+            material.diffuse_material = Vec3( 0.7 );
+            material.specular_material = Vec3(  1.,1.,1. );
+            material.shininess = 16;
+            material.transparency = 0.;
+            material.index_medium = 0.;
         }
+    }
 
+    // Places the six walls of the cornell box starting at squares[first], only their geometry depends on the aspect ratio
+    void place_cornell_walls(unsigned int first, float aspect_ratio) {
+        for (unsigned int i = first; i < first + 6; i++) {
+            squares[i].setQuad(Vec3(-1., -1., 0.), Vec3(1., 0, 0.), Vec3(0., 1, 0.), 2., 2.);
+        }
+        { //Back Wall
+            Square & s = squares[first + 0];
+            s.scale(Vec3(2.*aspect_ratio, 2., 1.));
+            s.translate(Vec3(0., 0., -2.));
+            materials[s.material_index].texture_scale_x = 1.*aspect_ratio;
+        }
         { //Left Wall
-
-            squares.resize( squares.size() + 1 );
-            Square & s = squares[squares.size() - 1];
-            s.setQuad(Vec3(-1., -1., 0.), Vec3(1., 0, 0.), Vec3(0., 1, 0.), 2., 2.);
+            Square & s = squares[first + 1];
             s.rotate_x(180);
             s.scale(Vec3(2., 2., 1.));
             s.translate(Vec3(0, 0., -2.*(-aspect_ratio)));
             s.rotate_y(90);
-            s.build_arrays();
-            s.material.diffuse_material = Vec3( 1.,0.,0. );
-            s.material.specular_material = Vec3( 1.,0.,0. );
-            s.material.shininess = 16;
-            s.material.texture_type = Texture_Image;
-            s.material.set_texture(&textures[brickwall_texture]);
-            s.material.set_normals(&normals[brickwall_normal]);
         }
-
         { //Right Wall
-            squares.resize( squares.size() + 1 );
-            Square & s = squares[squares.size() - 1];
-            s.setQuad(Vec3(-1., -1., 0.), Vec3(1., 0, 0.), Vec3(0., 1, 0.), 2., 2.);
+            Square & s = squares[first + 2];
             s.rotate_x(180);
             s.translate(Vec3(0., 0., -2.*(-aspect_ratio)));
             s.scale(Vec3(2., 2., 1.));
             s.rotate_y(-90);
-            s.build_arrays();
-            s.material.diffuse_material = Vec3( 0.0,1.0,0.0 );
-            s.material.specular_material = Vec3( 0.0,1.0,0.0 );
-            s.material.shininess = 16;
-            s.material.texture_type = Texture_Image;
-            s.material.set_texture(&textures[brickwall_texture]);
-            s.material.set_normals(&normals[brickwall_normal]);
         }
-
         { //Floor
-            squares.resize( squares.size() + 1 );
-            Square & s = squares[squares.size() - 1];
-            s.setQuad(Vec3(-1., -1., 0.), Vec3(1., 0, 0.), Vec3(0., 1, 0.), 2., 2.);
+            Square & s = squares[first + 3];
             s.translate(Vec3(0., 0., -2.));
             s.scale(Vec3(2.*aspect_ratio, 2., 1.));
             s.rotate_x(-90);
-            s.build_arrays();
-            s.material.diffuse_material = Vec3( 246./255., 204./255., 162./255. );
-            s.material.specular_material = Vec3( 1.0,1.0,1.0 );
-            s.material.shininess = 1;
-            s.material.texture_type = Texture_Image;
-            s.material.set_texture(&textures[sand_texture]);
-            s.material.set_normals(&normals[floor_normal]);
         }
         { //Ceiling
-            squares.resize( squares.size() + 1 );
-            Square & s = squares[squares.size() - 1];
-            s.setQuad(Vec3(-1., -1., 0.), Vec3(1., 0, 0.), Vec3(0., 1, 0.), 2., 2.);
+            Square & s = squares[first + 4];
             s.translate(Vec3(0., 0., -2.));
             s.scale(Vec3(2.*aspect_ratio, 2., 1.));
             s.rotate_x(90);
-            s.build_arrays();
-            s.material.diffuse_material = Vec3( 1.0,1.0,1.0 );
-            s.material.specular_material = Vec3( 1.0,1.0,1.0 );
-            s.material.shininess = 16;
-            s.material.texture_type = Texture_Checkerboard;
-            s.material.checkerboard_color1 = Vec3(0.95);
-            s.material.checkerboard_color2 = Vec3(0.5);
-            s.material.texture_scale_x = 8.*aspect_ratio;
-            s.material.texture_scale_y = 8.;
+            materials[s.material_index].texture_scale_x = 8.*aspect_ratio;
         }
         { //Front Wall
-            squares.resize( squares.size() + 1 );
-            Square & s = squares[squares.size() - 1];
-            s.setQuad(Vec3(-1., -1., 0.), Vec3(1., 0, 0.), Vec3(0., 1, 0.), 2., 2.);
+            Square & s = squares[first + 5];
             s.translate(Vec3(0., 0., -2.));
             s.scale(Vec3(2.*aspect_ratio, 2., 1.));
             s.rotate_y(180);
-            s.build_arrays();
-            s.material.diffuse_material = Vec3( 1.0,1.0,1.0 );
-            s.material.specular_material = Vec3( 1.0,1.0,1.0 );
-            s.material.shininess = 16;
-            s.material.texture_type = Texture_Image;
-            s.material.set_texture(&textures[brickwall_texture]);
-            s.material.set_normals(&normals[brickwall_normal]);
-        }
-        { //GLASS Sphere
-
-            spheres.resize( spheres.size() + 1 );
-            Sphere & s = spheres[spheres.size() - 1];
-            s.m_center = Vec3(1.0, -1.25, 0.5);
-            s.m_radius = 0.75f;
-            s.build_arrays();
-            s.material.type = Material_Glass;
-            s.material.diffuse_material = Vec3( 1.);
-            s.material.specular_material = Vec3( 1.);
-            s.material.shininess = 16;
-            s.material.transparency = 1.0;
-            s.material.index_medium = 1.4;
         }
-        { //MIRRORED Sphere
-            spheres.resize( spheres.size() + 1 );
-            Sphere & s = spheres[spheres.size() - 1];
-            s.m_center = Vec3(-1.0, -1.25, -0.5);
-            s.m_radius = 0.75f;
-            s.build_arrays();
-            s.material.type = Material_Mirror; 
-            s.material.diffuse_material = Vec3( 0.7 );
-            s.material.specular_material = Vec3(  1.,1.,1. );
-            s.material.shininess = 16;
-            s.material.transparency = 0.;
-            s.material.index_medium = 0.;
+        for (unsigned int i = first; i < first + 6; i++) {
+            squares[i].build_arrays();
         }
     }
 
@@ -656,58 +855,62 @@ public:
         { // Glass Sphere
             spheres.resize( spheres.size() + 1 );
             Sphere & s = spheres[spheres.size() - 1];
+            Material & material = new_material(s);
             s.m_center = Vec3(-4. , 0. , -8.);
             s.m_radius = 2.f;
             s.build_arrays();
-            s.material.type = Material_Glass;
-            s.material.diffuse_material = Vec3( 0.8 );
-            s.material.specular_material = Vec3( 0.8 );
-            s.material.index_medium = 1.5;
-            s.material.shininess = 20;
+            material.type = Material_Glass;
+            material.diffuse_material = Vec3( 0.8 );
+            material.specular_material = Vec3( 0.8 );
+            material.index_medium = 1.5;
+            material.shininess = 20;
         }
         { // Diffuse Sphere
             spheres.resize( spheres.size() + 1 );
             Sphere & s = spheres[spheres.size() - 1];
+            Material & material = new_material(s);
             s.m_center = Vec3(0. , 0.5 , -8.);
             s.m_radius = 1.5f;
             s.build_arrays();
-            s.material.diffuse_material = Vec3( 0.1,0.2, 0.5);
-            s.material.specular_material = Vec3( 0.2,0.2,0.2 );
-            s.material.shininess = 20;
-            s.material.texture_type = Texture_Image;
-            s.material.set_texture(&textures[sun_texture]);
-            s.material.emissive = true;
-            s.material.light_intensity = 15.;
-            s.material.motion_blur_translation = Vec3(0., 1., 0.);
+            material.diffuse_material = Vec3( 0.1,0.2, 0.5);
+            material.specular_material = Vec3( 0.2,0.2,0.2 );
+            material.shininess = 20;
+            material.texture_type = Texture_Image;
+            material.set_texture(textures[sun_texture].get());
+            material.emissive = true;
+            material.light_intensity = 15.;
+            s.motion_blur_translation = Vec3(0., 1., 0.);
         }
         { // Mirror Sphere
             spheres.resize( spheres.size() + 1 );
             Sphere & s = spheres[spheres.size() - 1];
+            Material & material = new_material(s);
             s.m_center = Vec3(4. , 0. , -8.);
             s.m_radius = 2.f;
             s.build_arrays();
-            s.material.type = Material_Mirror;
-            s.material.diffuse_material = Vec3( 0.8 );
-            s.material.specular_material = Vec3( 0.8 );
-            s.material.shininess = 32;
+            material.type = Material_Mirror;
+            material.diffuse_material = Vec3( 0.8 );
+            material.specular_material = Vec3( 0.8 );
+            material.shininess = 32;
         }
 
         { //Floor
             squares.resize( squares.size() + 1 );
             Square & s = squares[squares.size() - 1];
+            Material & material = new_material(s);
             s.setQuad(Vec3(-1., -0.2, 0.), Vec3(1., 0, 0.), Vec3(0., 1, 0.), 2., 2.);
             s.translate(Vec3(0., 0., -2.));
             s.scale(Vec3(50., 50., 1.));
             s.rotate_x(-90);
             s.build_arrays();
-            s.material.diffuse_material = Vec3( 0.1,0.2,0.5 );
-            s.material.specular_material = Vec3( 1.0,1.0,1.0 );
-            s.material.shininess = 16;
-            s.material.texture_type = Texture_Checkerboard;
-            s.material.checkerboard_color1 = Vec3(1.);
-            s.material.checkerboard_color2 = Vec3( 0.1,0.2,0.5 );
-            s.material.texture_scale_x = 100.;
-s.material.texture_scale_y = 100.;
+            material.diffuse_material = Vec3( 0.1,0.2,0.5 );
+            material.specular_material = Vec3( 1.0,1.0,1.0 );
+            material.shininess = 16;
+            material.texture_type = Texture_Checkerboard;
+            material.checkerboard_color1 = Vec3(1.);
+            material.checkerboard_color2 = Vec3( 0.1,0.2,0.5 );
+            material.texture_scale_x = 100.;
+material.texture_scale_y = 100.;
         }
     }
 
@@ -729,99 +932,107 @@ s.material.texture_scale_y = 100.;
         { // Diffuse Sphere
             spheres.resize( spheres.size() + 1 );
             Sphere & s = spheres[spheres.size() - 1];
+            Material & material = new_material(s);
             s.m_center = Vec3(0. , 0. , -16.);
             s.m_radius = 2.f;
             s.build_arrays();
-            s.material.diffuse_material = Vec3( 0.1 , 0.6, 0.2);
-            s.material.specular_material = Vec3( 0.1 , 0.6, 0.2);
-            s.material.shininess = 20;
+            material.diffuse_material = Vec3( 0.1 , 0.6, 0.2);
+            material.specular_material = Vec3( 0.1 , 0.6, 0.2);
+            material.shininess = 20;
         }
 
         { // Mirror Sphere
             spheres.resize( spheres.size() + 1 );
             Sphere & s = spheres[spheres.size() - 1];
+            Material & material = new_material(s);
             s.m_center = Vec3(4. , 0. , -8.);
             s.m_radius = 2.f;
             s.build_arrays();
-            s.material.type = Material_Mirror;
-            s.material.diffuse_material = Vec3( 0.8 );
-            s.material.specular_material = Vec3( 0.8 );
-            s.material.shininess = 32;
+            material.type = Material_Mirror;
+            material.diffuse_material = Vec3( 0.8 );
+            material.specular_material = Vec3( 0.8 );
+            material.shininess = 32;
         }
 
         {
             meshes.resize( meshes.size() + 1 );
             Mesh & m = meshes[meshes.size() - 1];
+            Material & material = new_material(m);
             m.loadOFF("mesh/blob-closed.off");
             m.translate(Vec3(0., 0.9, -4.));
             m.scale(Vec3(1.5));
             m.rotate_x(180);
             m.rotate_y(180);
             m.build_arrays();
-            m.material.type = Material_Glass;
-            m.material.index_medium = 1.333;
-            m.material.transparency = 0.9;
-            m.material.diffuse_material = Vec3( 0.1,0.2, 0.5);
-            m.material.specular_material = Vec3( 0.9, 0.9, 0.9 );
-            m.material.shininess = 32;
+            material.type = Material_Glass;
+            material.index_medium = 1.333;
+            material.transparency = 0.9;
+            material.diffuse_material = Vec3( 0.1,0.2, 0.5);
+            material.specular_material = Vec3( 0.9, 0.9, 0.9 );
+            material.shininess = 32;
         }
 
         { // Eye 1
             spheres.resize( spheres.size() + 1 );
             Sphere & s = spheres[spheres.size() - 1];
+            Material & material = new_material(s);
             s.m_center = Vec3(0.2, -1. , -4.8);
             s.m_radius = 0.3f;
             s.build_arrays();
-            s.material.diffuse_material = Vec3( 1.);
-            s.material.specular_material = Vec3( 1. );
-            s.material.shininess = 20;
+            material.diffuse_material = Vec3( 1.);
+            material.specular_material = Vec3( 1. );
+            material.shininess = 20;
         }
 
         { // Pupil 1
             spheres.resize( spheres.size() + 1 );
             Sphere & s = spheres[spheres.size() - 1];
+            Material & material = new_material(s);
             s.m_center = Vec3(0.2, -1. , -4.55);
             s.m_radius = 0.1f;
             s.build_arrays();
-            s.material.diffuse_material = Vec3( 0.);
-            s.material.specular_material = Vec3( 1. );
-            s.material.shininess = 20;
+            material.diffuse_material = Vec3( 0.);
+            material.specular_material = Vec3( 1. );
+            material.shininess = 20;
         }
 
         { // Eye 2
             spheres.resize( spheres.size() + 1 );
             Sphere & s = spheres[spheres.size() - 1];
+            Material & material = new_material(s);
             s.m_center = Vec3(-0.7 , -1. , -4.95);
             s.m_radius = 0.3f;
             s.build_arrays();
-            s.material.diffuse_material = Vec3( 1.);
-            s.material.specular_material = Vec3( 1. );
-            s.material.shininess = 20;
+            material.diffuse_material = Vec3( 1.);
+            material.specular_material = Vec3( 1. );
+            material.shininess = 20;
         }
 
         { // Pupil 2
             spheres.resize( spheres.size() + 1 );
             Sphere & s = spheres[spheres.size() - 1];
+            Material & material = new_material(s);
             s.m_center = Vec3(-0.7 , -1. , -4.7);
             s.m_radius = 0.1f;
             s.build_arrays();
-            s.material.diffuse_material = Vec3( 0.);
-            s.material.specular_material = Vec3( 1. );
-            s.material.shininess = 20;
+            material.diffuse_material = Vec3( 0.);
+            material.specular_material = Vec3( 1. );
+            material.shininess = 20;
         }
 
 
         { //Floor
             squares.resize( squares.size() + 1 );
             Square & s = squares[squares.size() - 1];
+            Material & material = new_material(s);
             s.setQuad(Vec3(-1., -0.2, 0.), Vec3(1., 0, 0.), Vec3(0., 1, 0.), 2., 2.);
             s.translate(Vec3(0., 0., -2.));
             s.scale(Vec3(50., 50., 1.));
             s.rotate_x(-90);
             s.build_arrays();
-            s.material.diffuse_material = Vec3( 0.8,0.8,0. );
-            s.material.specular_material = Vec3( 1.0,1.0,1.0 );
-            s.material.shininess = 16;
+            material.diffuse_material = Vec3( 0.8,0.8,0. );
+            material.specular_material = Vec3( 1.0,1.0,1.0 );
+            material.shininess = 16;
         }
         computeKDTrees();
     }
@@ -844,49 +1055,53 @@ s.material.texture_scale_y = 100.;
         { //Floor
             squares.resize( squares.size() + 1 );
             Square & s = squares[squares.size() - 1];
+            Material & material = new_material(s);
             s.setQuad(Vec3(-1., -0.2, 0.), Vec3(1., 0, 0.), Vec3(0., 1, 0.), 2., 2.);
             s.translate(Vec3(0., 0., -4.));
             s.scale(Vec3(100., 100., 1.));
             s.rotate_x(-90);
             s.build_arrays();
-            s.material.diffuse_material = Vec3( 0.8,0.8,0. );
-            s.material.specular_material = Vec3( 1.0,1.0,1.0 );
+            material.diffuse_material = Vec3( 0.8,0.8,0. );
+            material.specular_material = Vec3( 1.0,1.0,1.0 );
         }
 
         { // Mirror Sphere
             spheres.resize( spheres.size() + 1 );
             Sphere & s = spheres[spheres.size() - 1];
+            Material & material = new_material(s);
             s.m_center = Vec3(-3. , 0. , -22.);
             s.m_radius = 4.f;
             s.build_arrays();
-            s.material.type = Material_Mirror;
-            s.material.diffuse_material = Vec3( 0.8 );
-            s.material.specular_material = Vec3( 0.8 );
-            s.material.shininess = 32;
+            material.type = Material_Mirror;
+            material.diffuse_material = Vec3( 0.8 );
+            material.specular_material = Vec3( 0.8 );
+            material.shininess = 32;
         }
 
         { // Mirror Sphere
             spheres.resize( spheres.size() + 1 );
             Sphere & s = spheres[spheres.size() - 1];
+            Material & material = new_material(s);
             s.m_center = Vec3(4. , -2. , -15.);
             s.m_radius = 2.f;
             s.build_arrays();
-            s.material.type = Material_Mirror;
-            s.material.diffuse_material = Vec3( 0.8 );
-            s.material.specular_material = Vec3( 0.8 );
-            s.material.shininess = 32;
+            material.type = Material_Mirror;
+            material.diffuse_material = Vec3( 0.8 );
+            material.specular_material = Vec3( 0.8 );
+            material.shininess = 32;
         }
 
         { // Glass Sphere
             spheres.resize( spheres.size() + 1 );
             Sphere & s = spheres[spheres.size() - 1];
+            Material & material = new_material(s);
             s.m_center = Vec3(-1. , -2.5 , -8.);
             s.m_radius = 1.5f;
             s.build_arrays();
-            s.material.type = Material_Glass;
-            s.material.diffuse_material = Vec3( 0.8 );
-            s.material.specular_material = Vec3( 0.8 );
-            s.material.shininess = 20;
+            material.type = Material_Glass;
+            material.diffuse_material = Vec3( 0.8 );
+            material.specular_material = Vec3( 0.8 );
+            material.shininess = 20;
         }
 
         for (int i = 0; i < nSpheres; i++) {
@@ -895,31 +1110,32 @@ s.material.texture_scale_y = 100.;
             int type = rand() % 3;
             spheres.resize( spheres.size() + 1 );
             Sphere & s = spheres[spheres.size() - 1];
+            Material & material = new_material(s);
             s.m_center = Vec3(random_float(-30., 30.), -4+radius+height, random_float(-50., -2.));
             s.m_radius = radius;
             s.build_arrays();
             switch (type) {
                 case 0:
-                    s.material.type = Material_Mirror;
-                    s.material.diffuse_material = Vec3( random_float(0., 1.), random_float(0., 1.), random_float(0., 1.));
-                    s.material.specular_material = Vec3( random_float(0., 1.), random_float(0., 1.), random_float(0., 1.));
-                    s.material.shininess = random_float(32., 100.);
+                    material.type = Material_Mirror;
+                    material.diffuse_material = Vec3( random_float(0., 1.), random_float(0., 1.), random_float(0., 1.));
+                    material.specular_material = Vec3( random_float(0., 1.), random_float(0., 1.), random_float(0., 1.));
+                    material.shininess = random_float(32., 100.);
                     break;
                 case 1:
-                    s.material.type = Material_Glass;
-                    s.material.diffuse_material = Vec3( random_float(0.7, 1.));
-                    s.material.specular_material = Vec3( random_float(0.7, 1.));
-                    s.material.shininess = random_float(32., 70.);
-                    s.material.transparency = random_float(0.7, 1.);
-                    s.material.index_medium = random_float(1., 2.);
+                    material.type = Material_Glass;
+                    material.diffuse_material = Vec3( random_float(0.7, 1.));
+                    material.specular_material = Vec3( random_float(0.7, 1.));
+                    material.shininess = random_float(32., 70.);
+                    material.transparency = random_float(0.7, 1.);
+                    material.index_medium = random_float(1., 2.);
                     break;
                 default:
-                    s.material.diffuse_material = Vec3( random_float(0., 1.), random_float(0., 1.), random_float(0., 1.));
-                    s.material.specular_material = Vec3( random_float(0., 1.), random_float(0., 1.), random_float(0., 1.));
-                    s.material.shininess = random_float(0., 30.);
+                    material.diffuse_material = Vec3( random_float(0., 1.), random_float(0., 1.), random_float(0., 1.));
+                    material.specular_material = Vec3( random_float(0., 1.), random_float(0., 1.), random_float(0., 1.));
+                    material.shininess = random_float(0., 30.);
                     break;
             }
-            s.material.motion_blur_translation = Vec3(0., height, 0.);
+            s.motion_blur_translation = Vec3(0., height, 0.);
         }
     }
 
@@ -939,61 +1155,66 @@ s.material.texture_scale_y = 100.;
         { //Back Wall
             squares.resize( squares.size() + 1 );
             Square & s = squares[squares.size() - 1];
+            Material & material = new_material(s);
             s.setQuad(Vec3(-1., -1., 0.), Vec3(1., 0, 0.), Vec3(0., 1, 0.), 2., 2.);
             s.scale(Vec3(2., 2., 1.));
             s.translate(Vec3(-2., 2., -2.));
             s.build_arrays();
-            s.material.diffuse_material = Vec3( 1.,0.,0. );
-            s.material.specular_material = Vec3( 1.,1.,1. );
-            s.material.shininess = 16;
+            material.diffuse_material = Vec3( 1.,0.,0. );
+            material.specular_material = Vec3( 1.,1.,1. );
+            material.shininess = 16;
         }
         { //Back Wall
             squares.resize( squares.size() + 1 );
             Square & s = squares[squares.size() - 1];
+            Material & material = new_material(s);
             s.setQuad(Vec3(-1., -1., 0.), Vec3(1., 0, 0.), Vec3(0., 1, 0.), 2., 2.);
             s.scale(Vec3(2., 2., 1.));
             s.translate(Vec3(-2., -2., -2.));
             s.build_arrays();
-            s.material.diffuse_material = Vec3( 0.,1.,0. );
-            s.material.specular_material = Vec3( 1.,1.,1. );
-            s.material.shininess = 16;
+            material.diffuse_material = Vec3( 0.,1.,0. );
+            material.specular_material = Vec3( 1.,1.,1. );
+            material.shininess = 16;
         }
         { //Back Wall
             squares.resize( squares.size() + 1 );
             Square & s = squares[squares.size() - 1];
+            Material & material = new_material(s);
             s.setQuad(Vec3(-1., -1., 0.), Vec3(1., 0, 0.), Vec3(0., 1, 0.), 2., 2.);
             s.scale(Vec3(2., 2., 1.));
             s.translate(Vec3(2., 2., -2.));
             s.build_arrays();
-            s.material.diffuse_material = Vec3( 0.,0.,1. );
-            s.material.specular_material = Vec3( 1.,1.,1. );
-            s.material.shininess = 16;
+            material.diffuse_material = Vec3( 0.,0.,1. );
+            material.specular_material = Vec3( 1.,1.,1. );
+            material.shininess = 16;
         }
         { //Back Wall
             squares.resize( squares.size() + 1 );
             Square & s = squares[squares.size() - 1];
+            Material & material = new_material(s);
             s.setQuad(Vec3(-1., -1., 0.), Vec3(1., 0, 0.), Vec3(0., 1, 0.), 2., 2.);
             s.scale(Vec3(2., 2., 1.));
             s.translate(Vec3(2., -2., -2.));
             s.build_arrays();
-            s.material.diffuse_material = Vec3( 1.,1.,1. );
-            s.material.specular_material = Vec3( 1.,1.,1. );
-            s.material.shininess = 16;
+            material.diffuse_material = Vec3( 1.,1.,1. );
+            material.specular_material = Vec3( 1.,1.,1. );
+            material.shininess = 16;
         }
         
         { //GLASS Sphere
 
             spheres.resize( spheres.size() + 1 );
             Sphere & s = spheres[spheres.size() - 1];
+            Material & material = new_material(s);
             s.m_center = Vec3(0., 0., 0.);
             s.m_radius = 0.75f;
             s.build_arrays();
-            s.material.type = Material_Glass;
-            s.material.diffuse_material = Vec3( 1.);
-            s.material.specular_material = Vec3( 1.);
-            s.material.shininess = 16;
-            s.material.transparency = 1.0;
-            s.material.index_medium = 1.4;
+            material.type = Material_Glass;
+            material.diffuse_material = Vec3( 1.);
+            material.specular_material = Vec3( 1.);
+            material.shininess = 16;
+            material.transparency = 1.0;
+            material.index_medium = 1.4;
         }
     }
 
@@ -1023,46 +1244,50 @@ s.material.texture_scale_y = 100.;
         { //Floor
             squares.resize( squares.size() + 1 );
             Square & s = squares[squares.size() - 1];
+            Material & material = new_material(s);
             s.setQuad(Vec3(-1., -0.2, 0.), Vec3(1., 0, 0.), Vec3(0., 1, 0.), 2., 2.);
             s.translate(Vec3(0., 0., -2.));
             s.scale(Vec3(50., 50., 1.));
             s.rotate_x(-90);
             s.build_arrays();
-            s.material.diffuse_material = Vec3( 0.8,0.8,0.  );
-            s.material.specular_material = Vec3( 1.0,1.0,1.0 );
-            s.material.shininess = 16;
-            s.material.texture_type = Texture_Checkerboard;
-            s.material.checkerboard_color1 = Vec3(0.8, 0.8, 0.);
-            s.material.checkerboard_color2 = Vec3( 0.6,0.6,0.  );
-            s.material.texture_scale_x = 100.;
-            s.material.texture_scale_y = 100.;
+            material.diffuse_material = Vec3( 0.8,0.8,0.  );
+            material.specular_material = Vec3( 1.0,1.0,1.0 );
+            material.shininess = 16;
+            material.texture_type = Texture_Checkerboard;
+            material.checkerboard_color1 = Vec3(0.8, 0.8, 0.);
+            material.checkerboard_color2 = Vec3( 0.6,0.6,0.  );
+            material.texture_scale_x = 100.;
+            material.texture_scale_y = 100.;
         }
         { // Glass Sphere
             spheres.resize( spheres.size() + 1 );
             Sphere & s = spheres[spheres.size() - 1];
+            Material & material = new_material(s);
             s.m_center = Vec3(-4. , 0. , -8.);
             s.m_radius = 2.f;
             s.build_arrays();
-            s.material.type = Material_Glass;
-            s.material.diffuse_material = Vec3( 0.8 );
-            s.material.specular_material = Vec3( 0.8 );
-            s.material.index_medium = 1.5;
-            s.material.shininess = 20;
+            material.type = Material_Glass;
+            material.diffuse_material = Vec3( 0.8 );
+            material.specular_material = Vec3( 0.8 );
+            material.index_medium = 1.5;
+            material.shininess = 20;
         }
         { // Mirror Sphere
             spheres.resize( spheres.size() + 1 );
             Sphere & s = spheres[spheres.size() - 1];
+            Material & material = new_material(s);
             s.m_center = Vec3(4. , 0. , -8.);
             s.m_radius = 2.f;
             s.build_arrays();
-            s.material.type = Material_Mirror;
-            s.material.diffuse_material = Vec3( 0.8 );
-            s.material.specular_material = Vec3( 0.8 );
-            s.material.shininess = 32;
+            material.type = Material_Mirror;
+            material.diffuse_material = Vec3( 0.8 );
+            material.specular_material = Vec3( 0.8 );
+            material.shininess = 32;
         }
         {
             meshes.resize( meshes.size() + 1 );
             Mesh & m = meshes[meshes.size() - 1];
+            Material & material = new_material(m);
             m.loadOFF("mesh/flamingo_lowpoly_colored.off");
             m.scale(Vec3(2.5));
             m.rotate_x(90);
@@ -1070,9 +1295,9 @@ s.material.texture_scale_y = 100.;
             m.rotate_z(180);
             m.translate(Vec3(0., 1., -8.));
             m.build_arrays();
-            m.material.diffuse_material = Vec3( 0.1,0.2, 0.5);
-            m.material.specular_material = Vec3( 0.9, 0.9, 0.9 );
-            m.material.shininess = 6.;
+            material.diffuse_material = Vec3( 0.1,0.2, 0.5);
+            material.specular_material = Vec3( 0.9, 0.9, 0.9 );
+            material.shininess = 6.;
         }
         computeKDTrees();
     }
@@ -1096,112 +1321,120 @@ s.material.texture_scale_y = 100.;
         { //Flying carpet checker part
             squares.resize( squares.size() + 1 );
             Square & s = squares[squares.size() - 1];
+            Material & material = new_material(s);
             s.setQuad(Vec3(-1., -0.2, 0.), Vec3(1., 0, 0.), Vec3(0., 1, 0.), 2., 2.);
             s.translate(Vec3(0., 0., -2.));
             s.scale(Vec3(2., 4., 1.));
             s.rotate_x(-90);
             s.translate(Vec3(0., 0., -4.));
             s.build_arrays();
-            s.material.diffuse_material = Vec3( 0.5,0.,0.5  );
-            s.material.specular_material = Vec3( 1.0,1.0,1.0 );
-            s.material.shininess = 4;
-            s.material.texture_type = Texture_Checkerboard;
-            s.material.checkerboard_color1 = Vec3(0.5, 0., 0.5);
-            s.material.checkerboard_color2 = Vec3( 0.6,0.,0.6  );
-            s.material.texture_scale_x = 16.;
-            s.material.texture_scale_y = 16.;
+            material.diffuse_material = Vec3( 0.5,0.,0.5  );
+            material.specular_material = Vec3( 1.0,1.0,1.0 );
+            material.shininess = 4;
+            material.texture_type = Texture_Checkerboard;
+            material.checkerboard_color1 = Vec3(0.5, 0., 0.5);
+            material.checkerboard_color2 = Vec3( 0.6,0.,0.6  );
+            material.texture_scale_x = 16.;
+            material.texture_scale_y = 16.;
         }
         { //Flying carpet red part
             squares.resize( squares.size() + 1 );
             Square & s = squares[squares.size() - 1];
+            Material & material = new_material(s);
             s.setQuad(Vec3(-1., -0.2, 0.), Vec3(1., 0, 0.), Vec3(0., 1, 0.), 2., 2.);
             s.translate(Vec3(0., 0., -2.));
             s.scale(Vec3(2.5, 5., 1.));
             s.rotate_x(-90);
             s.translate(Vec3(0., -0.0001, -3.5));
             s.build_arrays();
-            s.material.diffuse_material = Vec3( 0.9, 0.2, 0.);
-            s.material.specular_material = Vec3( 1.0,1.0,1.0 );
-            s.material.shininess = 4;
+            material.diffuse_material = Vec3( 0.9, 0.2, 0.);
+            material.specular_material = Vec3( 1.0,1.0,1.0 );
+            material.shininess = 4;
         }
         { // Raccoon
             meshes.resize( meshes.size() + 1 );
             Mesh & m = meshes[meshes.size() - 1];
+            Material & material = new_material(m);
             m.loadOFF("mesh/raccoon_low_poly_colored.off");
             m.rotate_y(-90);
             m.scale(Vec3(2.));
             m.translate(Vec3(0., -2., -5.));
             m.build_arrays();
-            m.material.diffuse_material = Vec3( 0.1,0.2, 0.5);
-            m.material.specular_material = Vec3( 0.9, 0.9, 0.9 );
-            m.material.shininess = 6.;
+            material.diffuse_material = Vec3( 0.1,0.2, 0.5);
+            material.specular_material = Vec3( 0.9, 0.9, 0.9 );
+            material.shininess = 6.;
         }
         {   // Staff
             meshes.resize( meshes.size() + 1 );
             Mesh & m = meshes[meshes.size() - 1];
+            Material & material = new_material(m);
             m.loadOFF("mesh/magic_staff_low_poly_colored.off");
             m.rotate_y(-90);
             m.rotate_z(90);
             m.scale(Vec3(0.15));
             m.translate(Vec3(1., 0.2, -2.7));
             m.build_arrays();
-            m.material.diffuse_material = Vec3( 0.1,0.2, 0.5);
-            m.material.specular_material = Vec3( 0.9, 0.9, 0.9 );
-            m.material.shininess = 6.;
+            material.diffuse_material = Vec3( 0.1,0.2, 0.5);
+            material.specular_material = Vec3( 0.9, 0.9, 0.9 );
+            material.shininess = 6.;
         }
         { // Staff orb
             spheres.resize( spheres.size() + 1 );
             Sphere & s = spheres[spheres.size() - 1];
+            Material & material = new_material(s);
             s.m_center = Vec3(-1.85 , 0.35 , -2.7);
             s.m_radius = 0.14f;
             s.build_arrays();
-            s.material.type = Material_Glass;
-            s.material.diffuse_material = Vec3( 0.451, 0.6627, 0.7608 );
-            s.material.specular_material = Vec3( 1. );
-            s.material.index_medium = 1.5;
-            s.material.shininess = 64;
-            s.material.transparency = 0.65;
+            material.type = Material_Glass;
+            material.diffuse_material = Vec3( 0.451, 0.6627, 0.7608 );
+            material.specular_material = Vec3( 1. );
+            material.index_medium = 1.5;
+            material.shininess = 64;
+            material.transparency = 0.65;
         }
         { // Fire orb
             spheres.resize( spheres.size() + 1 );
             Sphere & s = spheres[spheres.size() - 1];
+            Material & material = new_material(s);
             s.m_center = Vec3(4. , 3. , -8.);
             s.m_radius = 1.3f;
             s.build_arrays();
-            s.material.type = Material_Mirror;
-            s.material.diffuse_material = Vec3( 0.8 , 0., 0.);
-            s.material.specular_material = Vec3( 0.8 );
-            s.material.shininess = 32;
-            s.material.texture_type = Texture_Image;
-            s.material.set_texture(&textures[fire_orb_texture]);
+            material.type = Material_Mirror;
+            material.diffuse_material = Vec3( 0.8 , 0., 0.);
+            material.specular_material = Vec3( 0.8 );
+            material.shininess = 32;
+            material.texture_type = Texture_Image;
+            material.set_texture(textures[fire_orb_texture].get());
         }
         { // Wind orb
             spheres.resize( spheres.size() + 1 );
             Sphere & s = spheres[spheres.size() - 1];
+            Material & material = new_material(s);
             s.m_center = Vec3(-4. , 2. , -5.);
             s.m_radius = 0.9f;
             s.build_arrays();
-            s.material.type = Material_Glass;
-            s.material.diffuse_material = Vec3( 1.);
-            s.material.specular_material = Vec3( 0.8 );
-            s.material.shininess = 32;
-            s.material.transparency = 0.4;
-            s.material.texture_type = Texture_Image;
-            s.material.set_texture(&textures[wind_orb_texture]);
+            material.type = Material_Glass;
+            material.diffuse_material = Vec3( 1.);
+            material.specular_material = Vec3( 0.8 );
+            material.shininess = 32;
+            material.transparency = 0.4;
+            material.texture_type = Texture_Image;
+            material.set_texture(textures[wind_orb_texture].get());
         }
         { // Water orb
             spheres.resize( spheres.size() + 1 );
             Sphere & s = spheres[spheres.size() - 1];
+            Material & material = new_material(s);
             s.m_center = Vec3(-0.2 , 3. , -1.);
             s.m_radius = 1.4f;
             s.build_arrays();
-            s.material.type = Material_Glass;
-            s.material.diffuse_material = Vec3(0.5, 0.53, 0.8);
-            s.material.specular_material = Vec3( 0.8 );
-            s.material.shininess = 32;
-            s.material.transparency = 0.8;
-            s.material.texture_type = Texture_Image;
-            s.material.set_texture(&textures[water_orb_texture]);
+            material.type = Material_Glass;
+            material.diffuse_material = Vec3(0.5, 0.53, 0.8);
+            material.specular_material = Vec3( 0.8 );
+            material.shininess = 32;
+            material.transparency = 0.8;
+            material.texture_type = Texture_Image;
+            material.set_texture(textures[water_orb_texture].get());
         }
         computeKDTrees();
     }
@@ -1222,31 +1455,34 @@ s.material.texture_scale_y = 100.;
         { // Pond. Note : when i'll implement acceleration structures, i should break this mesh into smaller parts
             meshes.resize( meshes.size() + 1 );
             Mesh & m = meshes[meshes.size() - 1];
+            Material & material = new_material(m);
             m.loadOFF("mesh/pond.off");
             m.scale(Vec3(3.));
             m.translate(Vec3(1., -5., -3.));
             m.build_arrays();
-            m.material.diffuse_material = Vec3( 0.1,0.2, 0.5);
-            m.material.specular_material = Vec3( 0.9, 0.9, 0.9 );
-            m.material.shininess = 6.;
+            material.diffuse_material = Vec3( 0.1,0.2, 0.5);
+            material.specular_material = Vec3( 0.9, 0.9, 0.9 );
+            material.shininess = 6.;
         }
         { // Water
             squares.resize( squares.size() + 1 );
             Square & s = squares[squares.size() - 1];
+            Material & material = new_material(s);
             s.setQuad(Vec3(-1., -0.2, 0.), Vec3(1., 0, 0.), Vec3(0., 1, 0.), 2., 2.);
             s.translate(Vec3(0., 0., -2.));
             s.scale(Vec3(5., 3.5, 1.));
             s.rotate_x(-90);
             s.translate(Vec3(1., 0., 2.8));
             s.build_arrays();
-            s.material.diffuse_material = Vec3( 0.5,0.53,0.8 );
-            s.material.specular_material = Vec3( 1.0,1.0,1.0 );
-            s.material.shininess = 4;
-            s.material.type = Material_Mirror;
+            material.diffuse_material = Vec3( 0.5,0.53,0.8 );
+            material.specular_material = Vec3( 1.0,1.0,1.0 );
+            material.shininess = 4;
+            material.type = Material_Mirror;
         }
         { // Flamingo
             meshes.resize( meshes.size() + 1 );
             Mesh & m = meshes[meshes.size() - 1];
+            Material & material = new_material(m);
             m.loadOFF("mesh/flamingo_lowpoly_colored.off");
             m.scale(Vec3(0.8));
             m.rotate_x(90);
@@ -1254,9 +1490,9 @@ s.material.texture_scale_y = 100.;
             m.rotate_z(180);
             m.translate(Vec3(3., -1.2, -1.));
             m.build_arrays();
-            m.material.diffuse_material = Vec3( 0.1,0.2, 0.5);
-            m.material.specular_material = Vec3( 0.9, 0.9, 0.9 );
-            m.material.shininess = 6.;
+            material.diffuse_material = Vec3( 0.1,0.2, 0.5);
+            material.specular_material = Vec3( 0.9, 0.9, 0.9 );
+            material.shininess = 6.;
         }
         computeKDTrees();
     }
@@ -1279,49 +1515,52 @@ s.material.texture_scale_y = 100.;
         { //Floor
             squares.resize( squares.size() + 1 );
             Square & s = squares[squares.size() - 1];
+            Material & material = new_material(s);
             s.setQuad(Vec3(-1., -0.2, 0.), Vec3(1., 0, 0.), Vec3(0., 1, 0.), 2., 2.);
             s.translate(Vec3(0., 0., -2.));
             s.scale(Vec3(50., 50., 1.));
             s.rotate_x(-90);
             s.build_arrays();
-            s.material.diffuse_material = Vec3( 0.1,0.5,0.1 );
-            s.material.specular_material = Vec3( 1.0,1.0,1.0 );
-            s.material.shininess = 16;
-            s.material.texture_type = Texture_Checkerboard;
-            s.material.checkerboard_color1 = Vec3(1.);
-            s.material.checkerboard_color2 = Vec3( 0.1,0.2,0.5 );
-            s.material.texture_scale_x = 100.;
-            s.material.texture_scale_y = 100.;
+            material.diffuse_material = Vec3( 0.1,0.5,0.1 );
+            material.specular_material = Vec3( 1.0,1.0,1.0 );
+            material.shininess = 16;
+            material.texture_type = Texture_Checkerboard;
+            material.checkerboard_color1 = Vec3(1.);
+            material.checkerboard_color2 = Vec3( 0.1,0.2,0.5 );
+            material.texture_scale_x = 100.;
+            material.texture_scale_y = 100.;
         }
                         { //Water
             squares.resize( squares.size() + 1 );
             Square & s = squares[squares.size() - 1];
+            Material & material = new_material(s);
             s.setQuad(Vec3(-1., -0.2, 0.), Vec3(1., 0, 0.), Vec3(0., 1, 0.), 2., 2.);
             s.translate(Vec3(0., 0., -2.));
             s.scale(Vec3(50., 50., 1.));
             s.rotate_x(-90);
             s.translate(Vec3(0., 0.3, 0.));
             s.build_arrays();
-            s.material.diffuse_material = Vec3( 0.1,0.2,0.5 );
-            s.material.specular_material = Vec3( 1.0,1.0,1.0 );
-            s.material.shininess = 16;
-            s.material.type = Material_Glass;
-            s.material.texture_scale_x = 10.;
-            s.material.texture_scale_y = 10.;
-            s.material.set_normals(&normals[water_normal]);
+            material.diffuse_material = Vec3( 0.1,0.2,0.5 );
+            material.specular_material = Vec3( 1.0,1.0,1.0 );
+            material.shininess = 16;
+            material.type = Material_Glass;
+            material.texture_scale_x = 10.;
+            material.texture_scale_y = 10.;
+            material.set_normals(normals[water_normal].get());
             
         }
         { // Flamingo
             meshes.resize( meshes.size() + 1 );
             Mesh & m = meshes[meshes.size() - 1];
+            Material & material = new_material(m);
             m.loadOFF("mesh/flamingo_float.off");
             m.centerAndScaleToUnit();
             m.rotate_x(270);
             m.translate(Vec3(0., -1.5, -1.));
             m.build_arrays();
-            m.material.diffuse_material = Vec3( 237./255.,149./255., 218./255.);
-            m.material.specular_material = Vec3( 1. );
-            m.material.shininess = 6.;
+            material.diffuse_material = Vec3( 237./255.,149./255., 218./255.);
+            material.specular_material = Vec3( 1. );
+            material.shininess = 6.;
         }
         computeKDTrees();
     }
@@ -1336,118 +1575,126 @@ s.material.texture_scale_y = 100.;
         { //Ceil light 1
             squares.resize( squares.size() + 1 );
             Square & s = squares[squares.size() - 1];
+            Material & material = new_material(s);
             s.setQuad(Vec3(-1., -0.2, 0.), Vec3(1., 0, 0.), Vec3(0., 1, 0.), 2., 2.);
             s.translate(Vec3(0., 0., -2.));
             s.scale(Vec3(0.5, 0.5, 1.));
             s.rotate_x(90);
             s.translate(Vec3(0.,2.95,-12.75));
             s.build_arrays();
-            s.material.diffuse_material = Vec3( 1. );
-            s.material.specular_material = Vec3( 1.0,1.0,1.0 );
-            s.material.shininess = 16;
-            s.material.emissive = true;
-            s.material.light_intensity = lights_intensity;
-            s.material.light_color = Vec3(1.);
+            material.diffuse_material = Vec3( 1. );
+            material.specular_material = Vec3( 1.0,1.0,1.0 );
+            material.shininess = 16;
+            material.emissive = true;
+            material.light_intensity = lights_intensity;
+            material.light_color = Vec3(1.);
         }
         { //Ceil light 2
             squares.resize( squares.size() + 1 );
             Square & s = squares[squares.size() - 1];
+            Material & material = new_material(s);
             s.setQuad(Vec3(-1., -0.2, 0.), Vec3(1., 0, 0.), Vec3(0., 1, 0.), 2., 2.);
             s.translate(Vec3(0., 0., -2.));
             s.scale(Vec3(0.5, 0.5, 1.));
             s.rotate_x(90);
             s.translate(Vec3(0.,2.95,-8.75));
             s.build_arrays();
-            s.material.diffuse_material = Vec3( 1. );
-            s.material.specular_material = Vec3( 1.0,1.0,1.0 );
-            s.material.shininess = 16;
-            s.material.emissive = true;
-            s.material.light_intensity = lights_intensity;
-            s.material.light_color = Vec3(1.);
+            material.diffuse_material = Vec3( 1. );
+            material.specular_material = Vec3( 1.0,1.0,1.0 );
+            material.shininess = 16;
+            material.emissive = true;
+            material.light_intensity = lights_intensity;
+            material.light_color = Vec3(1.);
         }
         { //Ceil light 3
             squares.resize( squares.size() + 1 );
             Square & s = squares[squares.size() - 1];
+            Material & material = new_material(s);
             s.setQuad(Vec3(-1., -0.2, 0.), Vec3(1., 0, 0.), Vec3(0., 1, 0.), 2., 2.);
             s.translate(Vec3(0., 0., -2.));
             s.scale(Vec3(0.5, 0.5, 1.));
             s.rotate_x(90);
             s.translate(Vec3(0.,2.95,-4.75));
             s.build_arrays();
-            s.material.diffuse_material = Vec3( 1. );
-            s.material.specular_material = Vec3( 1.0,1.0,1.0 );
-            s.material.shininess = 16;
-            s.material.emissive = true;
-            s.material.light_intensity = lights_intensity;
-            s.material.light_color = Vec3(1.);
+            material.diffuse_material = Vec3( 1. );
+            material.specular_material = Vec3( 1.0,1.0,1.0 );
+            material.shininess = 16;
+            material.emissive = true;
+            material.light_intensity = lights_intensity;
+            material.light_color = Vec3(1.);
         }
         { //Ceil light 4
             squares.resize( squares.size() + 1 );
             Square & s = squares[squares.size() - 1];
+            Material & material = new_material(s);
             s.setQuad(Vec3(-1., -0.2, 0.), Vec3(1., 0, 0.), Vec3(0., 1, 0.), 2., 2.);
             s.translate(Vec3(0., 0., -2.));
             s.scale(Vec3(0.5, 0.5, 1.));
             s.rotate_x(90);
             s.translate(Vec3(0.,2.95,-0.75));
             s.build_arrays();
-            s.material.diffuse_material = Vec3( 1. );
-            s.material.specular_material = Vec3( 1.0,1.0,1.0 );
-            s.material.shininess = 16;
-            s.material.emissive = true;
-            s.material.light_intensity = lights_intensity;
-            s.material.light_color = Vec3(1.);
+            material.diffuse_material = Vec3( 1. );
+            material.specular_material = Vec3( 1.0,1.0,1.0 );
+            material.shininess = 16;
+            material.emissive = true;
+            material.light_intensity = lights_intensity;
+            material.light_color = Vec3(1.);
         }
         { //Pool water
             squares.resize( squares.size() + 1 );
             Square & s = squares[squares.size() - 1];
+            Material & material = new_material(s);
             s.setQuad(Vec3(-1., -0.2, 0.), Vec3(1., 0, 0.), Vec3(0., 1, 0.), 2., 2.);
             s.translate(Vec3(0., 0., -2.));
             s.scale(Vec3(4., 8., 1.));
             s.rotate_x(-90);
             s.translate(Vec3(0.,-0.75,0.));
             s.build_arrays();
-            s.material.diffuse_material = Vec3( 170./255.,213./255.,219./255. );
-            s.material.specular_material = Vec3( 1.0,1.0,1.0 );
-            s.material.shininess = 16;
-            s.material.type = Material_Glass;
-            s.material.transparency = 0.99;
-            s.material.texture_type = Texture_None;
-            s.material.set_normals(&normals[water_normal]);
+            material.diffuse_material = Vec3( 170./255.,213./255.,219./255. );
+            material.specular_material = Vec3( 1.0,1.0,1.0 );
+            material.shininess = 16;
+            material.type = Material_Glass;
+            material.transparency = 0.99;
+            material.texture_type = Texture_None;
+            material.set_normals(normals[water_normal].get());
         }
         { //Pool floor
             squares.resize( squares.size() + 1 );
             Square & s = squares[squares.size() - 1];
+            Material & material = new_material(s);
             s.setQuad(Vec3(-1., -0.2, 0.), Vec3(1., 0, 0.), Vec3(0., 1, 0.), 2., 2.);
             s.translate(Vec3(0., 0., -2.));
             s.scale(Vec3(4., 8., 1.));
             s.rotate_x(-90);
             s.translate(Vec3(0.,-1.,0.));
             s.build_arrays();
-            s.material.diffuse_material = Vec3( 0.1,0.5,0.1 );
-            s.material.specular_material = Vec3( 1.0,1.0,1.0 );
-            s.material.shininess = 16;
-            s.material.texture_type = Texture_Image;
-            s.material.texture_scale_x = 1.;
-            s.material.texture_scale_y = 2.;
-            s.material.set_texture(&textures[pool_tiles_texture]);
-            s.material.set_normals(&normals[pool_tiles_normal]);
+            material.diffuse_material = Vec3( 0.1,0.5,0.1 );
+            material.specular_material = Vec3( 1.0,1.0,1.0 );
+            material.shininess = 16;
+            material.texture_type = Texture_Image;
+            material.texture_scale_x = 1.;
+            material.texture_scale_y = 2.;
+            material.set_texture(textures[pool_tiles_texture].get());
+            material.set_normals(normals[pool_tiles_normal].get());
         }
         { //Pool ceiling
             squares.resize( squares.size() + 1 );
             Square & s = squares[squares.size() - 1];
+            Material & material = new_material(s);
             s.setQuad(Vec3(-1., -0.2, 0.), Vec3(1., 0, 0.), Vec3(0., 1, 0.), 2., 2.);
             s.translate(Vec3(0., 0., -2.));
             s.scale(Vec3(4., 8., 1.));
             s.rotate_x(90);
             s.translate(Vec3(0.,3.,-12.75));
             s.build_arrays();
-            s.material.diffuse_material = Vec3( 0.8 );
-            s.material.specular_material = Vec3( 1.0,1.0,1.0 );
-            s.material.shininess = 16;
+            material.diffuse_material = Vec3( 0.8 );
+            material.specular_material = Vec3( 1.0,1.0,1.0 );
+            material.shininess = 16;
         }
         { //Pool right wall
             squares.resize( squares.size() + 1 );
             Square & s = squares[squares.size() - 1];
+            Material & material = new_material(s);
             s.setQuad(Vec3(-1., -0.2, 0.), Vec3(1., 0, 0.), Vec3(0., 1, 0.), 2., 2.);
             s.translate(Vec3(0., 0., -2.));
             s.scale(Vec3(0.5, 8., 1.));
@@ -1455,18 +1702,19 @@ s.material.texture_scale_y = 100.;
             s.rotate_z(90);
             s.translate(Vec3(2.,-2.5,0.));
             s.build_arrays();
-            s.material.diffuse_material = Vec3( 0.1,0.5,0.1 );
-            s.material.specular_material = Vec3( 1.0,1.0,1.0 );
-            s.material.shininess = 16;
-            s.material.texture_type = Texture_Image;
-            s.material.texture_scale_x = 0.25;
-            s.material.texture_scale_y = 2.;
-            s.material.set_texture(&textures[pool_tiles_texture]);
-            s.material.set_normals(&normals[pool_tiles_normal]);
+            material.diffuse_material = Vec3( 0.1,0.5,0.1 );
+            material.specular_material = Vec3( 1.0,1.0,1.0 );
+            material.shininess = 16;
+            material.texture_type = Texture_Image;
+            material.texture_scale_x = 0.25;
+            material.texture_scale_y = 2.;
+            material.set_texture(textures[pool_tiles_texture].get());
+            material.set_normals(normals[pool_tiles_normal].get());
         }
         { //Pool right upper wall
             squares.resize( squares.size() + 1 );
             Square & s = squares[squares.size() - 1];
+            Material & material = new_material(s);
             s.setQuad(Vec3(-1., -0.2, 0.), Vec3(1., 0, 0.), Vec3(0., 1, 0.), 2., 2.);
             s.translate(Vec3(0., 0., -2.));
             s.scale(Vec3(2., 8., 1.));
@@ -1474,18 +1722,19 @@ s.material.texture_scale_y = 100.;
             s.rotate_z(90);
             s.translate(Vec3(2.,4.,0.));
             s.build_arrays();
-            s.material.diffuse_material = Vec3( 0.1,0.5,0.1 );
-            s.material.specular_material = Vec3( 1.0,1.0,1.0 );
-            s.material.shininess = 16;
-            s.material.texture_type = Texture_Image;
-            s.material.texture_scale_x = 1.;
-            s.material.texture_scale_y = 2.;
-            s.material.set_texture(&textures[pool_tiles_texture]);
-            s.material.set_normals(&normals[pool_tiles_normal]);
+            material.diffuse_material = Vec3( 0.1,0.5,0.1 );
+            material.specular_material = Vec3( 1.0,1.0,1.0 );
+            material.shininess = 16;
+            material.texture_type = Texture_Image;
+            material.texture_scale_x = 1.;
+            material.texture_scale_y = 2.;
+            material.set_texture(textures[pool_tiles_texture].get());
+            material.set_normals(normals[pool_tiles_normal].get());
         }
         { //Pool left wall
             squares.resize( squares.size() + 1 );
             Square & s = squares[squares.size() - 1];
+            Material & material = new_material(s);
             s.setQuad(Vec3(-1., -0.2, 0.), Vec3(1., 0, 0.), Vec3(0., 1, 0.), 2., 2.);
             s.translate(Vec3(0., 0., -2.));
             s.scale(Vec3(2., 8., 1.));
@@ -1493,18 +1742,19 @@ s.material.texture_scale_y = 100.;
             s.rotate_z(-90);
             s.translate(Vec3(-2.,4.,0.));
             s.build_arrays();
-            s.material.diffuse_material = Vec3( 0.1,0.5,0.1 );
-            s.material.specular_material = Vec3( 1.0,1.0,1.0 );
-            s.material.shininess = 16;
-            s.material.texture_type = Texture_Image;
-            s.material.texture_scale_x = 1.;
-            s.material.texture_scale_y = 2.;
-            s.material.set_texture(&textures[pool_tiles_texture]);
-            s.material.set_normals(&normals[pool_tiles_normal]);
+            material.diffuse_material = Vec3( 0.1,0.5,0.1 );
+            material.specular_material = Vec3( 1.0,1.0,1.0 );
+            material.shininess = 16;
+            material.texture_type = Texture_Image;
+            material.texture_scale_x = 1.;
+            material.texture_scale_y = 2.;
+            material.set_texture(textures[pool_tiles_texture].get());
+            material.set_normals(normals[pool_tiles_normal].get());
         }
         { //Pool right upper wall
             squares.resize( squares.size() + 1 );
             Square & s = squares[squares.size() - 1];
+            Material & material = new_material(s);
             s.setQuad(Vec3(-1., -0.2, 0.), Vec3(1., 0, 0.), Vec3(0., 1, 0.), 2., 2.);
             s.translate(Vec3(0., 0., -2.));
             s.scale(Vec3(0.5, 8., 1.));
@@ -1512,312 +1762,330 @@ s.material.texture_scale_y = 100.;
             s.rotate_z(-90);
             s.translate(Vec3(-2.,-2.5,0.));
             s.build_arrays();
-            s.material.diffuse_material = Vec3( 0.1,0.5,0.1 );
-            s.material.specular_material = Vec3( 1.0,1.0,1.0 );
-            s.material.shininess = 16;
-            s.material.texture_type = Texture_Image;
-            s.material.texture_scale_x = 0.25;
-            s.material.texture_scale_y = 2.;
-            s.material.set_texture(&textures[pool_tiles_texture]);
-            s.material.set_normals(&normals[pool_tiles_normal]);
+            material.diffuse_material = Vec3( 0.1,0.5,0.1 );
+            material.specular_material = Vec3( 1.0,1.0,1.0 );
+            material.shininess = 16;
+            material.texture_type = Texture_Image;
+            material.texture_scale_x = 0.25;
+            material.texture_scale_y = 2.;
+            material.set_texture(textures[pool_tiles_texture].get());
+            material.set_normals(normals[pool_tiles_normal].get());
         }
         { //Pool right upper floor
             squares.resize( squares.size() + 1 );
             Square & s = squares[squares.size() - 1];
+            Material & material = new_material(s);
             s.setQuad(Vec3(-1., -0.2, 0.), Vec3(1., 0, 0.), Vec3(0., 1, 0.), 2., 2.);
             s.translate(Vec3(0., 0., -2.));
             s.scale(Vec3(1., 8., 1.));
             s.rotate_x(-90);
             s.translate(Vec3(5.,0.,0.));
             s.build_arrays();
-            s.material.diffuse_material = Vec3( 0.1,0.5,0.1 );
-            s.material.specular_material = Vec3( 1.0,1.0,1.0 );
-            s.material.shininess = 16;
-            s.material.texture_type = Texture_Image;
-            s.material.texture_scale_x = 1.;
-            s.material.texture_scale_y = 2.;
-            s.material.set_texture(&textures[pool_tiles_texture]);
-            s.material.set_normals(&normals[pool_tiles_normal]);
+            material.diffuse_material = Vec3( 0.1,0.5,0.1 );
+            material.specular_material = Vec3( 1.0,1.0,1.0 );
+            material.shininess = 16;
+            material.texture_type = Texture_Image;
+            material.texture_scale_x = 1.;
+            material.texture_scale_y = 2.;
+            material.set_texture(textures[pool_tiles_texture].get());
+            material.set_normals(normals[pool_tiles_normal].get());
         }
 
         { //Pool right upper ceil
             squares.resize( squares.size() + 1 );
             Square & s = squares[squares.size() - 1];
+            Material & material = new_material(s);
             s.setQuad(Vec3(-1., -0.2, 0.), Vec3(1., 0, 0.), Vec3(0., 1, 0.), 2., 2.);
             s.translate(Vec3(0., 0., -2.));
             s.scale(Vec3(1., 8., 1.));
             s.rotate_x(90);
             s.translate(Vec3(5.,0.,-12.75));
             s.build_arrays();
-            s.material.diffuse_material = Vec3( 0.1,0.5,0.1 );
-            s.material.specular_material = Vec3( 1.0,1.0,1.0 );
-            s.material.shininess = 16;
-            s.material.texture_type = Texture_Image;
-            s.material.texture_scale_x = 1.;
-            s.material.texture_scale_y = 2.;
-            s.material.set_texture(&textures[pool_tiles_texture]);
-            s.material.set_normals(&normals[pool_tiles_normal]);
+            material.diffuse_material = Vec3( 0.1,0.5,0.1 );
+            material.specular_material = Vec3( 1.0,1.0,1.0 );
+            material.shininess = 16;
+            material.texture_type = Texture_Image;
+            material.texture_scale_x = 1.;
+            material.texture_scale_y = 2.;
+            material.set_texture(textures[pool_tiles_texture].get());
+            material.set_normals(normals[pool_tiles_normal].get());
         }
 
         { //Pool left upper floor
             squares.resize( squares.size() + 1 );
             Square & s = squares[squares.size() - 1];
+            Material & material = new_material(s);
             s.setQuad(Vec3(-1., -0.2, 0.), Vec3(1., 0, 0.), Vec3(0., 1, 0.), 2., 2.);
             s.translate(Vec3(0., 0., -2.));
             s.scale(Vec3(1., 8., 1.));
             s.rotate_x(-90);
             s.translate(Vec3(-5.,0.,0.));
             s.build_arrays();
-            s.material.diffuse_material = Vec3( 0.1,0.5,0.1 );
-            s.material.specular_material = Vec3( 1.0,1.0,1.0 );
-            s.material.shininess = 16;
-            s.material.texture_type = Texture_Image;
-            s.material.texture_scale_x = 1.;
-            s.material.texture_scale_y = 2.;
-            s.material.set_texture(&textures[pool_tiles_texture]);
-            s.material.set_normals(&normals[pool_tiles_normal]);
+            material.diffuse_material = Vec3( 0.1,0.5,0.1 );
+            material.specular_material = Vec3( 1.0,1.0,1.0 );
+            material.shininess = 16;
+            material.texture_type = Texture_Image;
+            material.texture_scale_x = 1.;
+            material.texture_scale_y = 2.;
+            material.set_texture(textures[pool_tiles_texture].get());
+            material.set_normals(normals[pool_tiles_normal].get());
         }
 
         { //Pool right upper ceil
             squares.resize( squares.size() + 1 );
             Square & s = squares[squares.size() - 1];
+            Material & material = new_material(s);
             s.setQuad(Vec3(-1., -0.2, 0.), Vec3(1., 0, 0.), Vec3(0., 1, 0.), 2., 2.);
             s.translate(Vec3(0., 0., -2.));
             s.scale(Vec3(1., 8., 1.));
             s.rotate_x(90);
             s.translate(Vec3(5.,0.,-12.75));
             s.build_arrays();
-            s.material.diffuse_material = Vec3( 0.1,0.5,0.1 );
-            s.material.specular_material = Vec3( 1.0,1.0,1.0 );
-            s.material.shininess = 16;
-            s.material.texture_type = Texture_Image;
-            s.material.texture_scale_x = 1.;
-            s.material.texture_scale_y = 2.;
-            s.material.set_texture(&textures[pool_tiles_texture]);
-            s.material.set_normals(&normals[pool_tiles_normal]);
+            material.diffuse_material = Vec3( 0.1,0.5,0.1 );
+            material.specular_material = Vec3( 1.0,1.0,1.0 );
+            material.shininess = 16;
+            material.texture_type = Texture_Image;
+            material.texture_scale_x = 1.;
+            material.texture_scale_y = 2.;
+            material.set_texture(textures[pool_tiles_texture].get());
+            material.set_normals(normals[pool_tiles_normal].get());
         }
 
         { //Pool left upper ceil
             squares.resize( squares.size() + 1 );
             Square & s = squares[squares.size() - 1];
+            Material & material = new_material(s);
             s.setQuad(Vec3(-1., -0.2, 0.), Vec3(1., 0, 0.), Vec3(0., 1, 0.), 2., 2.);
             s.translate(Vec3(0., 0., -2.));
             s.scale(Vec3(1., 8., 1.));
             s.rotate_x(90);
             s.translate(Vec3(-5.,0.,-12.75));
             s.build_arrays();
-            s.material.diffuse_material = Vec3( 0.1,0.5,0.1 );
-            s.material.specular_material = Vec3( 1.0,1.0,1.0 );
-            s.material.shininess = 16;
-            s.material.texture_type = Texture_Image;
-            s.material.texture_scale_x = 1.;
-            s.material.texture_scale_y = 2.;
-            s.material.set_texture(&textures[pool_tiles_texture]);
-            s.material.set_normals(&normals[pool_tiles_normal]);
+            material.diffuse_material = Vec3( 0.1,0.5,0.1 );
+            material.specular_material = Vec3( 1.0,1.0,1.0 );
+            material.shininess = 16;
+            material.texture_type = Texture_Image;
+            material.texture_scale_x = 1.;
+            material.texture_scale_y = 2.;
+            material.set_texture(textures[pool_tiles_texture].get());
+            material.set_normals(normals[pool_tiles_normal].get());
         }
         { //Pool right middle wall
             squares.resize( squares.size() + 1 );
             Square & s = squares[squares.size() - 1];
+            Material & material = new_material(s);
             s.setQuad(Vec3(-1., -0.2, 0.), Vec3(1., 0, 0.), Vec3(0., 1, 0.), 2., 2.);
             s.translate(Vec3(0., 0., -2.));
             s.scale(Vec3(8., 2., 1.));
             s.rotate_y(-90);
             s.translate(Vec3(4.,-1.6,-6.4));
             s.build_arrays();
-            s.material.diffuse_material = Vec3( 0.1,0.5,0.1 );
-            s.material.specular_material = Vec3( 1.0,1.0,1.0 );
-            s.material.shininess = 16;
-            s.material.texture_type = Texture_Image;
-            s.material.texture_scale_x = 2.;
-            s.material.texture_scale_y = 1.;
-            s.material.set_texture(&textures[pool_tiles_texture]);
-            s.material.set_normals(&normals[pool_tiles_normal]);
+            material.diffuse_material = Vec3( 0.1,0.5,0.1 );
+            material.specular_material = Vec3( 1.0,1.0,1.0 );
+            material.shininess = 16;
+            material.texture_type = Texture_Image;
+            material.texture_scale_x = 2.;
+            material.texture_scale_y = 1.;
+            material.set_texture(textures[pool_tiles_texture].get());
+            material.set_normals(normals[pool_tiles_normal].get());
         }
         { //Pool right middle wall light 1
             squares.resize( squares.size() + 1 );
             Square & s = squares[squares.size() - 1];
+            Material & material = new_material(s);
             s.setQuad(Vec3(-1., -0.2, 0.), Vec3(1., 0, 0.), Vec3(0., 1, 0.), 2., 2.);
             s.translate(Vec3(0., 0., -2.));
             s.scale(Vec3(0.5, 0.5, 1.));
             s.rotate_y(-90);
             s.translate(Vec3(3.95,0.9,-0.75));
             s.build_arrays();
-            s.material.diffuse_material = Vec3( 1. );
-            s.material.specular_material = Vec3( 1.0,1.0,1.0 );
-            s.material.shininess = 16;
-            s.material.emissive = true;
-            s.material.light_intensity = lights_intensity;
-            s.material.light_color = Vec3(1.);
+            material.diffuse_material = Vec3( 1. );
+            material.specular_material = Vec3( 1.0,1.0,1.0 );
+            material.shininess = 16;
+            material.emissive = true;
+            material.light_intensity = lights_intensity;
+            material.light_color = Vec3(1.);
         }
         { //Pool right middle wall light 2
             squares.resize( squares.size() + 1 );
             Square & s = squares[squares.size() - 1];
+            Material & material = new_material(s);
             s.setQuad(Vec3(-1., -0.2, 0.), Vec3(1., 0, 0.), Vec3(0., 1, 0.), 2., 2.);
             s.translate(Vec3(0., 0., -2.));
             s.scale(Vec3(0.5, 0.5, 1.));
             s.rotate_y(-90);
             s.translate(Vec3(3.95,0.9,-4.75));
             s.build_arrays();
-            s.material.diffuse_material = Vec3( 1. );
-            s.material.specular_material = Vec3( 1.0,1.0,1.0 );
-            s.material.shininess = 16;
-            s.material.emissive = true;
-            s.material.light_intensity = lights_intensity;
-            s.material.light_color = Vec3(1.);
+            material.diffuse_material = Vec3( 1. );
+            material.specular_material = Vec3( 1.0,1.0,1.0 );
+            material.shininess = 16;
+            material.emissive = true;
+            material.light_intensity = lights_intensity;
+            material.light_color = Vec3(1.);
         }
         { //Pool right middle wall light 3
             squares.resize( squares.size() + 1 );
             Square & s = squares[squares.size() - 1];
+            Material & material = new_material(s);
             s.setQuad(Vec3(-1., -0.2, 0.), Vec3(1., 0, 0.), Vec3(0., 1, 0.), 2., 2.);
             s.translate(Vec3(0., 0., -2.));
             s.scale(Vec3(0.5, 0.5, 1.));
             s.rotate_y(-90);
             s.translate(Vec3(3.95,0.9,-8.75));
             s.build_arrays();
-            s.material.diffuse_material = Vec3( 1. );
-            s.material.specular_material = Vec3( 1.0,1.0,1.0 );
-            s.material.shininess = 16;
-            s.material.emissive = true;
-            s.material.light_intensity = lights_intensity;
-            s.material.light_color = Vec3(1.);
+            material.diffuse_material = Vec3( 1. );
+            material.specular_material = Vec3( 1.0,1.0,1.0 );
+            material.shininess = 16;
+            material.emissive = true;
+            material.light_intensity = lights_intensity;
+            material.light_color = Vec3(1.);
         }
         { //Pool right middle wall light 3
             squares.resize( squares.size() + 1 );
             Square & s = squares[squares.size() - 1];
+            Material & material = new_material(s);
             s.setQuad(Vec3(-1., -0.2, 0.), Vec3(1., 0, 0.), Vec3(0., 1, 0.), 2., 2.);
             s.translate(Vec3(0., 0., -2.));
             s.scale(Vec3(0.5, 0.5, 1.));
             s.rotate_y(-90);
             s.translate(Vec3(3.95,0.9,-12.75));
             s.build_arrays();
-            s.material.diffuse_material = Vec3( 1. );
-            s.material.specular_material = Vec3( 1.0,1.0,1.0 );
-            s.material.shininess = 16;
-            s.material.emissive = true;
-            s.material.light_intensity = lights_intensity;
-            s.material.light_color = Vec3(1.);
+            material.diffuse_material = Vec3( 1. );
+            material.specular_material = Vec3( 1.0,1.0,1.0 );
+            material.shininess = 16;
+            material.emissive = true;
+            material.light_intensity = lights_intensity;
+            material.light_color = Vec3(1.);
         }
         { //Pool left middle wall
             squares.resize( squares.size() + 1 );
             Square & s = squares[squares.size() - 1];
+            Material & material = new_material(s);
             s.setQuad(Vec3(-1., -0.2, 0.), Vec3(1., 0, 0.), Vec3(0., 1, 0.), 2., 2.);
             s.translate(Vec3(0., 0., -2.));
             s.scale(Vec3(8., 2., 1.));
             s.rotate_y(90);
             s.translate(Vec3(-4.,-1.6,-6.4));
             s.build_arrays();
-            s.material.diffuse_material = Vec3( 0.1,0.5,0.1 );
-            s.material.specular_material = Vec3( 1.0,1.0,1.0 );
-            s.material.shininess = 16;
-            s.material.texture_type = Texture_Image;
-            s.material.texture_scale_x = 2.;
-            s.material.texture_scale_y = 1.;
-            s.material.set_texture(&textures[pool_tiles_texture]);
-            s.material.set_normals(&normals[pool_tiles_normal]);
+            material.diffuse_material = Vec3( 0.1,0.5,0.1 );
+            material.specular_material = Vec3( 1.0,1.0,1.0 );
+            material.shininess = 16;
+            material.texture_type = Texture_Image;
+            material.texture_scale_x = 2.;
+            material.texture_scale_y = 1.;
+            material.set_texture(textures[pool_tiles_texture].get());
+            material.set_normals(normals[pool_tiles_normal].get());
         }
         { //Pool left middle wall light 1
             squares.resize( squares.size() + 1 );
             Square & s = squares[squares.size() - 1];
+            Material & material = new_material(s);
             s.setQuad(Vec3(-1., -0.2, 0.), Vec3(1., 0, 0.), Vec3(0., 1, 0.), 2., 2.);
             s.translate(Vec3(0., 0., -2.));
             s.scale(Vec3(0.5, 0.5, 1.));
             s.rotate_y(90);
             s.translate(Vec3(-3.95,0.8,-0.75));
             s.build_arrays();
-            s.material.diffuse_material = Vec3( 1. );
-            s.material.specular_material = Vec3( 1.0,1.0,1.0 );
-            s.material.shininess = 16;
-            s.material.emissive = true;
-            s.material.light_intensity = lights_intensity;
-            s.material.light_color = Vec3(1.);
+            material.diffuse_material = Vec3( 1. );
+            material.specular_material = Vec3( 1.0,1.0,1.0 );
+            material.shininess = 16;
+            material.emissive = true;
+            material.light_intensity = lights_intensity;
+            material.light_color = Vec3(1.);
         }
         { //Pool left middle wall light 1
             squares.resize( squares.size() + 1 );
             Square & s = squares[squares.size() - 1];
+            Material & material = new_material(s);
             s.setQuad(Vec3(-1., -0.2, 0.), Vec3(1., 0, 0.), Vec3(0., 1, 0.), 2., 2.);
             s.translate(Vec3(0., 0., -2.));
             s.scale(Vec3(0.5, 0.5, 1.));
             s.rotate_y(90);
             s.translate(Vec3(-3.95,0.8,-4.75));
             s.build_arrays();
-            s.material.diffuse_material = Vec3( 1. );
-            s.material.specular_material = Vec3( 1.0,1.0,1.0 );
-            s.material.shininess = 16;
-            s.material.emissive = true;
-            s.material.light_intensity = lights_intensity;
-            s.material.light_color = Vec3(1.);
+            material.diffuse_material = Vec3( 1. );
+            material.specular_material = Vec3( 1.0,1.0,1.0 );
+            material.shininess = 16;
+            material.emissive = true;
+            material.light_intensity = lights_intensity;
+            material.light_color = Vec3(1.);
         }
         { //Pool left middle wall light 1
             squares.resize( squares.size() + 1 );
             Square & s = squares[squares.size() - 1];
+            Material & material = new_material(s);
             s.setQuad(Vec3(-1., -0.2, 0.), Vec3(1., 0, 0.), Vec3(0., 1, 0.), 2., 2.);
             s.translate(Vec3(0., 0., -2.));
             s.scale(Vec3(0.5, 0.5, 1.));
             s.rotate_y(90);
             s.translate(Vec3(-3.95,0.8,-8.75));
             s.build_arrays();
-            s.material.diffuse_material = Vec3( 1. );
-            s.material.specular_material = Vec3( 1.0,1.0,1.0 );
-            s.material.shininess = 16;
-            s.material.emissive = true;
-            s.material.light_intensity = lights_intensity;
-            s.material.light_color = Vec3(1.);
+            material.diffuse_material = Vec3( 1. );
+            material.specular_material = Vec3( 1.0,1.0,1.0 );
+            material.shininess = 16;
+            material.emissive = true;
+            material.light_intensity = lights_intensity;
+            material.light_color = Vec3(1.);
         }
         { //Pool left middle wall light 1
             squares.resize( squares.size() + 1 );
             Square & s = squares[squares.size() - 1];
+            Material & material = new_material(s);
             s.setQuad(Vec3(-1., -0.2, 0.), Vec3(1., 0, 0.), Vec3(0., 1, 0.), 2., 2.);
             s.translate(Vec3(0., 0., -2.));
             s.scale(Vec3(0.5, 0.5, 1.));
             s.rotate_y(90);
             s.translate(Vec3(-3.95,0.8,-12.75));
             s.build_arrays();
-            s.material.diffuse_material = Vec3( 1. );
-            s.material.specular_material = Vec3( 1.0,1.0,1.0 );
-            s.material.shininess = 16;
-            s.material.emissive = true;
-            s.material.light_intensity = lights_intensity;
-            s.material.light_color = Vec3(1.);
+            material.diffuse_material = Vec3( 1. );
+            material.specular_material = Vec3( 1.0,1.0,1.0 );
+            material.shininess = 16;
+            material.emissive = true;
+            material.light_intensity = lights_intensity;
+            material.light_color = Vec3(1.);
         }
         { //Pool front
             squares.resize( squares.size() + 1 );
             Square & s = squares[squares.size() - 1];
+            Material & material = new_material(s);
             s.setQuad(Vec3(-1., -0.2, 0.), Vec3(1., 0, 0.), Vec3(0., 1, 0.), 2., 2.);
             s.translate(Vec3(0., 0., -2.));
             s.scale(Vec3(8., 8., 1.));
             s.rotate_x(-180);
             s.translate(Vec3(0.,4.,0.));
             s.build_arrays();
-            s.material.diffuse_material = Vec3( 0.1,0.5,0.1 );
-            s.material.specular_material = Vec3( 1.0,1.0,1.0 );
-            s.material.shininess = 16;
-            s.material.texture_type = Texture_Image;
-            s.material.texture_scale_x = 2.;
-            s.material.texture_scale_y = 2.;
-            s.material.set_texture(&textures[pool_tiles_texture]);
-            s.material.set_normals(&normals[pool_tiles_normal]);
+            material.diffuse_material = Vec3( 0.1,0.5,0.1 );
+            material.specular_material = Vec3( 1.0,1.0,1.0 );
+            material.shininess = 16;
+            material.texture_type = Texture_Image;
+            material.texture_scale_x = 2.;
+            material.texture_scale_y = 2.;
+            material.set_texture(textures[pool_tiles_texture].get());
+            material.set_normals(normals[pool_tiles_normal].get());
         }
 
         { //Pool back
             squares.resize( squares.size() + 1 );
             Square & s = squares[squares.size() - 1];
+            Material & material = new_material(s);
             s.setQuad(Vec3(-1., -0.2, 0.), Vec3(1., 0, 0.), Vec3(0., 1, 0.), 2., 2.);
             s.translate(Vec3(0., 0., -2.));
             s.scale(Vec3(8., 8., 1.));
             s.translate(Vec3(0.,-3.,-12.));
             s.build_arrays();
-            s.material.diffuse_material = Vec3( 0.1,0.5,0.1 );
-            s.material.specular_material = Vec3( 1.0,1.0,1.0 );
-            s.material.shininess = 16;
-            s.material.texture_type = Texture_Image;
-            s.material.texture_scale_x = 2.;
-            s.material.texture_scale_y = 2.;
-            s.material.set_texture(&textures[pool_tiles_texture]);
-            s.material.set_normals(&normals[pool_tiles_normal]);
+            material.diffuse_material = Vec3( 0.1,0.5,0.1 );
+            material.specular_material = Vec3( 1.0,1.0,1.0 );
+            material.shininess = 16;
+            material.texture_type = Texture_Image;
+            material.texture_scale_x = 2.;
+            material.texture_scale_y = 2.;
+            material.set_texture(textures[pool_tiles_texture].get());
+            material.set_normals(normals[pool_tiles_normal].get());
         }
         { // Flamingo
             meshes.resize( meshes.size() + 1 );
             Mesh & m = meshes[meshes.size() - 1];
+            Material & material = new_material(m);
             m.loadOFF("mesh/flamingo_float_colored.off");
             m.centerAndScaleToUnit();
             m.rotate_x(0);
@@ -1825,58 +2093,62 @@ s.material.texture_scale_y = 100.;
             m.translate(Vec3(-0.5, -1.35, -2.));
             m.scale(Vec3(1.8));
             m.build_arrays();
-            m.material.diffuse_material = Vec3( 237./255.,149./255., 218./255.);
-            m.material.specular_material = Vec3( 1. );
-            m.material.shininess = 6.;
+            material.diffuse_material = Vec3( 237./255.,149./255., 218./255.);
+            material.specular_material = Vec3( 1. );
+            material.shininess = 6.;
         }
         { // Flamingo eye
             spheres.resize( spheres.size() + 1 );
             Sphere & s = spheres[spheres.size() - 1];
+            Material & material = new_material(s);
             s.m_center = Vec3(0.05, -1.4, -3.1);
             s.m_radius = 0.05f;
             s.build_arrays();
-            s.material.type = Material_Diffuse_Blinn_Phong; 
-            s.material.diffuse_material = Vec3( 1. );
-            s.material.specular_material = Vec3(  1. );
-            s.material.shininess = 16;
+            material.type = Material_Diffuse_Blinn_Phong; 
+            material.diffuse_material = Vec3( 1. );
+            material.specular_material = Vec3(  1. );
+            material.shininess = 16;
         }
         { // Flamingo pupil
             spheres.resize( spheres.size() + 1 );
             Sphere & s = spheres[spheres.size() - 1];
+            Material & material = new_material(s);
             s.m_center = Vec3(0.05, -1.4, -3.05);
             s.m_radius = 0.01f;
             s.build_arrays();
-            s.material.type = Material_Diffuse_Blinn_Phong; 
-            s.material.diffuse_material = Vec3( 0. );
-            s.material.specular_material = Vec3(  0. );
-            s.material.shininess = 16;
+            material.type = Material_Diffuse_Blinn_Phong; 
+            material.diffuse_material = Vec3( 0. );
+            material.specular_material = Vec3(  0. );
+            material.shininess = 16;
         }
         { // Rubber duck
             meshes.resize( meshes.size() + 1 );
             Mesh & m = meshes[meshes.size() - 1];
+            Material & material = new_material(m);
             m.loadOFF("mesh/rubber_duck_colored.off");
             m.centerAndScaleToUnit();
             m.rotate_y(-35);
             m.translate(Vec3(2., -1.65, -2.));
             m.scale(Vec3(1.3));
             m.build_arrays();
-            m.material.diffuse_material = Vec3( 1.,1., 0.);
-            m.material.specular_material = Vec3( 1. );
-            m.material.shininess = 6.;
+            material.diffuse_material = Vec3( 1.,1., 0.);
+            material.specular_material = Vec3( 1. );
+            material.shininess = 6.;
         }
         { // Pool ladder
             meshes.resize( meshes.size() + 1 );
             Mesh & m = meshes[meshes.size() - 1];
+            Material & material = new_material(m);
             m.loadOFF("mesh/pool_ladder.off");
             m.centerAndScaleToUnit();
             m.rotate_y(90);
             m.translate(Vec3(-3., -1.445, -3.));
             m.scale(Vec3(1.3));
             m.build_arrays();
-            m.material.type = Material_Mirror;
-            m.material.diffuse_material = Vec3( 0.5,0.5, 0.5);
-            m.material.specular_material = Vec3( 1. );
-            m.material.shininess = 6.;
+            material.type = Material_Mirror;
+            material.diffuse_material = Vec3( 0.5,0.5, 0.5);
+            material.specular_material = Vec3( 1. );
+            material.shininess = 6.;
         }
         computeKDTrees();
     }
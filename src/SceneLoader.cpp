@@ -0,0 +1,353 @@
+#include "Scene.h"
+#include "MappedFile.h"
+
+#include <charconv>
+#include <map>
+#include <algorithm>
+#include <string_view>
+
+// Scene description format, parsed in a single pass.
+// One statement per line : a keyword followed by properties ("name values..."), '#' starts a comment.
+// Transformations (translate, scale, rotate_x/y/z, center_unit) are applied in the order they appear.
+// Every primitive also accepts "motion x y z", its translation during the exposure (motion blur).
+//
+//   camera     translate 0 0 -3.1  zoom 3  rotate 0 30 0
+//   sky        dark | gradient
+//   skybox     img/textures/sky.ppm
+//   texture    brick img/planeTextures/brickwall.ppm
+//   normalmap  brick_n img/normalMaps/brickwall_normal.ppm
+//   material   wall  type diffuse  diffuse 1 1 1  specular 1 1 1  shininess 16  texture brick  normalmap brick_n
+//              other properties : ambient r g b, index n, transparency t, checker r g b r g b,
+//              texture_scale sx sy, emissive r g b intensity ; type is diffuse, glass or mirror
+//   light      position -5 5 5  radius 2.5  color 1 1 1  power 2
+//   sphere     center 0 0 0  radius 1  material wall  motion 0 1 0
+//   square     corner -1 -1 0  right 1 0 0  up 0 1 0  size 2 2  uv 0 1 0 1  translate 0 0 -2  material wall
+//   mesh       mesh/flamingo.off  scale 2.5  rotate_x 90  translate 0 1 -8  material wall
+//
+// Animation (rendered by ./render --sequence) : keys at given frames, linear in between.
+// Camera keys start from the camera statement, mesh keys move the n-th mesh statement (from 0) rigidly from its
+// placement above (see Mesh::place).
+//   frames     48
+//   camera_key 47  translate 0 0 -3.1  zoom 3  rotate 0 90 0
+//   animate    0 47  translate 0 0.5 0  rotate 0 360 0
+
+namespace {
+
+struct Parser {
+    const char *p;
+    const char *end;
+    const std::string &filename;
+    unsigned int line;
+    bool ok; // false once the current statement has an error
+    unsigned int errors;
+
+    Parser(const char *begin, const char *end, const std::string &filename) : p(begin), end(end), filename(filename), line(1), ok(true), errors(0) {}
+
+    void error(const std::string &message) {
+        if (ok) {
+            std::cout << filename << ":" << line << ": " << message << std::endl;
+            errors++;
+        }
+        ok = false;
+    }
+
+    void skip_blanks() {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) p++;
+        if (p < end && *p == '#') {
+            while (p < end && *p != '\n') p++;
+        }
+    }
+
+    bool at_line_end() {
+        skip_blanks();
+        return p >= end || *p == '\n';
+    }
+
+    void next_line() {
+        while (p < end && *p != '\n') p++;
+        if (p < end) p++;
+        line++;
+        ok = true;
+    }
+
+    bool word(std::string_view &w) {
+        if (at_line_end()) return false;
+        const char *start = p;
+        while (p < end && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n' && *p != '#') p++;
+        w = std::string_view(start, p - start);
+        return true;
+    }
+
+    bool number(float &f) {
+        if (at_line_end()) {
+            error("expected a number");
+            return false;
+        }
+        const char *start = p;
+        if (p < end && *p == '+') start = ++p;
+        std::from_chars_result res = std::from_chars(start, end, f);
+        if (res.ec != std::errc() || (res.ptr < end && *res.ptr != ' ' && *res.ptr != '\t' && *res.ptr != '\r' && *res.ptr != '\n' && *res.ptr != '#')) {
+            error("expected a number");
+            return false;
+        }
+        p = res.ptr;
+        return true;
+    }
+
+    // Reads up to 3 numbers, returns how many were read
+    int numbers(Vec3 &v) {
+        int n = 0;
+        while (n < 3) {
+            skip_blanks();
+            if (p >= end || !((*p >= '0' && *p <= '9') || *p == '-' || *p == '+' || *p == '.')) break;
+            if (!number(v[n])) return n;
+            n++;
+        }
+        return n;
+    }
+
+    bool vec3(Vec3 &v) {
+        if (numbers(v) != 3) {
+            error("expected 3 numbers");
+            return false;
+        }
+        return true;
+    }
+};
+
+// Applies the transformation named w to the mesh, returns false if w is not a transformation
+bool transform(Parser &parser, std::string_view w, Mesh &mesh) {
+    Vec3 v;
+    float f;
+    if (w == "translate") {
+        if (parser.vec3(v)) mesh.translate(v);
+    } else if (w == "scale") {
+        int n = parser.numbers(v);
+        if (n == 1) mesh.scale(Vec3(v[0]));
+        else if (n == 3) mesh.scale(v);
+        else parser.error("expected 1 or 3 numbers");
+    } else if (w == "rotate_x") {
+        if (parser.number(f)) mesh.rotate_x(f);
+    } else if (w == "rotate_y") {
+        if (parser.number(f)) mesh.rotate_y(f);
+    } else if (w == "rotate_z") {
+        if (parser.number(f)) mesh.rotate_z(f);
+    } else if (w == "center_unit") {
+        mesh.centerAndScaleToUnit();
+    } else {
+        return false;
+    }
+    return true;
+}
+
+}
+
+bool Scene::setup_from_file(const std::string &filename) {
+    clear();
+    skybox.reset();
+    dark_sky = true;
+
+    MappedFile file(filename);
+    if (!file.is_open()) {
+        std::cout << "Could not open file: " << filename << std::endl;
+        return false;
+    }
+
+    std::map<std::string, int, std::less<>> textureNames, normalNames;
+    std::map<std::string, unsigned int, std::less<>> materialNames;
+
+    Parser parser((const char *)file.data(), (const char *)file.data() + file.size(), filename);
+    for (; parser.p < parser.end; parser.next_line()) {
+        std::string_view keyword, w;
+        if (!parser.word(keyword)) continue;
+
+        if (keyword == "camera") {
+            camera.defined = true;
+            while (parser.ok && parser.word(w)) {
+                if (w == "translate") parser.vec3(camera.translation);
+                else if (w == "zoom") parser.number(camera.zoom);
+                else if (w == "rotate") parser.vec3(camera.rotation);
+                else parser.error("unknown camera property " + std::string(w));
+            }
+        } else if (keyword == "frames") {
+            float frames;
+            if (parser.number(frames)) animation.frames = std::max(frames, 0.f);
+        } else if (keyword == "camera_key") {
+            SceneCameraKey key;
+            key.camera = camera;
+            if (!parser.number(key.frame)) continue;
+            while (parser.ok && parser.word(w)) {
+                if (w == "translate") parser.vec3(key.camera.translation);
+                else if (w == "zoom") parser.number(key.camera.zoom);
+                else if (w == "rotate") parser.vec3(key.camera.rotation);
+                else parser.error("unknown camera property " + std::string(w));
+            }
+            if (parser.ok) animation.camera.push_back(key);
+        } else if (keyword == "animate") {
+            SceneMeshKey key;
+            float index;
+            if (!parser.number(index) || !parser.number(key.frame)) continue;
+            if (index < 0.f || index >= meshes.size()) {
+                parser.error("no mesh " + std::to_string((int)index) + " above");
+                continue;
+            }
+            key.mesh = (unsigned int)index;
+            key.translation = Vec3(0.);
+            key.rotation = Vec3(0.);
+            while (parser.ok && parser.word(w)) {
+                if (w == "translate") parser.vec3(key.translation);
+                else if (w == "rotate") parser.vec3(key.rotation);
+                else parser.error("unknown animation property " + std::string(w));
+            }
+            if (parser.ok) animation.meshes.push_back(key);
+        } else if (keyword == "sky") {
+            if (parser.word(w) && (w == "dark" || w == "gradient")) dark_sky = (w == "dark");
+            else parser.error("expected dark or gradient");
+        } else if (keyword == "skybox") {
+            if (parser.word(w)) loadSkybox(std::string(w));
+            else parser.error("expected a file name");
+        } else if (keyword == "texture" || keyword == "normalmap") {
+            std::string_view name, path;
+            if (!parser.word(name) || !parser.word(path)) {
+                parser.error("expected a name and a file name");
+            } else if (keyword == "texture") {
+                textureNames[std::string(name)] = load_texture(std::string(path));
+            } else {
+                normalNames[std::string(name)] = load_normal_map(std::string(path));
+            }
+        } else if (keyword == "material") {
+            std::string_view name;
+            if (!parser.word(name)) {
+                parser.error("expected a material name");
+                continue;
+            }
+            Material material;
+            while (parser.ok && parser.word(w)) {
+                if (w == "type") {
+                    std::string_view type;
+                    parser.word(type);
+                    if (type == "diffuse") material.type = Material_Diffuse_Blinn_Phong;
+                    else if (type == "glass") material.type = Material_Glass;
+                    else if (type == "mirror") material.type = Material_Mirror;
+                    else parser.error("unknown material type " + std::string(type));
+                }
+                else if (w == "ambient") parser.vec3(material.ambient_material);
+                else if (w == "diffuse") parser.vec3(material.diffuse_material);
+                else if (w == "specular") parser.vec3(material.specular_material);
+                else if (w == "shininess") {
+                    float f;
+                    if (parser.number(f)) material.shininess = f;
+                }
+                else if (w == "index") parser.number(material.index_medium);
+                else if (w == "transparency") parser.number(material.transparency);
+                else if (w == "checker") {
+                    material.texture_type = Texture_Checkerboard;
+                    parser.vec3(material.checkerboard_color1) && parser.vec3(material.checkerboard_color2);
+                }
+                else if (w == "texture_scale") parser.number(material.texture_scale_x) && parser.number(material.texture_scale_y);
+                else if (w == "emissive") {
+                    material.emissive = true;
+                    parser.vec3(material.light_color) && parser.number(material.light_intensity);
+                }
+                else if (w == "texture" || w == "normalmap") {
+                    std::string_view ref;
+                    parser.word(ref);
+                    std::map<std::string, int, std::less<>> &names = (w == "texture") ? textureNames : normalNames;
+                    auto it = names.find(ref);
+                    if (it == names.end()) parser.error("unknown " + std::string(w) + " " + std::string(ref));
+                    else if (w == "texture") {
+                        material.texture_type = Texture_Image;
+                        material.set_texture(textures[it->second].get());
+                    } else {
+                        material.set_normals(normals[it->second].get());
+                    }
+                }
+                else parser.error("unknown material property " + std::string(w));
+            }
+            materialNames[std::string(name)] = add_material(material);
+        } else if (keyword == "light") {
+            lights.resize( lights.size() + 1 );
+            Light & light = lights[lights.size() - 1];
+            light.pos = Vec3(0.);
+            light.radius = 1.5f;
+            light.powerCorrection = 2.f;
+            light.type = LightType_Spherical;
+            light.material = Vec3(1.);
+            light.isInCamSpace = false;
+            while (parser.ok && parser.word(w)) {
+                if (w == "position") parser.vec3(light.pos);
+                else if (w == "radius") parser.number(light.radius);
+                else if (w == "color") parser.vec3(light.material);
+                else if (w == "power") parser.number(light.powerCorrection);
+                else parser.error("unknown light property " + std::string(w));
+            }
+        } else if (keyword == "sphere" || keyword == "square" || keyword == "mesh") {
+            Mesh *mesh;
+            Sphere *sphere = nullptr;
+            Square *square = nullptr;
+            if (keyword == "sphere") {
+                spheres.resize( spheres.size() + 1 );
+                sphere = &spheres.back();
+                sphere->m_center = Vec3(0.);
+                sphere->m_radius = 1.f;
+                mesh = sphere;
+            } else if (keyword == "square") {
+                squares.resize( squares.size() + 1 );
+                square = &squares.back();
+                mesh = square;
+            } else {
+                std::string_view path;
+                if (!parser.word(path)) {
+                    parser.error("expected a file name");
+                    continue;
+                }
+                meshes.resize( meshes.size() + 1 );
+                mesh = &meshes.back();
+                mesh->loadOFF(std::string(path));
+            }
+
+            // The quad is set before the first transformation
+            Vec3 corner(-1., -1., 0.), right(1., 0., 0.), up(0., 1., 0.), size(2., 2., 0.);
+            float uv[4] = {0.f, 1.f, 0.f, 1.f};
+            bool quadSet = false;
+            while (parser.ok && parser.word(w)) {
+                if (square && !quadSet) {
+                    if (w == "corner") { parser.vec3(corner); continue; }
+                    if (w == "right") { parser.vec3(right); continue; }
+                    if (w == "up") { parser.vec3(up); continue; }
+                    if (w == "size") { parser.number(size[0]) && parser.number(size[1]); continue; }
+                    if (w == "uv") { parser.number(uv[0]) && parser.number(uv[1]) && parser.number(uv[2]) && parser.number(uv[3]); continue; }
+                }
+                if (sphere && w == "center") parser.vec3(sphere->m_center);
+                else if (sphere && w == "radius") parser.number(sphere->m_radius);
+                else if (w == "material") {
+                    std::string_view ref;
+                    parser.word(ref);
+                    auto it = materialNames.find(ref);
+                    if (it == materialNames.end()) parser.error("unknown material " + std::string(ref));
+                    else mesh->material_index = it->second;
+                } else if (w == "motion") {
+                    parser.vec3(mesh->motion_blur_translation);
+                } else if (sphere) {
+                    parser.error("unknown sphere property " + std::string(w));
+                } else {
+                    if (square && !quadSet) {
+                        square->setQuad(corner, right, up, size[0], size[1], uv[0], uv[1], uv[2], uv[3]);
+                        quadSet = true;
+                    }
+                    if (!transform(parser, w, *mesh)) parser.error("unknown property " + std::string(w));
+                }
+            }
+            if (square && !quadSet) square->setQuad(corner, right, up, size[0], size[1], uv[0], uv[1], uv[2], uv[3]);
+            mesh->build_arrays();
+        } else {
+            parser.error("unknown statement " + std::string(keyword));
+        }
+    }
+    std::stable_sort(animation.camera.begin(), animation.camera.end(), [](const SceneCameraKey &a, const SceneCameraKey &b) { return a.frame < b.frame; });
+    std::stable_sort(animation.meshes.begin(), animation.meshes.end(), [](const SceneMeshKey &a, const SceneMeshKey &b) {
+        return a.mesh != b.mesh ? a.mesh < b.mesh : a.frame < b.frame;
+    });
+    computeKDTrees();
+    return parser.errors == 0;
+}
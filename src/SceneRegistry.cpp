@@ -0,0 +1,110 @@
+#include "SceneRegistry.h"
+#include "Trace.h"
+
+#include <chrono>
+#include <iostream>
+
+SceneRegistry::~SceneRegistry() {
+    // Background builds use the entries, wait for them
+    for (unsigned int i = 0; i < entries.size(); i++) {
+        std::shared_future<void> build;
+        {
+            std::lock_guard<std::mutex> lock(entries[i]->mutex);
+            build = entries[i]->build;
+        }
+        if (build.valid()) build.wait();
+    }
+}
+
+unsigned int SceneRegistry::add(const std::string &name, Factory factory) {
+    entries.emplace_back(new Entry());
+    entries.back()->name = name;
+    entries.back()->factory = factory;
+    return entries.size() - 1;
+}
+
+std::shared_future<void> SceneRegistry::request(unsigned int index, std::launch policy) {
+    Entry *entry = entries[index].get();
+    std::lock_guard<std::mutex> lock(entry->mutex);
+    if (!entry->build.valid()) {
+        entry->build = std::async(policy, [entry]() {
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            TRACE_SPAN("scene setup", entry->name);
+            entry->factory(entry->scene);
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            std::cout << "Scene " << entry->name << " built in " << elapsed.count() << " seconds" << std::endl;
+        }).share();
+    }
+    return entry->build;
+}
+
+Scene & SceneRegistry::get(unsigned int index) {
+    // A deferred build runs here, a background one is waited for
+    request(index, std::launch::deferred).wait();
+    Entry *entry = entries[index].get();
+    std::map<std::string, float> parameters;
+    {
+        std::lock_guard<std::mutex> lock(entry->mutex);
+        parameters.swap(entry->parameters);
+    }
+    for (const auto &parameter : parameters) entry->scene.set_parameter(parameter.first, parameter.second);
+    return entry->scene;
+}
+
+void SceneRegistry::prebuild(unsigned int index) {
+    request(index, std::launch::async);
+}
+
+Scene & SceneRegistry::rebuild(unsigned int index) {
+    // A scene never requested is only built once, by get()
+    bool built = requested(index);
+    Scene & scene = get(index);
+    if (!built) return scene;
+    entries[index]->factory(scene);
+    for (const auto &parameter : parameters) scene.set_parameter(parameter.first, parameter.second);
+    return scene;
+}
+
+void SceneRegistry::set_parameter(const std::string &name, float value) {
+    parameters[name] = value;
+    for (unsigned int i = 0; i < entries.size(); i++) {
+        Entry *entry = entries[i].get();
+        bool built;
+        {
+            std::lock_guard<std::mutex> lock(entry->mutex);
+            // Never waits : a build still running (or deferred to get()) keeps the value for later
+            built = entry->build.valid() && entry->build.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+            if (!built) entry->parameters[name] = value;
+        }
+        if (built) entry->scene.set_parameter(name, value);
+    }
+}
+
+bool SceneRegistry::requested(unsigned int index) {
+    std::lock_guard<std::mutex> lock(entries[index]->mutex);
+    return entries[index]->build.valid();
+}
+
+unsigned int find_scene(SceneRegistry &scenes, const std::string &name) {
+    for (unsigned int i = 0; i < scenes.size(); i++) {
+        if (scenes.name(i) == name) return i;
+    }
+    if (name.size() > 6 && name.compare(name.size() - 6, 6, ".scene") == 0) {
+        return scenes.add(name, [name](Scene & s) { s.setup_from_file(name); });
+    }
+    return scenes.size();
+}
+
+void add_builtin_scenes(SceneRegistry &scenes, float aspect_ratio) {
+    scenes.add("single_sphere", [](Scene & s) { s.setup_single_sphere(); });
+    scenes.add("single_square", [](Scene & s) { s.setup_single_square(); });
+    scenes.add("cornell_box", [aspect_ratio](Scene & s) { s.setup_cornell_box(aspect_ratio); });
+    scenes.add("mesh", [](Scene & s) { s.setup_mesh(); });
+    scenes.add("rt_in_a_weekend", [](Scene & s) { s.setup_rt_in_a_weekend(); });
+    scenes.add("random_spheres", [](Scene & s) { s.setup_random_spheres(); });
+    scenes.add("debug_refraction", [](Scene & s) { s.setup_debug_refraction(); });
+    scenes.add("flamingo", [](Scene & s) { s.setup_flamingo(); });
+    scenes.add("raccoon", [](Scene & s) { s.setup_raccoon(); });
+    scenes.add("flamingo_pond", [](Scene & s) { s.setup_flamingo_pond(); });
+    scenes.add("backrooms_pool", [](Scene & s) { s.setup_backrooms_pool(); });
+}
@@ -0,0 +1,59 @@
+#ifndef SCENEREGISTRY_H
+#define SCENEREGISTRY_H
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <mutex>
+#include <future>
+#include <functional>
+#include <map>
+
+#include "Scene.h"
+
+// Scenes registered as factories, built on first use instead of all at startup.
+// prebuild() builds a scene on a background thread, get() waits for it if needed.
+// Parameter changes (see Scene::set_parameter) reach the built scenes at once and the others in get().
+class SceneRegistry {
+public:
+    typedef std::function<void(Scene &)> Factory;
+
+    ~SceneRegistry();
+
+    unsigned int add(const std::string &name, Factory factory);
+    unsigned int size() const { return entries.size(); }
+    const std::string & name(unsigned int index) const { return entries[index]->name; }
+
+    // Builds the scene on the calling thread if it was never requested
+    Scene & get(unsigned int index);
+    // Starts building the scene on a background thread if it was never requested
+    void prebuild(unsigned int index);
+    // Runs the factory again on the calling thread, then sets the parameters again (builds it like get() if it was never requested)
+    Scene & rebuild(unsigned int index);
+    bool requested(unsigned int index);
+    // Sets the parameter of the built scenes, the ones being built get it in get()
+    void set_parameter(const std::string &name, float value);
+
+private:
+    struct Entry {
+        std::string name;
+        Factory factory;
+        Scene scene;
+        std::mutex mutex;
+        std::shared_future<void> build;
+        std::map<std::string, float> parameters; // set while the scene was not built
+    };
+    std::vector< std::unique_ptr<Entry> > entries;
+    std::map<std::string, float> parameters; // all the values set, for rebuild
+
+    std::shared_future<void> request(unsigned int index, std::launch policy);
+};
+
+// The setup_* scenes of Scene.h, in the viewer's order. Later aspect ratios go through set_parameter.
+void add_builtin_scenes(SceneRegistry &scenes, float aspect_ratio);
+
+// Index of the scene registered as name. A scene file (name ending in .scene, see SceneLoader.cpp) is registered on
+// first use. size() if there is none.
+unsigned int find_scene(SceneRegistry &scenes, const std::string &name);
+
+#endif // SCENEREGISTRY_H
@@ -0,0 +1,119 @@
+#include "Skybox.h"
+#include "Constants.h"
+#include "RenderCounters.h"
+#include "Trace.h"
+
+#include <algorithm>
+#include <cmath>
+
+// atan2 within ~1e-5 rad, well under a texel of the skyboxes
+static inline float fast_atan2(float y, float x) {
+    float ax = fabsf(x), ay = fabsf(y);
+    float a = std::min(ax, ay) / std::max(std::max(ax, ay), 1e-30f);
+    float s = a * a;
+    float r = a * (0.99997726f + s * (-0.33262347f + s * (0.19354346f + s * (-0.11643287f + s * (0.05265332f + s * -0.01172120f)))));
+    if (ay > ax) r = 1.57079637f - r;
+    if (x < 0) r = 3.14159274f - r;
+    return y < 0 ? -r : r;
+}
+
+// (u, v) of the equirectangular map, asin(y) is computed as atan2(y, sqrt(x*x + z*z))
+static inline void direction_to_uv(const Vec3 &d, float &u, float &v) {
+    u = 0.5f + fast_atan2(d[2], d[0]) * (float)(0.5 / M_PI);
+    v = 0.5f - fast_atan2(d[1], sqrtf(d[0] * d[0] + d[2] * d[2])) * (float)(1. / M_PI);
+}
+
+void Skybox::load(const TextureHandle &texture) {
+    reset();
+    image = texture;
+    if (empty()) return;
+    TRACE_SPAN("skybox distribution");
+
+    unsigned int l = 0;
+    while (l + 1 < image->levels.size() && image->levels[l].w > SKYBOX_SAMPLING_WIDTH) l++;
+    const ppmLoader::ImageLevel &level = image->levels[l];
+    width = level.w;
+    height = level.h;
+
+    std::vector<float> weights(width * height);
+    std::vector<float> row_weights(height);
+    for (int y = 0; y < height; y++) {
+        float sin_theta = sinf(M_PI * (y + 0.5f) / height);
+        float sum = 0.f;
+        for (int x = 0; x < width; x++) {
+            const Vec3 &c = level.texels[y * width + x];
+            float w = (0.2126f * c[0] + 0.7152f * c[1] + 0.0722f * c[2]) * sin_theta;
+            weights[y * width + x] = w;
+            sum += w;
+        }
+        row_weights[y] = sum;
+    }
+    double total = 0.;
+    for (int y = 0; y < height; y++) total += row_weights[y];
+    if (total <= 0.) return;
+
+    marginal_cdf.resize(height + 1);
+    conditional_cdf.resize((width + 1) * height);
+    texel_pdf.resize(width * height);
+    double acc = 0.;
+    marginal_cdf[0] = 0.f;
+    for (int y = 0; y < height; y++) {
+        acc += row_weights[y];
+        marginal_cdf[y + 1] = acc / total;
+        float *cdf = &conditional_cdf[y * (width + 1)];
+        double row_acc = 0.;
+        cdf[0] = 0.f;
+        for (int x = 0; x < width; x++) {
+            row_acc += weights[y * width + x];
+            // Empty rows are never picked, a uniform cdf keeps them well formed
+            cdf[x + 1] = row_weights[y] > 0.f ? row_acc / row_weights[y] : (x + 1.f) / width;
+            texel_pdf[y * width + x] = weights[y * width + x] / total * width * height;
+        }
+    }
+}
+
+void Skybox::reset() {
+    image.reset();
+    width = height = 0;
+    marginal_cdf.clear();
+    conditional_cdf.clear();
+    texel_pdf.clear();
+}
+
+Vec3 Skybox::radiance(const Vec3 &direction) const {
+    RENDER_STAT(texture_lookups, 1);
+    float u, v;
+    direction_to_uv(direction, u, v);
+    const ppmLoader::ImageLevel &level = image->levels[0];
+    int x = std::min(int(u * level.w), level.w - 1);
+    int y = std::min(int(v * level.h), level.h - 1);
+    return level.texels[y * level.w + x];
+}
+
+Vec3 Skybox::sample(float r1, float r2, float &pdf) const {
+    // Row, then column in the row, and the position inside the texel from what is left of the random numbers
+    int y = std::upper_bound(marginal_cdf.begin() + 1, marginal_cdf.end() - 1, r1) - marginal_cdf.begin() - 1;
+    float dv = (r1 - marginal_cdf[y]) / std::max(marginal_cdf[y + 1] - marginal_cdf[y], 1e-30f);
+    const float *cdf = &conditional_cdf[y * (width + 1)];
+    int x = std::upper_bound(cdf + 1, cdf + width, r2) - cdf - 1;
+    float du = (r2 - cdf[x]) / std::max(cdf[x + 1] - cdf[x], 1e-30f);
+
+    float u = (x + std::min(du, 1.f)) / width;
+    float v = (y + std::min(dv, 1.f)) / height;
+    float phi = 2 * M_PI * (u - 0.5f);
+    float elevation = M_PI * (0.5f - v);
+    float cos_elevation = cosf(elevation);
+    // sin(theta) = cos(elevation), the jacobian of the uv -> sphere mapping is 2 pi^2 sin(theta)
+    pdf = cos_elevation > 0.f ? texel_pdf[y * width + x] / (2 * M_PI * M_PI * cos_elevation) : 0.f;
+    return Vec3(cos_elevation * cosf(phi), sinf(elevation), cos_elevation * sinf(phi));
+}
+
+float Skybox::pdf(const Vec3 &direction) const {
+    float u, v;
+    direction_to_uv(direction, u, v);
+    int x = std::min(int(u * width), width - 1);
+    int y = std::min(int(v * height), height - 1);
+    float sin_theta = sqrtf(direction[0] * direction[0] + direction[2] * direction[2]);
+    if (sin_theta <= 0.f) return 0.f;
+    return texel_pdf[y * width + x] / (2 * M_PI * M_PI * sin_theta);
+}
@@ -0,0 +1,35 @@
+#ifndef SKYBOX_H
+#define SKYBOX_H
+
+#include <vector>
+#include "Vec3.h"
+#include "TextureCache.h"
+
+// Equirectangular skybox : direction -> texel lookup, and importance sampling of the directions by luminance.
+// The distribution (marginal cdf over the rows, conditional cdf in each row) is built from a mip level at most
+// SKYBOX_SAMPLING_WIDTH wide, weighted by sin(theta) so that it is proportional to the radiance per solid angle.
+class Skybox {
+public:
+    Skybox() : width(0), height(0) {}
+
+    void load(const TextureHandle &texture);
+    void reset();
+
+    bool empty() const { return !image || image->levels.empty(); }
+    // False for black (or missing) images
+    bool can_sample() const { return !marginal_cdf.empty(); }
+
+    Vec3 radiance(const Vec3 &direction) const;
+    // Direction drawn with a probability proportional to the luminance, pdf per steradian. r1, r2 uniform in [0, 1)
+    Vec3 sample(float r1, float r2, float &pdf) const;
+    float pdf(const Vec3 &direction) const;
+
+private:
+    TextureHandle image;
+    int width, height; // of the sampling level
+    std::vector<float> marginal_cdf;    // height + 1
+    std::vector<float> conditional_cdf; // (width + 1) per row
+    std::vector<float> texel_pdf;       // width * height, density in uv space
+};
+
+#endif // SKYBOX_H
@@ -7,14 +7,13 @@
 #include "math.h"
 #include "Functions.h"
 #include "AABB.h"
+#include "Vec3A.h"
+#include <algorithm>
 
+// Only the distance : the surface is computed by Sphere::surface for the hit that is shaded
 struct RaySphereIntersection{
     bool intersectionExists;
     float t;
-    float theta,phi;
-    Vec3 intersection;
-    Vec3 secondintersection;
-    Vec3 normal;
 
     RaySphereIntersection() : intersectionExists(false) , t(FLT_MAX) {}
 };
@@ -48,9 +47,9 @@ public:
 
     void build_arrays(){
         unsigned int nTheta = 20 , nPhi = 20;
-        positions_array.resize(3 * nTheta * nPhi );
-        normalsArray.resize(3 * nTheta * nPhi );
-        uvs_array.resize(2 * nTheta * nPhi );
+        positions.resize(nTheta * nPhi );
+        normals.resize(nTheta * nPhi );
+        uvs.resize(2 * nTheta * nPhi );
         for( unsigned int thetaIt = 0 ; thetaIt < nTheta ; ++thetaIt ) {
             float u = (float)(thetaIt) / (float)(nTheta-1);
             float theta = u * 2 * M_PI;
@@ -59,39 +58,31 @@ public:
                 float v = (float)(phiIt) / (float)(nPhi-1);
                 float phi = - M_PI/2.0 + v * M_PI;
                 Vec3 xyz = SphericalCoordinatesToEuclidean( theta , phi );
-                positions_array[ 3 * vertexIndex + 0 ] = m_center[0] + m_radius * xyz[0];
-                positions_array[ 3 * vertexIndex + 1 ] = m_center[1] + m_radius * xyz[1];
-                positions_array[ 3 * vertexIndex + 2 ] = m_center[2] + m_radius * xyz[2];
-                normalsArray[ 3 * vertexIndex + 0 ] = xyz[0];
-                normalsArray[ 3 * vertexIndex + 1 ] = xyz[1];
-                normalsArray[ 3 * vertexIndex + 2 ] = xyz[2];
-                uvs_array[ 2 * vertexIndex + 0 ] = u;
-                uvs_array[ 2 * vertexIndex + 1 ] = v;
+                positions[ vertexIndex ] = m_center + m_radius * xyz;
+                normals[ vertexIndex ] = xyz;
+                uvs[ 2 * vertexIndex + 0 ] = u;
+                uvs[ 2 * vertexIndex + 1 ] = v;
             }
         }
-        triangles_array.clear();
+        triangles.clear();
         for( unsigned int thetaIt = 0 ; thetaIt < nTheta - 1 ; ++thetaIt ) {
             for( unsigned int phiIt = 0 ; phiIt < nPhi - 1 ; ++phiIt ) {
                 unsigned int vertexuv = thetaIt + phiIt * nTheta;
                 unsigned int vertexUv = thetaIt + 1 + phiIt * nTheta;
                 unsigned int vertexuV = thetaIt + (phiIt+1) * nTheta;
                 unsigned int vertexUV = thetaIt + 1 + (phiIt+1) * nTheta;
-                triangles_array.push_back( vertexuv );
-                triangles_array.push_back( vertexUv );
-                triangles_array.push_back( vertexUV );
-                triangles_array.push_back( vertexuv );
-                triangles_array.push_back( vertexUV );
-                triangles_array.push_back( vertexuV );
+                triangles.push_back( MeshTriangle( vertexuv , vertexUv , vertexUV ) );
+                triangles.push_back( MeshTriangle( vertexuv , vertexUV , vertexuV ) );
             }
         }
-        computeAABBFromPosArray();
+        computeAABB();
     }
 
     // TO DO add , float time = 0.f to each intersect function (square and sphere and mesh) for motion blur
     RaySphereIntersection intersect(const Ray &ray) const {
         RaySphereIntersection intersection;
         //TODO calcul l'intersection rayon sphere
-        Vec3 timed_center = m_center + (ray.time) * material.motion_blur_translation;
+        Vec3 timed_center = m_center + (ray.time) * motion_blur_translation;
         Vec3 o = ray.origin();
         Vec3 d = ray.direction();
         float t, t1;
@@ -121,14 +112,51 @@ public:
             intersection.t = FLT_MAX;
             return intersection;
         }
-        intersection.intersection = o + t*d;
-        intersection.normal = (intersection.intersection - timed_center);
-        intersection.normal.normalize();
         intersection.intersectionExists = true;
         intersection.t = t;
-        intersection.theta = acos(intersection.normal[1]*-1.);
-        intersection.phi = atan2(intersection.normal[2]*-1., intersection.normal[0]) + M_PI;
         return intersection;
     }
+
+    // Same test as intersect on spheres[0..count-1] (count <= 4), one per lane.
+    // Returns the mask of the lanes that hit, t is FLT_MAX for the others.
+    static int intersect4(const Ray &ray, const Sphere *spheres, unsigned int count, float t[4]) {
+        const Sphere &s0 = spheres[0];
+        const Sphere &s1 = spheres[std::min(1u, count - 1)];
+        const Sphere &s2 = spheres[std::min(2u, count - 1)];
+        const Sphere &s3 = spheres[std::min(3u, count - 1)];
+        __m128 time = _mm_set1_ps(ray.time);
+        Vec3x4 center = Vec3x4(s0.m_center, s1.m_center, s2.m_center, s3.m_center)
+                      + time * Vec3x4(s0.motion_blur_translation, s1.motion_blur_translation, s2.motion_blur_translation, s3.motion_blur_translation);
+        __m128 r = _mm_set_ps(s3.m_radius, s2.m_radius, s1.m_radius, s0.m_radius);
+        Vec3x4 d(ray.direction());
+        Vec3x4 oc = Vec3x4(ray.origin()) - center;
+
+        __m128 a = _mm_set1_ps(Vec3::dot(ray.direction(), ray.direction()));
+        __m128 b = _mm_mul_ps(_mm_set1_ps(2.f), Vec3x4::dot(d, oc));
+        __m128 c = _mm_sub_ps(Vec3x4::dot(oc, oc), _mm_mul_ps(r, r));
+        __m128 delta = _mm_sub_ps(_mm_mul_ps(b, b), _mm_mul_ps(_mm_set1_ps(4.f), _mm_mul_ps(a, c)));
+        __m128 valid = _mm_cmpge_ps(delta, _mm_setzero_ps());
+
+        __m128 sqrtDelta = _mm_sqrt_ps(_mm_max_ps(delta, _mm_setzero_ps()));
+        __m128 twoA = _mm_mul_ps(_mm_set1_ps(2.f), a);
+        __m128 tn = _mm_div_ps(_mm_sub_ps(_mm_sub_ps(_mm_setzero_ps(), b), sqrtDelta), twoA);
+        __m128 tf = _mm_div_ps(_mm_add_ps(_mm_sub_ps(_mm_setzero_ps(), b), sqrtDelta), twoA);
+        __m128 useFar = _mm_and_ps(_mm_cmpgt_ps(tf, _mm_set1_ps(EPSILON)), _mm_cmplt_ps(tf, tn));
+        __m128 tt = _mm_or_ps(_mm_and_ps(useFar, tf), _mm_andnot_ps(useFar, tn));
+        valid = _mm_and_ps(valid, _mm_cmpge_ps(tt, _mm_set1_ps(-EPSILON)));
+        valid = _mm_and_ps(valid, _mm_cmplt_ps(_mm_set_ps(3.f, 2.f, 1.f, 0.f), _mm_set1_ps((float)count)));
+        _mm_storeu_ps(t, _mm_or_ps(_mm_and_ps(valid, tt), _mm_andnot_ps(valid, _mm_set1_ps(FLT_MAX))));
+        return _mm_movemask_ps(valid);
+    }
+
+    // Point, normal and spherical coordinates where the ray hits the sphere at t
+    void surface(const Ray &ray, float t, Vec3 &position, Vec3 &normal, float &theta, float &phi) const {
+        Vec3 timed_center = m_center + (ray.time) * motion_blur_translation;
+        position = ray.origin() + t*ray.direction();
+        normal = position - timed_center;
+        normal.normalize();
+        theta = acos(normal[1]*-1.);
+        phi = atan2(normal[2]*-1., normal[0]) + M_PI;
+    }
 };
 #endif
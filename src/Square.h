@@ -6,12 +6,11 @@
 #include <cmath>
 #include "Functions.h"
 
+// Distance and uv only : the point and the normal are computed for the hit that is shaded
 struct RaySquareIntersection{
     bool intersectionExists;
     float t;
     float u,v;
-    Vec3 intersection;
-    Vec3 normal;
 
     RaySquareIntersection() : intersectionExists(false) , t(FLT_MAX) {}
 };
@@ -44,85 +43,76 @@ public:
         m_right_vector = m_right_vector*width;
         m_up_vector = m_up_vector*height;
 
-        vertices.clear();
-        vertices.resize(4);
-        vertices[0].position = bottomLeft;                                      vertices[0].u = uMin; vertices[0].v = vMin;
-        vertices[1].position = bottomLeft + m_right_vector;                     vertices[1].u = uMax; vertices[1].v = vMin;
-        vertices[2].position = bottomLeft + m_right_vector + m_up_vector;       vertices[2].u = uMax; vertices[2].v = vMax;
-        vertices[3].position = bottomLeft + m_up_vector;                        vertices[3].u = uMin; vertices[3].v = vMax;
-        vertices[0].normal = vertices[1].normal = vertices[2].normal = vertices[3].normal = m_normal;
-        triangles.clear();
+        positions.resize(4);
+        positions[0] = bottomLeft;
+        positions[1] = bottomLeft + m_right_vector;
+        positions[2] = bottomLeft + m_right_vector + m_up_vector;
+        positions[3] = bottomLeft + m_up_vector;
+        normals.assign(4, m_normal);
+        uvs = {uMin, vMin,  uMax, vMin,  uMax, vMax,  uMin, vMax};
         triangles.resize(2);
-        triangles[0][0] = 0;
-        triangles[0][1] = 1;
-        triangles[0][2] = 2;
-        triangles[1][0] = 0;
-        triangles[1][1] = 2;
-        triangles[1][2] = 3;
+        triangles[0] = MeshTriangle(0, 1, 2);
+        triangles[1] = MeshTriangle(0, 2, 3);
+        update_frame();
+    }
+
+    // Frame of the quad used by intersect, computed from the transformed vertices
+    void update_frame() {
+        Vec3 right = positions[1] - positions[0];
+        Vec3 up = positions[3] - positions[0];
+        m_origin = positions[0];
+        m_plane_normal = Vec3::cross(right, up);
+        m_plane_normal.normalize();
+        m_plane_distance = Vec3::dot(m_origin, m_plane_normal);
+        m_inv_width = 1.f / right.length();
+        m_inv_height = 1.f / up.length();
+        m_axis_u = right * m_inv_width;
+        m_axis_v = up * m_inv_height;
+    }
 
+    void build_arrays() {
+        Mesh::build_arrays();
+        update_frame();
     }
 
-    RaySquareIntersection intersect(const Ray &ray) const {
+    Vec3 const & normal() const { return m_plane_normal; }
+    // uv per unit of length along the right / up vectors
+    float inv_width() const { return m_inv_width; }
+    float inv_height() const { return m_inv_height; }
+
+    RaySquareIntersection intersect(const Ray &ray, bool cull_backfaces = true) const {
         RaySquareIntersection intersection;
 
-        Vec3 m_bottom_left = vertices[0].position + ray.time * material.motion_blur_translation;
-        Vec3 m_right_vector = vertices[1].position - vertices[0].position;
-        Vec3 m_up_vector = vertices[3].position - vertices[0].position;
-        Vec3 m_normal = Vec3::cross(m_right_vector, m_up_vector);
-        m_normal.normalize();
+        float dotRN = Vec3::dot(ray.direction(), m_plane_normal);
+        // Rayon parallèle, ou face arrière (backface culling)
+        if (dotRN == 0 || (dotRN > 0 && cull_backfaces)) return intersection;
 
-        //TODO calculer l'intersection rayon quad
-        float dotRN = Vec3::dot(ray.direction(), m_normal);
-        // Rayon parallèle
-        if (dotRN == 0) {
-            intersection.intersectionExists = false;
-            intersection.t = FLT_MAX;
-            return intersection;
-        }
-
-        // Backface culling
-        if (dotRN > 0 && material.type != Material_Glass) {
-            intersection.intersectionExists = false;
-            intersection.t = FLT_MAX;
-            return intersection;
-        }
-        
-        float D = Vec3::dot(m_bottom_left, m_normal);
-        float t = (D - Vec3::dot(ray.origin(), m_normal))/(dotRN);
+        // Le flou de mouvement translate le plan
+        Vec3 offset = ray.time * motion_blur_translation;
+        float D = m_plane_distance + Vec3::dot(offset, m_plane_normal);
+        float t = (D - Vec3::dot(ray.origin(), m_plane_normal))/(dotRN);
 
         // Intersection derrière la caméra
-        if (t < -EPSILON) {
-            intersection.intersectionExists = false;
-            intersection.t = FLT_MAX;
-            return intersection;
-        }
-
-        if (t >= EPSILON) {
-        
-            Vec3 p = ray.origin() + t*ray.direction();
-            Vec3 q = p - m_bottom_left;
-
-            // proj sur bottom left to right
-            float proj1 = Vec3::dot(q, m_right_vector) / m_right_vector.length();
-
-
-            // proj sur bottom left to up
-            float proj2 = Vec3::dot(q, m_up_vector) / m_up_vector.length();
-
-            if ((proj1 <= m_right_vector.length() && proj1 >= 0) && (proj2 <= m_up_vector.length() && proj2 >= 0)) {
-                intersection.intersectionExists = true;
-                intersection.t = t;
-                intersection.u = proj1 / m_right_vector.length();
-                intersection.v = proj2 / m_up_vector.length();
-                intersection.intersection = p;
-                intersection.normal = m_normal;
-                return intersection;
-            }
-
-        }
-        intersection.intersectionExists = false;
-        intersection.t = FLT_MAX;
+        if (t < EPSILON) return intersection;
+
+        Vec3 q = ray.origin() + t*ray.direction() - m_origin - offset;
+        float u = Vec3::dot(q, m_axis_u) * m_inv_width;
+        if (u < 0 || u > 1) return intersection;
+        float v = Vec3::dot(q, m_axis_v) * m_inv_height;
+        if (v < 0 || v > 1) return intersection;
+
+        intersection.intersectionExists = true;
+        intersection.t = t;
+        intersection.u = u;
+        intersection.v = v;
         return intersection;
     }
+
+private:
+    Vec3 m_origin;       // bottom left vertex
+    Vec3 m_axis_u, m_axis_v; // unit edge directions
+    float m_inv_width, m_inv_height;
+    Vec3 m_plane_normal;
+    float m_plane_distance;
 };
 #endif // SQUARE_H
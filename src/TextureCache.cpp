@@ -0,0 +1,40 @@
+#include "TextureCache.h"
+#include "Trace.h"
+
+#include <map>
+#include <mutex>
+#include <future>
+
+namespace TextureCache {
+
+// The lock only covers the lookup and insert : the first caller for a key loads it, the others wait on its future
+static std::mutex mutex;
+static std::map<std::pair<std::string, int>, std::shared_future<TextureHandle> > textures;
+
+TextureHandle get(const std::string &filename, ppmLoader::TextureFormat format) {
+    std::pair<std::string, int> key(filename, format);
+    std::promise<TextureHandle> promise;
+    std::shared_future<TextureHandle> loaded;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::map<std::pair<std::string, int>, std::shared_future<TextureHandle> >::iterator it = textures.find(key);
+        if (it != textures.end()) loaded = it->second;
+        else textures[key] = promise.get_future().share();
+    }
+    if (loaded.valid()) return loaded.get();
+
+    TRACE_SPAN("texture load", filename);
+    // Failed loads are kept too (empty image), so a missing file is only reported once
+    std::shared_ptr<ppmLoader::ImageRGB> img = std::make_shared<ppmLoader::ImageRGB>();
+    ppmLoader::map_ppm(*img, filename);
+    ppmLoader::build_texture(*img, format);
+    promise.set_value(img);
+    return img;
+}
+
+unsigned int size() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return textures.size();
+}
+
+}
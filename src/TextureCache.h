@@ -0,0 +1,19 @@
+#ifndef TEXTURECACHE_H
+#define TEXTURECACHE_H
+
+#include <string>
+#include <memory>
+#include "imageLoader.h"
+
+// Shared, immutable image. The cache keeps every image alive until the end of the process,
+// so raw pointers taken from a handle (Material::image, Material::normals) never dangle.
+typedef std::shared_ptr<const ppmLoader::ImageRGB> TextureHandle;
+
+// Process-wide texture cache keyed by path and format : each file is loaded (mapped) once, decoded with its mip pyramid,
+// and shared between scenes. Thread safe, scenes can be built concurrently.
+namespace TextureCache {
+    TextureHandle get(const std::string &filename, ppmLoader::TextureFormat format = ppmLoader::TextureFormat_Color);
+    unsigned int size();
+}
+
+#endif // TEXTURECACHE_H
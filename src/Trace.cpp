@@ -0,0 +1,99 @@
+#include "Trace.h"
+
+#include <atomic>
+#include <fstream>
+#include <mutex>
+#include <vector>
+
+namespace Trace {
+
+struct Event {
+    const char *name;
+    std::string detail;
+    unsigned int thread;
+    double begin_us, duration_us;
+};
+
+static std::atomic<bool> recording(false);
+static std::mutex mutex;
+static std::string output;
+static std::vector<Event> events;
+static std::chrono::steady_clock::time_point origin;
+
+// Small thread numbers, in order of first use, easier to read than the system ids
+static unsigned int thread_number() {
+    static std::atomic<unsigned int> next(0);
+    static thread_local unsigned int number = next++;
+    return number;
+}
+
+void start(const std::string &filename) {
+    std::lock_guard<std::mutex> lock(mutex);
+    output = filename;
+    events.clear();
+    origin = std::chrono::steady_clock::now();
+    recording = true;
+}
+
+bool enabled() {
+    return recording.load(std::memory_order_relaxed);
+}
+
+static void json_string(std::ostream &out, const std::string &s) {
+    out << '"';
+    for (char c : s) {
+        if (c == '"' || c == '\\') out << '\\' << c;
+        else if ((unsigned char)c < 0x20) out << ' ';
+        else out << c;
+    }
+    out << '"';
+}
+
+bool stop() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!recording) return false;
+    recording = false;
+    std::ofstream f(output.c_str());
+    if (f.fail()) return false;
+    f << "{\"traceEvents\": [" << std::endl;
+    f.precision(3);
+    f << std::fixed;
+    for (unsigned int i = 0; i < events.size(); i++) {
+        const Event &e = events[i];
+        f << (i ? ",\n" : "") << "{\"name\": ";
+        json_string(f, e.name);
+        f << ", \"ph\": \"X\", \"pid\": 1, \"tid\": " << e.thread << ", \"ts\": " << e.begin_us << ", \"dur\": " << e.duration_us;
+        if (!e.detail.empty()) {
+            f << ", \"args\": {\"detail\": ";
+            json_string(f, e.detail);
+            f << "}";
+        }
+        f << "}";
+    }
+    f << std::endl << "], \"displayTimeUnit\": \"ms\"}" << std::endl;
+    events.clear();
+    return !f.fail();
+}
+
+Span::Span(const char *name, const std::string &detail) : name(name), active(enabled()) {
+    if (!active) return;
+    this->detail = detail;
+    begin = std::chrono::steady_clock::now();
+}
+
+Span::~Span() {
+    if (!active) return;
+    std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+    Event e;
+    e.name = name;
+    e.detail = detail;
+    e.thread = thread_number();
+    std::lock_guard<std::mutex> lock(mutex);
+    // Spans still open when the recording stopped or restarted are dropped
+    if (!recording || begin < origin) return;
+    e.begin_us = std::chrono::duration<double, std::micro>(begin - origin).count();
+    e.duration_us = std::chrono::duration<double, std::micro>(end - begin).count();
+    events.push_back(e);
+}
+
+}
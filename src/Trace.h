@@ -0,0 +1,37 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <string>
+#include <chrono>
+
+// Timeline of the setup and rendering phases, written as a Chrome trace_event JSON file
+// (chrome://tracing, Perfetto). Nothing is recorded between stop() and start(), a span then costs one atomic load.
+namespace Trace {
+    void start(const std::string &filename);
+    // Writes the spans recorded since start, returns false if the file could not be written
+    bool stop();
+    bool enabled();
+
+    // Complete event on the calling thread from construction to destruction, detail is shown in its arguments
+    class Span {
+    public:
+        Span(const char *name, const std::string &detail = std::string());
+        ~Span();
+
+        Span(const Span &) = delete;
+        Span & operator = (const Span &) = delete;
+
+    private:
+        const char *name;
+        std::string detail;
+        bool active;
+        std::chrono::steady_clock::time_point begin;
+    };
+}
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+// Span until the end of the enclosing scope : TRACE_SPAN("name") or TRACE_SPAN("name", detail)
+#define TRACE_SPAN(...) Trace::Span TRACE_CONCAT(trace_span_, __LINE__)(__VA_ARGS__)
+
+#endif // TRACE_H
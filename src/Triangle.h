@@ -5,14 +5,14 @@
 #include "Plane.h"
 #include <cfloat>
 #include "AABB.h"
+#include "Vec3A.h"
 
+// Distance and barycentric coordinates only, the normal is Triangle::normal() of triangle tIndex
 struct RayTriangleIntersection{
     bool intersectionExists;
     float t;
     float w0,w1,w2;
     unsigned int tIndex;
-    Vec3 intersection;
-    Vec3 normal;
 
     RayTriangleIntersection() : intersectionExists(false) , t(FLT_MAX) {}
 };
@@ -75,54 +75,59 @@ public:
     }
 
     RayTriangleIntersection getIntersection( Ray const & ray ) const {
-        RayTriangleIntersection result;
-        float dotRN = Vec3::dot( ray.direction() , m_normal );
-        // 1) check that the ray is not parallel to the triangle:
-        if (dotRN == 0) {
-            result.intersectionExists = false;
-            result.t = FLT_MAX;
-            return result;
-        }
-
-        // Check if in front of the triangle
-        if (dotRN > 0) {
-            result.intersectionExists = false;
-            result.t = FLT_MAX;
-            return result;
-        }
-
-        // 2) check that the triangle is "in front of" the ray:
-        float D = Vec3::dot( m_c[0] , m_normal );
-        float t = ( D - Vec3::dot( ray.origin() , m_normal ) ) / dotRN;
-        if ( t < 0 ) {
-            result.intersectionExists = false;
-            result.t = FLT_MAX;
-            return result;
-        }
-
-        // 3) check that the intersection point is inside the triangle:
-        // CONVENTION: compute u,v such that p = w0*c0 + w1*c1 + w2*c2, check that 0 <= w0,w1,w2 <= 1
-        Vec3 p = ray.origin() + t * ray.direction();
+        return intersect( ray , Vec3A(m_c[0]) , Vec3A(m_c[1]) , Vec3A(m_c[2]) );
+    }
 
-        float u0,u1,u2;
-        computeBarycentricCoordinates( p , u0 , u1 , u2 );
-        
+    // Möller-Trumbore, without building a Triangle.
+    // Back faces and parallel rays are rejected, t >= 0, p = w0*c0 + w1*c1 + w2*c2 with 0 <= w0,w1,w2 <= 1
+    static RayTriangleIntersection intersect( Ray const & ray , Vec3A const & c0 , Vec3A const & c1 , Vec3A const & c2 ) {
+        RayTriangleIntersection result;
+        Vec3A e1 = c1 - c0;
+        Vec3A e2 = c2 - c0;
+        Vec3A p = Vec3A::cross( ray.direction_a , e2 );
+        float det = Vec3A::dot( e1 , p );
+        if ( !(det > 0) ) return result;
+        float invDet = 1.f / det;
+        Vec3A s = ray.origin_a - c0;
+        float w1 = Vec3A::dot( s , p ) * invDet;
+        if ( w1 < 0 || w1 > 1 ) return result;
+        Vec3A q = Vec3A::cross( s , e1 );
+        float w2 = Vec3A::dot( ray.direction_a , q ) * invDet;
+        if ( w2 < 0 || w1 + w2 > 1 ) return result;
+        float t = Vec3A::dot( e2 , q ) * invDet;
+        if ( t < 0 ) return result;
+        result.intersectionExists = true;
+        result.t = t;
+        result.w0 = 1 - w1 - w2;
+        result.w1 = w1;
+        result.w2 = w2;
+        return result;
+    }
 
-        // 4) Finally, if all conditions were met, then there is an intersection! :
-        if ( u0 >= 0 && u0 <= 1 && u1 >= 0 && u1 <= 1 && u2 >= 0 && u2 <= 1 ) {
-            result.intersectionExists = true;
-            result.t = t;
-            result.w0 = u0;
-            result.w1 = u1;
-            result.w2 = u2;
-            result.intersection = p;
-            result.normal = m_normal;
-            return result;
-        } else {
-            result.intersectionExists = false;
-            result.t = FLT_MAX;
-            return result;
-        }
+    // Same test on 4 triangles, one per lane. Returns the mask of the lanes that hit, with their t, w1, w2.
+    static int intersect4( Vec3x4 const & origin , Vec3x4 const & direction , Vec3x4 const & c0 , Vec3x4 const & c1 , Vec3x4 const & c2 ,
+                           float t[4] , float w1[4] , float w2[4] ) {
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 one = _mm_set1_ps(1.f);
+        Vec3x4 e1 = c1 - c0;
+        Vec3x4 e2 = c2 - c0;
+        Vec3x4 p = Vec3x4::cross( direction , e2 );
+        __m128 det = Vec3x4::dot( e1 , p );
+        __m128 valid = _mm_cmpgt_ps( det , zero );
+        __m128 invDet = _mm_div_ps( one , det );
+        Vec3x4 s = origin - c0;
+        __m128 u = _mm_mul_ps( Vec3x4::dot( s , p ) , invDet );
+        Vec3x4 q = Vec3x4::cross( s , e1 );
+        __m128 v = _mm_mul_ps( Vec3x4::dot( direction , q ) , invDet );
+        __m128 tt = _mm_mul_ps( Vec3x4::dot( e2 , q ) , invDet );
+        valid = _mm_and_ps( valid , _mm_cmpge_ps( u , zero ) );
+        valid = _mm_and_ps( valid , _mm_cmpge_ps( v , zero ) );
+        valid = _mm_and_ps( valid , _mm_cmple_ps( _mm_add_ps( u , v ) , one ) );
+        valid = _mm_and_ps( valid , _mm_cmpge_ps( tt , zero ) );
+        _mm_storeu_ps( t , tt );
+        _mm_storeu_ps( w1 , u );
+        _mm_storeu_ps( w2 , v );
+        return _mm_movemask_ps( valid );
     }
 
     AABB getAABB() {
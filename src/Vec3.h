@@ -20,12 +20,10 @@ public:
     Vec3( float f ) {
        mVals[0] = f; mVals[1] = f; mVals[2] = f;
     }
+    const float * data() const { return mVals; }
     float & operator [] (unsigned int c) { return mVals[c]; }
     float operator [] (unsigned int c) const { return mVals[c]; }
-    Vec3 operator = (Vec3 const & other) {
-       mVals[0] = other[0] ; mVals[1] = other[1]; mVals[2] = other[2];
-       return *this;
-    }
+    Vec3 & operator = (Vec3 const & other) = default;
     float squareLength() const {
        return mVals[0]*mVals[0] + mVals[1]*mVals[1] + mVals[2]*mVals[2];
     }
@@ -34,7 +32,7 @@ public:
     float norm() const { return length(); }
     inline
     float squareNorm() const { return squareLength(); }
-    void normalize() { float L = length(); mVals[0] /= L; mVals[1] /= L; mVals[2] /= L; }
+    void normalize() { float invL = 1.f / length(); mVals[0] *= invL; mVals[1] *= invL; mVals[2] *= invL; }
     static float dot( Vec3 const & a , Vec3 const & b ) {
        return a[0]*b[0] + a[1]*b[1] + a[2]*b[2];
     }
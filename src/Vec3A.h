@@ -0,0 +1,106 @@
+#ifndef VEC3A_H
+#define VEC3A_H
+
+#include "Vec3.h"
+
+#include <immintrin.h>
+
+// SIMD vector types for the intersection code (SSE2 minimum, SSE4.1 used when enabled, see ARCHFLAGS in the Makefile).
+//   Vec3A  : one Vec3 padded to 4 floats in a register, the 4th lane is kept at 0
+//   Vec3x4 : 4 Vec3 in SoA layout (x0..x3, y0..y3, z0..z3), one per lane
+// Vec3 stays the storage type, these are built from it in the hot loops. Shading stays on Vec3.
+
+#ifndef __SSE2__
+#error "Vec3A.h requires SSE2"
+#endif
+
+struct Vec3A {
+    __m128 v;
+
+    Vec3A() : v(_mm_setzero_ps()) {}
+    Vec3A(__m128 v) : v(v) {}
+    Vec3A(float x, float y, float z) : v(_mm_set_ps(0.f, z, y, x)) {}
+    explicit Vec3A(float f) : v(_mm_set_ps(0.f, f, f, f)) {}
+    // x, y in one 64 bits load (__m64 may alias the floats, no alignment needed) and z in the low lane of a second one
+    Vec3A(const Vec3 & a) : v(_mm_movelh_ps(_mm_loadl_pi(_mm_setzero_ps(), (const __m64 *)a.data()), _mm_load_ss(a.data() + 2))) {}
+
+    Vec3 toVec3() const {
+        alignas(16) float f[4];
+        _mm_store_ps(f, v);
+        return Vec3(f[0], f[1], f[2]);
+    }
+    float x() const { return _mm_cvtss_f32(v); }
+    float y() const { return _mm_cvtss_f32(_mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 1, 1, 1))); }
+    float z() const { return _mm_cvtss_f32(_mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 2, 2, 2))); }
+
+    static float dot(const Vec3A & a, const Vec3A & b) {
+#ifdef __SSE4_1__
+        return _mm_cvtss_f32(_mm_dp_ps(a.v, b.v, 0x71));
+#else
+        __m128 m = _mm_mul_ps(a.v, b.v);
+        __m128 s = _mm_add_ss(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(1, 1, 1, 1)));
+        return _mm_cvtss_f32(_mm_add_ss(s, _mm_movehl_ps(m, m)));
+#endif
+    }
+    static Vec3A cross(const Vec3A & a, const Vec3A & b) {
+        __m128 a_yzx = _mm_shuffle_ps(a.v, a.v, _MM_SHUFFLE(3, 0, 2, 1));
+        __m128 b_yzx = _mm_shuffle_ps(b.v, b.v, _MM_SHUFFLE(3, 0, 2, 1));
+        __m128 c = _mm_sub_ps(_mm_mul_ps(a.v, b_yzx), _mm_mul_ps(a_yzx, b.v));
+        return Vec3A(_mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 0, 2, 1)));
+    }
+    static Vec3A min(const Vec3A & a, const Vec3A & b) { return Vec3A(_mm_min_ps(a.v, b.v)); }
+    static Vec3A max(const Vec3A & a, const Vec3A & b) { return Vec3A(_mm_max_ps(a.v, b.v)); }
+
+    // Largest / smallest of the 3 components
+    float hmax() const {
+        __m128 m = _mm_max_ss(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 1, 1, 1)));
+        return _mm_cvtss_f32(_mm_max_ss(m, _mm_movehl_ps(v, v)));
+    }
+    float hmin() const {
+        __m128 m = _mm_min_ss(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 1, 1, 1)));
+        return _mm_cvtss_f32(_mm_min_ss(m, _mm_movehl_ps(v, v)));
+    }
+
+    float squareLength() const { return dot(*this, *this); }
+    float length() const { return sqrtf(squareLength()); }
+    void normalize() { v = _mm_mul_ps(v, _mm_set1_ps(1.f / length())); }
+
+    void operator += (const Vec3A & o) { v = _mm_add_ps(v, o.v); }
+    void operator -= (const Vec3A & o) { v = _mm_sub_ps(v, o.v); }
+    void operator *= (float s) { v = _mm_mul_ps(v, _mm_set1_ps(s)); }
+};
+
+static inline Vec3A operator + (const Vec3A & a, const Vec3A & b) { return Vec3A(_mm_add_ps(a.v, b.v)); }
+static inline Vec3A operator - (const Vec3A & a, const Vec3A & b) { return Vec3A(_mm_sub_ps(a.v, b.v)); }
+static inline Vec3A operator * (const Vec3A & a, const Vec3A & b) { return Vec3A(_mm_mul_ps(a.v, b.v)); }
+static inline Vec3A operator * (float s, const Vec3A & a) { return Vec3A(_mm_mul_ps(_mm_set1_ps(s), a.v)); }
+static inline Vec3A operator * (const Vec3A & a, float s) { return Vec3A(_mm_mul_ps(a.v, _mm_set1_ps(s))); }
+
+
+struct Vec3x4 {
+    __m128 x, y, z;
+
+    Vec3x4() : x(_mm_setzero_ps()), y(_mm_setzero_ps()), z(_mm_setzero_ps()) {}
+    Vec3x4(__m128 x, __m128 y, __m128 z) : x(x), y(y), z(z) {}
+    // Same vector in every lane
+    Vec3x4(const Vec3 & a) : x(_mm_set1_ps(a[0])), y(_mm_set1_ps(a[1])), z(_mm_set1_ps(a[2])) {}
+    Vec3x4(const Vec3 & a, const Vec3 & b, const Vec3 & c, const Vec3 & d) :
+        x(_mm_set_ps(d[0], c[0], b[0], a[0])),
+        y(_mm_set_ps(d[1], c[1], b[1], a[1])),
+        z(_mm_set_ps(d[2], c[2], b[2], a[2])) {}
+
+    static __m128 dot(const Vec3x4 & a, const Vec3x4 & b) {
+        return _mm_add_ps(_mm_add_ps(_mm_mul_ps(a.x, b.x), _mm_mul_ps(a.y, b.y)), _mm_mul_ps(a.z, b.z));
+    }
+    static Vec3x4 cross(const Vec3x4 & a, const Vec3x4 & b) {
+        return Vec3x4(_mm_sub_ps(_mm_mul_ps(a.y, b.z), _mm_mul_ps(a.z, b.y)),
+                      _mm_sub_ps(_mm_mul_ps(a.z, b.x), _mm_mul_ps(a.x, b.z)),
+                      _mm_sub_ps(_mm_mul_ps(a.x, b.y), _mm_mul_ps(a.y, b.x)));
+    }
+};
+
+static inline Vec3x4 operator + (const Vec3x4 & a, const Vec3x4 & b) { return Vec3x4(_mm_add_ps(a.x, b.x), _mm_add_ps(a.y, b.y), _mm_add_ps(a.z, b.z)); }
+static inline Vec3x4 operator - (const Vec3x4 & a, const Vec3x4 & b) { return Vec3x4(_mm_sub_ps(a.x, b.x), _mm_sub_ps(a.y, b.y), _mm_sub_ps(a.z, b.z)); }
+static inline Vec3x4 operator * (__m128 s, const Vec3x4 & a) { return Vec3x4(_mm_mul_ps(s, a.x), _mm_mul_ps(s, a.y), _mm_mul_ps(s, a.z)); }
+
+#endif // VEC3A_H
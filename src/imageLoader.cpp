@@ -1,5 +1,9 @@
 
 #include "imageLoader.h"
+#include "Constants.h"
+
+#include <cmath>
+#include <array>
 
 // Source courtesy of J. Manson
 // http://josiahmanson.com/prose/optimize_ppm/
@@ -78,6 +82,8 @@ void load_ppm(ImageRGB &img, const string &name)
 
     // load image data
     img.data.resize(img.w * img.h);
+    img.pixels = img.data.data();
+    img.file.reset();
 
     if (mode == 6)
     {
@@ -103,6 +109,153 @@ void load_ppm(ImageRGB &img, const string &name)
 }
 
 
+// Skips whitespaces and comments in a mapped header
+static size_t skip_blanks(const unsigned char *d, size_t size, size_t i)
+{
+    while (i < size) {
+        if (d[i] == '#') {
+            while (i < size && d[i] != '\n') i++;
+        } else if (d[i] == ' ' || d[i] == '\t' || d[i] == '\n' || d[i] == '\r') {
+            i++;
+        } else {
+            break;
+        }
+    }
+    return i;
+}
+
+static size_t read_int(const unsigned char *d, size_t size, size_t i, int &value)
+{
+    value = 0;
+    i = skip_blanks(d, size, i);
+    size_t start = i;
+    while (i < size && d[i] >= '0' && d[i] <= '9' && value < 100000000) {
+        value = value * 10 + (d[i] - '0');
+        i++;
+    }
+    if (i == start) value = -1;
+    return i;
+}
+
+void map_ppm(ImageRGB &img, const string &name)
+{
+    shared_ptr<MappedFile> file = make_shared<MappedFile>(name);
+    if (!file->is_open())
+    {
+        cout << "Could not open file: " << name << endl;
+        return;
+    }
+    const unsigned char *d = file->data();
+    size_t size = file->size();
+
+    size_t i = skip_blanks(d, size, 0);
+    if (i + 2 > size || d[i] != 'P' || d[i + 1] != '6')
+    {
+        load_ppm(img, name);
+        return;
+    }
+    int w, h, bits;
+    i = read_int(d, size, i + 2, w);
+    i = read_int(d, size, i, h);
+    i = read_int(d, size, i, bits);
+    // a single whitespace separates the header from the data
+    i++;
+    if (w < 1 || h < 1 || bits != 255 || i + 3 * (size_t)w * h > size)
+    {
+        load_ppm(img, name);
+        return;
+    }
+    img.w = w;
+    img.h = h;
+    img.data.clear();
+    img.pixels = (const RGB *)(d + i);
+    img.file = file;
+}
+
+
+// 8 bits value -> linear value, filled once by a thread safe static initialization
+static const float * srgb_table()
+{
+    static const std::array<float, 256> table = []()
+    {
+        std::array<float, 256> t;
+        for (int i = 0; i < 256; i++)
+        {
+            float c = i / 255.f;
+#if TEXTURE_SRGB_DECODE
+            t[i] = c <= 0.04045f ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+#else
+            t[i] = c;
+#endif
+        }
+        return t;
+    }();
+    return table.data();
+}
+
+static ImageLevel make_level(int w, int h, const Vec3 *texels)
+{
+    ImageLevel level;
+    level.w = w;
+    level.h = h;
+    level.mask_x = (w & (w - 1)) == 0 ? w - 1 : -1;
+    level.mask_y = (h & (h - 1)) == 0 ? h - 1 : -1;
+    level.texels = texels;
+    return level;
+}
+
+void build_texture(ImageRGB &img, TextureFormat format)
+{
+    img.levels.clear();
+    img.level_data.clear();
+    if (img.w < 1 || img.h < 1 || !img.pixels)
+        return;
+
+    unsigned int nLevels = 1;
+    for (int size = max(img.w, img.h); size > 1; size /= 2)
+        nLevels++;
+    img.levels.reserve(nLevels);
+    img.level_data.reserve(nLevels);
+
+    img.level_data.emplace_back((size_t)img.w * img.h);
+    vector<Vec3> &base = img.level_data.back();
+    const float *table = srgb_table();
+    for (size_t i = 0; i < base.size(); i++)
+    {
+        const RGB &p = img.pixels[i];
+        if (format == TextureFormat_Normal)
+            base[i] = Vec3(p.r / 127.5f - 1.f, p.g / 127.5f - 1.f, p.b / 127.5f - 1.f);
+        else
+            base[i] = Vec3(table[p.r], table[p.g], table[p.b]);
+    }
+    img.levels.push_back(make_level(img.w, img.h, base.data()));
+
+    // the 8 bits source is not needed anymore
+    img.pixels = nullptr;
+    img.data = vector<RGB>();
+    img.file.reset();
+
+    while (img.levels.back().w > 1 || img.levels.back().h > 1)
+    {
+        const ImageLevel prev = img.levels.back();
+        int w = max(1, prev.w / 2), h = max(1, prev.h / 2);
+        img.level_data.emplace_back((size_t)w * h);
+        vector<Vec3> &level = img.level_data.back();
+        for (int y = 0; y < h; y++)
+        {
+            int y0 = min(2 * y, prev.h - 1), y1 = min(2 * y + 1, prev.h - 1);
+            for (int x = 0; x < w; x++)
+            {
+                int x0 = min(2 * x, prev.w - 1), x1 = min(2 * x + 1, prev.w - 1);
+                level[y * w + x] = 0.25f * (prev.texels[y0 * prev.w + x0] + prev.texels[y0 * prev.w + x1]
+                                          + prev.texels[y1 * prev.w + x0] + prev.texels[y1 * prev.w + x1]);
+            }
+        }
+        img.levels.push_back(make_level(w, h, level.data()));
+    }
+}
+
+
 void load_ppm( unsigned char * & pixels , unsigned int & w , unsigned int & h , const string &name , loadedFormat format)
 {
     ifstream f(name.c_str(), ios::binary);
@@ -5,6 +5,9 @@
 #include <vector>
 #include <iostream>
 #include <fstream>
+#include <memory>
+#include "MappedFile.h"
+#include "Vec3.h"
 
 // Source courtesy of J. Manson
 // http://josiahmanson.com/prose/optimize_ppm/
@@ -19,14 +22,45 @@ struct RGB
     unsigned char r, g, b;
 };
 
+// How build_texture decodes the 8 bits pixels
+enum TextureFormat
+{
+    TextureFormat_Color,  // linear RGB in [0, 1], sRGB decoded if TEXTURE_SRGB_DECODE is set
+    TextureFormat_Normal  // normal map, unpacked to [-1, 1]
+};
+
+// One level of the mip pyramid, one decoded Vec3 per texel
+struct ImageLevel
+{
+    int w, h;
+    int mask_x, mask_y; // w - 1 and h - 1 for power of two sizes (wrap with &), -1 otherwise
+    const Vec3 *texels;
+};
+
+// pixels points either into data, or directly into a memory-mapped P6 file (see map_ppm).
+// build_texture decodes them into levels and releases them.
 struct ImageRGB
 {
     int w, h;
+    const RGB *pixels;
     vector<RGB> data;
+    shared_ptr<MappedFile> file;
+
+    // Mip pyramid (see build_texture) : levels[0] is the full size image, each level points into level_data
+    vector<ImageLevel> levels;
+    vector< vector<Vec3> > level_data;
+
+    ImageRGB() : w(0), h(0), pixels(nullptr) {}
+    ImageRGB(const ImageRGB &) = delete;
+    ImageRGB & operator = (const ImageRGB &) = delete;
 };
 
 
 void load_ppm(ImageRGB &img, const string &name);
+// Maps binary 8 bits P6 files without copying them, falls back to load_ppm for the other formats
+void map_ppm(ImageRGB &img, const string &name);
+// Decodes the pixels into levels[0] and builds the levels down to 1x1, each texel is the average of 2x2 texels of the previous level
+void build_texture(ImageRGB &img, TextureFormat format);
 
 
 enum loadedFormat {